@@ -118,6 +118,39 @@ def expected_counts_segment(
     return counts_list
 
 
+def segment_native(
+        words_file,
+        fasttext: FastText,
+        subwords: List[str],
+        subword_embeddings: np.ndarray,
+        batch_size: int) -> None:
+    from legros._native import CosineSegmenter
+
+    segmenter = CosineSegmenter(
+        subwords, subword_embeddings.astype(np.float32))
+
+    def vector(word):
+        try:
+            return fasttext[word]
+        except KeyError:
+            return fasttext.vectors.mean(0)
+
+    def process(words):
+        if not words:
+            return
+        vectors = np.stack([vector(word) for word in words])
+        for segmentation in segmenter.segment_batch(words, vectors):
+            print(" ".join(segmentation))
+
+    words = []
+    for line in words_file:
+        words.append(line.strip())
+        if len(words) == batch_size:
+            process(words)
+            words = []
+    process(words)
+
+
 def main():
     parser = argparse.ArgumentParser(__doc__)
     parser.add_argument("fasttext", help="W2V/FastText model from Gensim.")
@@ -152,8 +185,22 @@ def main():
         "--bert-wordpiece", default=False, action="store_true",
         help="Set for tokenizer based BER's WordPiece.",
         required=False)
+    parser.add_argument(
+        "--native", default=False, action="store_true",
+        help="Segment in batches with the native cosine segmenter "
+             "(legros._native), which scores out-of-vocabulary characters "
+             "with similarity -1 like legros-train.")
+    parser.add_argument(
+        "--batch-size", type=int, default=10000,
+        help="Words per batch for the native segmenter.")
     args = parser.parse_args()
 
+    if args.native and (
+            args.sample or args.expected_counts or args.excluded
+            or args.bert_wordpiece or args.inference_mode != "sum"):
+        parser.error(
+            "--native only supports plain segmentation in the 'sum' mode.")
+
     logging.info("Load word embeddings model from %s.", args.fasttext)
     if args.embeddings_type == "fasttext":
         fasttext = FastText.load(args.fasttext).wv
@@ -193,6 +240,15 @@ def main():
 
     subwrd2idx = {s: i for i, s in enumerate(subwords)}
 
+    if args.native:
+        logging.info("Segment words with the native segmenter.")
+        segment_native(
+            args.input, fasttext, subwords, subword_embeddings,
+            args.batch_size)
+        args.input.close()
+        logging.info("Done.")
+        return
+
     logging.info("Segment words.")
     for line in args.input:
         if args.expected_counts:
@@ -0,0 +1,89 @@
+"""Helpers for tests of the native (C++) tools."""
+
+import os
+import random
+import subprocess
+import tempfile
+import unittest
+
+
+BUILD_DIR = os.environ.get(
+    "LEGROS_BUILD_DIR",
+    os.path.join(os.path.dirname(__file__), "..", "..", "..", "build"))
+
+
+def binary(name: str) -> str:
+    """Path to a native binary; skips the test if it has not been built."""
+    path = os.path.join(BUILD_DIR, name)
+    if not os.access(path, os.X_OK):
+        raise unittest.SkipTest(
+            f"'{name}' not found in {BUILD_DIR}, set LEGROS_BUILD_DIR.")
+    return path
+
+
+def run(name: str, *args: str, stdin: str = "", env=None) -> str:
+    """Runs a native binary and returns its standard output."""
+    full_env = None
+    if env is not None:
+        full_env = dict(os.environ, **env)
+    result = subprocess.run(
+        [binary(name), *args], input=stdin.encode("utf-8"),
+        stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+        env=full_env, check=True)
+    return result.stdout.decode("utf-8")
+
+
+# A tiny bigram model in the format written by legros-train.
+UNIGRAMS = {
+    "<w>": 20, "</w>": 0, "wal": 6, "rus": 6, "walrus": 2, "es": 3,
+    "sea": 4, "l": 1, "ion": 2, "s": 5, "▁": 2, "▁wal": 3,
+}
+BIGRAMS = [
+    ("<w>", "wal", 4), ("wal", "rus", 5), ("rus", "es", 2),
+    ("<w>", "sea", 4), ("sea", "l", 3), ("l", "ion", 2), ("ion", "s", 2),
+    ("<w>", "walrus", 2), ("<w>", "▁wal", 3), ("▁wal", "rus", 3),
+]
+SENTENCES = [
+    "walrus walruses sea lions",
+    "sealions and walruses",
+    "",
+    "walrus  rus",
+    "mořský lev",
+]
+
+
+def write_bigram_model(directory: str):
+    """Writes the tiny model, returns paths to bigram and unigram stats."""
+    bigrams = os.path.join(directory, "bigram_stats")
+    unigrams = os.path.join(directory, "unigram_stats")
+    with open(unigrams, "w", encoding="utf-8") as f_uni:
+        for subword, count in UNIGRAMS.items():
+            print(f"{subword}\t{count}", file=f_uni)
+    with open(bigrams, "w", encoding="utf-8") as f_bi:
+        for prev, subword, count in BIGRAMS:
+            print(f"{prev}\t{subword}\t{count}", file=f_bi)
+    return bigrams, unigrams
+
+
+class NativeTestCase(unittest.TestCase):
+    """Test case with a temporary directory and a random generator seeded
+    with the `seed` of the class."""
+
+    seed = 0
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.rng = random.Random(self.seed)
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def path(self, *names: str) -> str:
+        return os.path.join(self.tmp.name, *names)
+
+    def write(self, name: str, lines) -> str:
+        """Writes the lines to a file in the temporary directory."""
+        with open(self.path(name), "w", encoding="utf-8") as f_out:
+            for line in lines:
+                print(line, file=f_out)
+        return self.path(name)
@@ -0,0 +1,122 @@
+import math
+import struct
+import subprocess
+import unittest
+
+from legros.tests.native import NativeTestCase, run
+
+
+def normalize(vector):
+    norm = math.sqrt(sum(x * x for x in vector))
+    return [x / norm for x in vector]
+
+
+class TestNativeAnn(NativeTestCase):
+
+    seed = 4
+
+    def setUp(self):
+        super().setUp()
+        rng = self.rng
+        dim = 8
+        self.subwords = ["<w>", "</w>"] + [f"sub{i}" for i in range(600)]
+        self.vectors = [[rng.gauss(0, 1) for _ in range(dim)]
+                        for _ in self.subwords]
+        # the last subword is a near duplicate of sub7
+        self.vectors[-1] = [x + rng.gauss(0, 1e-3) for x in self.vectors[9]]
+
+        self.subword_path = self.write("subwords.0", self.subwords)
+        self.embeddings = self.write("subword_embeddings.0", [
+            " ".join(f"{x:.6f}" for x in vector) for vector in self.vectors])
+        self.normalized = [normalize(vector) for vector in self.vectors]
+
+    def build(self, threads=1):
+        index = self.path(f"index{threads}")
+        run("legros-ann", "build", self.embeddings, "-o", index,
+            "--m", "8", env={"OMP_NUM_THREADS": str(threads)})
+        return index
+
+    def exact_neighbors(self, query, k):
+        q = self.subwords.index(query)
+        similarities = sorted(
+            ((sum(a * b for a, b in zip(self.normalized[q], vector)), i)
+             for i, vector in enumerate(self.normalized)
+             if i != q and i > 1),
+            reverse=True)
+        return [self.subwords[i] for _, i in similarities[:k]]
+
+    def neighbors(self, index, *args, stdin=""):
+        output = run("legros-ann", "neighbors", self.subword_path, index,
+                     *args, stdin=stdin)
+        result = {}
+        for line in output.splitlines():
+            query, neighbor, similarity = line.split("\t")
+            result.setdefault(query, []).append((neighbor, float(similarity)))
+        return result
+
+    def test_recall(self):
+        for threads in [1, 4]:
+            with self.subTest(threads=threads):
+                result = self.neighbors(
+                    self.build(threads), "--all", "-k", "5")
+                self.assertEqual(len(result), len(self.subwords) - 2)
+                found = 0
+                for query, neighbors in result.items():
+                    self.assertEqual(len(neighbors), 5)
+                    found += len(set(self.exact_neighbors(query, 5))
+                                 & {neighbor for neighbor, _ in neighbors})
+                self.assertGreater(found / (5 * len(result)), 0.95)
+
+    def test_queries_from_input(self):
+        result = self.neighbors(
+            self.build(), "-k", "3", stdin="sub7\nunknown\nsub10\n")
+        self.assertEqual(list(result), ["sub7", "sub10"])
+        self.assertEqual(
+            [neighbor for neighbor, _ in result["sub10"]],
+            self.exact_neighbors("sub10", 3))
+        neighbor, similarity = result["sub7"][0]
+        self.assertEqual(neighbor, self.subwords[-1])
+        self.assertAlmostEqual(similarity, 1.0, places=3)
+
+    def test_redundancy(self):
+        output = run("legros-ann", "redundancy", self.subword_path,
+                     self.build())
+        lines = [line.split("\t") for line in output.splitlines()]
+        self.assertEqual(len(lines), len(self.subwords) - 2)
+        self.assertEqual(
+            {lines[0][1], lines[0][2]}, {"sub7", self.subwords[-1]})
+        self.assertLess(float(lines[0][0]), 1e-3)
+        distances = [float(line[0]) for line in lines]
+        self.assertEqual(distances, sorted(distances))
+        for line in lines:
+            digits = line[0].split("e")[0].replace(".", "").lstrip("-0")
+            self.assertLessEqual(len(digits), 5, line[0])
+
+    def test_corrupted_index_fails(self):
+        index = self.build()
+        with open(index, "rb") as f_index:
+            data = f_index.read()
+        # the header: magic, version, count, dimension, m, max_level,
+        # entry_point and upper_links, then the upper offsets, the vectors
+        # and the levels before the bottom links
+        count, dim = struct.unpack_from("<II", data, 12)
+        levels = 40 + 8 * (count + 1) + 4 * count * dim
+        bottom = levels + 4 * count
+        self.assertGreater(struct.unpack_from("<I", data, bottom)[0], 0)
+        corruptions = [(28, count),  # entry point
+                       (20, 1),  # m
+                       (levels, 1000),  # level of the first item
+                       (bottom + 4, count)]  # first link of the first item
+        for offset, value in corruptions:
+            corrupted = bytearray(data)
+            struct.pack_into("<I", corrupted, offset, value)
+            with open(index, "wb") as f_index:
+                f_index.write(corrupted)
+            with self.assertRaises(subprocess.CalledProcessError) as context:
+                run("legros-ann", "neighbors", self.subword_path, index,
+                    stdin="sub7\n")
+            self.assertEqual(context.exception.returncode, 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,83 @@
+import tempfile
+import threading
+import unittest
+
+from legros.tests.native import SENTENCES, run, write_bigram_model
+
+try:
+    from legros import _native
+except ImportError:
+    _native = None
+
+
+@unittest.skipIf(_native is None, "legros._native has not been built.")
+class TestNativeBindings(unittest.TestCase):
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.model = write_bigram_model(self.tmp.name)
+        self.text = "\n".join(SENTENCES) + "\n"
+        self.segmenter = _native.BigramSegmenter(*self.model)
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def cli_ids(self):
+        ids = run("legros", *self.model, "--output-format", "ids",
+                  stdin=self.text)
+        return [[int(i) for i in line.split()]
+                for line in ids.split("\n")[:-1]]
+
+    def test_segment_batch_matches_cli(self):
+        expected = self.cli_ids()
+        batch = self.segmenter.segment_batch(SENTENCES)
+        self.assertEqual([list(ids) for ids in batch], expected)
+        self.assertEqual(
+            [list(self.segmenter.segment(line)) for line in SENTENCES],
+            expected)
+
+    def test_segment_tokens_matches_cli(self):
+        expected = [
+            [subword.replace("@@", "") for subword in line.split()]
+            for line in run("legros", *self.model,
+                            stdin=self.text).split("\n")[:-1]]
+        segmentations = iter(self.segmenter.segment_tokens(
+            [token for sentence in SENTENCES for token in sentence.split()]))
+        self.assertEqual(
+            [[subword for _ in sentence.split()
+              for subword in next(segmentations)]
+             for sentence in SENTENCES],
+            expected)
+
+    def test_segment_batch_in_threads(self):
+        # the batches release the GIL, so the threads run them concurrently
+        expected = [list(ids) for ids in self.segmenter.segment_batch(
+            SENTENCES * 100)]
+        results = [None] * 4
+
+        def segment(k):
+            results[k] = [list(ids) for ids in self.segmenter.segment_batch(
+                SENTENCES * 100)]
+
+        threads = [threading.Thread(target=segment, args=(k,))
+                   for k in range(len(results))]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(results, [expected] * len(results))
+
+    def test_cosine_segment_checks_dimension(self):
+        segmenter = _native.CosineSegmenter(
+            ["<w>", "</w>", "wal", "rus"],
+            [[1.0, 0.0], [0.0, 1.0], [1.0, 1.0], [1.0, -1.0]])
+        self.assertEqual(segmenter.segment("walrus", [1.0, 0.5]),
+                         ["wal", "rus"])
+        with self.assertRaises(ValueError):
+            segmenter.segment("walrus", [1.0, 0.5, 0.0])
+        with self.assertRaises(ValueError):
+            segmenter.segment_batch(["walrus"], [[1.0, 0.5, 0.0]])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,186 @@
+import collections
+import os
+import struct
+import subprocess
+import unittest
+
+from legros.tests.native import NativeTestCase, run
+
+
+HEADER = struct.Struct("<8sIIQQQQQ")
+PAIR = struct.Struct("<IIQ")
+
+
+def read_counts(path):
+    """Reads a counts file, returns the header, frequencies and pairs."""
+    with open(path, "rb") as f_counts:
+        data = f_counts.read()
+    (magic, _, window_size, vocabulary_size, _,
+     lines, tokens, pairs) = HEADER.unpack_from(data)
+    assert magic == b"LEGROSWC"
+    offset = HEADER.size
+    frequencies = list(struct.unpack_from(f"<{vocabulary_size}Q", data, offset))
+    offset += 8 * vocabulary_size
+    counts = {}
+    for i in range(pairs):
+        word, context, count = PAIR.unpack_from(data, offset + i * PAIR.size)
+        counts[word, context] = count
+    header = {"window_size": window_size, "lines": lines, "tokens": tokens}
+    return header, frequencies, counts
+
+
+def reference_counts(lines, words, window_size):
+    """Word frequencies and cooccurrences counted as in the training."""
+    index = {word: i for i, word in enumerate(words)}
+    frequencies = [0] * len(words)
+    counts = collections.Counter()
+    for line in lines:
+        tokens = line.split()
+        for t, token in enumerate(tokens):
+            if token not in index:
+                continue
+            frequencies[index[token]] += 1
+            for j in range(max(0, t - window_size),
+                           min(len(tokens), t + window_size + 1)):
+                if j != t and tokens[j] in index:
+                    counts[index[tokens[j]], index[token]] += 1
+    return frequencies, dict(counts)
+
+
+class TestNativeCount(NativeTestCase):
+
+    seed = 0
+
+    def setUp(self):
+        super().setUp()
+        rng = self.rng
+        self.words = ["walrus", "seal", "lion", "sea", "ice", "fish", "the"]
+        tokens = self.words + ["oov", "unknown"]
+        weights = [8, 5, 4, 3, 2, 2, 10, 1, 1]
+        self.lines = [
+            " ".join(rng.choices(tokens, weights, k=rng.randint(0, 12)))
+            for _ in range(200)]
+        self.vocabulary = self.write("vocab.txt", self.words)
+
+    def count(self, name, lines, *args, threads=None):
+        corpus = self.write(name + ".txt", lines)
+        env = None if threads is None else {"OMP_NUM_THREADS": str(threads)}
+        run("legros-count", corpus, self.vocabulary, "-o", self.path(name),
+            *args, env=env)
+        return self.path(name)
+
+    def test_counts_match_reference(self):
+        header, frequencies, counts = read_counts(
+            self.count("full", self.lines, "--window-size", "2"))
+        expected_frequencies, expected_counts = reference_counts(
+            self.lines, self.words, 2)
+        self.assertEqual(header["window_size"], 2)
+        self.assertEqual(header["lines"], len(self.lines))
+        self.assertEqual(
+            header["tokens"], sum(len(line.split()) for line in self.lines))
+        self.assertEqual(frequencies, expected_frequencies)
+        self.assertEqual(counts, expected_counts)
+
+    def test_thread_count_does_not_change_counts(self):
+        lines = self.lines * 50
+        single = self.count("single", lines, threads=1)
+        with open(single, "rb") as f_single:
+            expected = f_single.read()
+        for threads in [2, 4, 7]:
+            multi = self.count(f"threads{threads}", lines, threads=threads)
+            with open(multi, "rb") as f_multi:
+                self.assertEqual(f_multi.read(), expected)
+
+        _, frequencies, _ = read_counts(single)
+        expected_frequencies, _ = reference_counts(lines, self.words, 3)
+        self.assertEqual(frequencies, expected_frequencies)
+
+    def test_merged_shards_equal_full_corpus(self):
+        full = self.count("full", self.lines)
+        shards = [
+            self.count(f"shard{i}", self.lines[begin:end])
+            for i, (begin, end) in enumerate([(0, 37), (37, 150), (150, 200)])]
+        merged = self.path("merged")
+        run("legros-merge", *shards, "-o", merged)
+        with open(full, "rb") as f_full, open(merged, "rb") as f_merged:
+            self.assertEqual(f_merged.read(), f_full.read())
+
+        # merging is associative, so the shards can be merged in a tree
+        partial = self.path("partial")
+        run("legros-merge", *shards[:2], "-o", partial)
+        run("legros-merge", partial, shards[2], "-o", self.path("tree"))
+        with open(self.path("tree"), "rb") as f_tree, \
+                open(merged, "rb") as f_merged:
+            self.assertEqual(f_tree.read(), f_merged.read())
+
+    def test_min_count_filtering(self):
+        shards = [self.count("shard0", self.lines[:100]),
+                  self.count("shard1", self.lines[100:])]
+        run("legros-merge", *shards, "-o", self.path("merged"),
+            "--min-count", "20", "--min-word-count", "100")
+        _, frequencies, counts = read_counts(self.path("merged"))
+        expected_frequencies, expected_counts = reference_counts(
+            self.lines, self.words, 3)
+        self.assertEqual(frequencies, expected_frequencies)
+        self.assertEqual(counts, {
+            pair: count for pair, count in expected_counts.items()
+            if count >= 20 and frequencies[pair[0]] >= 100
+            and frequencies[pair[1]] >= 100})
+        self.assertNotEqual(counts, {})
+
+    def test_mismatched_shards_fail(self):
+        shard = self.count("shard", self.lines)
+        other = self.count("other", self.lines, "--window-size", "5")
+        with self.assertRaises(subprocess.CalledProcessError):
+            run("legros-merge", shard, other, "-o", self.path("merged"))
+
+    def test_corrupted_counts_fail(self):
+        counts = self.count("counts", self.lines)
+        with open(counts, "rb") as f_counts:
+            data = f_counts.read()
+        pairs = HEADER.size + 8 * len(self.words)
+        first = data[pairs:pairs + PAIR.size]
+        second = data[pairs + PAIR.size:pairs + 2 * PAIR.size]
+        corruptions = [
+            data[:16] + struct.pack("<Q", 2 ** 40) + data[24:],  # words
+            data[:48] + struct.pack("<Q", 2 ** 40) + data[56:],  # pairs
+            data[:-PAIR.size // 2],  # truncated
+            data[:pairs] + PAIR.pack(len(self.words), 0, 1)
+            + data[pairs + PAIR.size:],  # a word out of the vocabulary
+            data[:pairs] + second + first
+            + data[pairs + 2 * PAIR.size:]]  # pairs out of order
+        for corrupted in corruptions:
+            with open(counts, "wb") as f_counts:
+                f_counts.write(corrupted)
+            with self.assertRaises(subprocess.CalledProcessError) as context:
+                run("legros-merge", counts, "-o", self.path("merged"))
+            self.assertEqual(context.exception.returncode, 1)
+
+    def test_counts_beyond_int_fail_in_training(self):
+        counts = self.count("counts", self.lines)
+        embeddings = self.write("embeddings.txt", [f"{len(self.words)} 2"] + [
+            f"{word} 0.5 {i}" for i, word in enumerate(self.words)])
+        allowed = self.write("allowed.txt", [
+            f"{word} {word} {word[0]}" for word in self.words])
+        output = self.path("output")
+        os.mkdir(output)
+
+        def train():
+            run("legros-train", embeddings, "--word-counts", counts,
+                "--allowed-substrings", allowed, "--fasttext-dim", "2",
+                "--output-directory", output)
+
+        train()
+        with open(counts, "rb") as f_counts:
+            data = bytearray(f_counts.read())
+        pairs = HEADER.size + 8 * len(self.words)
+        word, context, _ = PAIR.unpack_from(data, pairs)
+        PAIR.pack_into(data, pairs, word, context, 2 ** 31)
+        with open(counts, "wb") as f_counts:
+            f_counts.write(data)
+        with self.assertRaises(subprocess.CalledProcessError) as context:
+            train()
+        self.assertEqual(context.exception.returncode, 1)
+
+if __name__ == "__main__":
+    unittest.main()
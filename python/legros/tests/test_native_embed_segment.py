@@ -0,0 +1,206 @@
+import math
+import struct
+import subprocess
+import unittest
+
+from legros.tests.native import NativeTestCase, run
+
+
+def cosine(x, y):
+    dot = sum(a * b for a, b in zip(x, y))
+    return dot / math.sqrt(sum(a * a for a in x) * sum(b * b for b in y))
+
+
+def reference_segment(word, vector, subwords, embeddings, mode):
+    """The Viterbi decoding of legros-train with the modes of
+    unigram_segment.py; a single out-of-vocabulary character scores -1."""
+    scores = [0.0 if mode == "sum" else math.inf]
+    previous = []
+    for i in range(1, len(word) + 1):
+        best, best_j = -math.inf, None
+        for j in range(i):
+            candidate = word[j:i]
+            if candidate in subwords:
+                similarity = cosine(vector, embeddings[subwords[candidate]])
+            elif j == i - 1:
+                similarity = -1
+            else:
+                continue
+            if mode == "sum":
+                score = scores[j] + similarity - 1
+            else:
+                score = min(scores[j], similarity - 1)
+            if score > best:
+                best, best_j = score, j
+        scores.append(best)
+        previous.append(best_j)
+
+    segmentation = []
+    i = len(word)
+    while i > 0:
+        segmentation.append(word[previous[i - 1]:i])
+        i = previous[i - 1]
+    return list(reversed(segmentation))
+
+
+def ngram_buckets(word, buckets, min_n=3, max_n=6):
+    """The fastText n-gram buckets of legros-oov-table."""
+    bracketed = f"<{word}>"
+    result = []
+    for begin in range(len(bracketed)):
+        for n in range(min_n, min(max_n, len(bracketed) - begin) + 1):
+            if begin == 0 and n == len(bracketed):
+                continue
+            value = 2166136261
+            for byte in bracketed[begin:begin + n].encode("utf-8"):
+                # fastText sign-extends the bytes
+                if byte >= 128:
+                    byte |= 0xFFFFFF00
+                value = ((value ^ byte) * 16777619) % 2 ** 32
+            result.append(value % buckets)
+    return result
+
+
+def reference_oov_embedding(word, word_vectors, buckets):
+    """Mean of the n-gram vectors, each the mean of the normalized
+    embeddings of the words with the n-gram, None without any."""
+    dim = len(next(iter(word_vectors.values())))
+    sums, counts = {}, {}
+    for known, vector in word_vectors.items():
+        norm = math.sqrt(sum(x * x for x in vector))
+        for bucket in ngram_buckets(known, buckets):
+            total = sums.setdefault(bucket, [0.0] * dim)
+            for k in range(dim):
+                total[k] += vector[k] / norm
+            counts[bucket] = counts.get(bucket, 0) + 1
+    found = [bucket for bucket in ngram_buckets(word, buckets)
+             if bucket in sums]
+    if not found:
+        return None
+    return [sum(sums[bucket][k] / counts[bucket] for bucket in found)
+            / len(found) for k in range(dim)]
+
+
+class TestNativeEmbedSegment(NativeTestCase):
+
+    seed = 3
+
+    def setUp(self):
+        super().setUp()
+        rng = self.rng
+        dim = 6
+        self.words = ["walrus", "walruses", "seal", "sealion", "mořský", "lev"]
+        self.word_vectors = {
+            word: [rng.gauss(0, 1) for _ in range(dim)] for word in self.words}
+        subwords = ["<w>", "</w>", "wal", "rus", "es", "sea", "l", "ion", "s",
+                    "e", "a", "w", "r", "u", "moř", "ský", "lev", "walrus"]
+        self.subwords = {subword: i for i, subword in enumerate(subwords)}
+        self.subword_vectors = [
+            [rng.gauss(0, 1) for _ in range(dim)] for _ in subwords]
+
+        self.embeddings = self.write(
+            "embeddings.txt", [f"{len(self.words)} {dim}"] + [
+                " ".join([word] + [f"{x:.6f}" for x in vector])
+                for word, vector in self.word_vectors.items()])
+        self.subword_path = self.write("subwords.0", subwords)
+        self.subword_embeddings = self.write("subword_embeddings.0", [
+            " ".join(f"{x:.6f}" for x in vector)
+            for vector in self.subword_vectors])
+        for vector in self.word_vectors.values():
+            vector[:] = [float(f"{x:.6f}") for x in vector]
+        for vector in self.subword_vectors:
+            vector[:] = [float(f"{x:.6f}") for x in vector]
+
+    def segment(self, words, *args):
+        output = run("legros-embed-segment", self.embeddings,
+                     self.subword_path, self.subword_embeddings, *args,
+                     stdin="".join(word + "\n" for word in words))
+        return [line.split() for line in output.splitlines()]
+
+    def test_matches_python_reference(self):
+        dim = len(self.subword_vectors[0])
+        mean = [sum(vector[k] for vector in self.word_vectors.values())
+                / len(self.word_vectors) for k in range(dim)]
+        words = self.words + ["walrusový", "sealx", ""]
+        for mode in ["sum", "maxmin"]:
+            with self.subTest(mode=mode):
+                expected = [
+                    reference_segment(
+                        word, self.word_vectors.get(word, mean),
+                        self.subwords, self.subword_vectors, mode)
+                    for word in words]
+                self.assertEqual(
+                    self.segment(words, "--inference-mode", mode,
+                                 "--batch-size", "4"),
+                    expected)
+
+    def test_oov_table(self):
+        # "walruses" and "sealion" are left out of the embeddings
+        known = {word: vector for word, vector in self.word_vectors.items()
+                 if word not in ["walruses", "sealion"]}
+        dim = len(self.subword_vectors[0])
+        self.embeddings = self.write(
+            "known.txt", [f"{len(known)} {dim}"] + [
+                " ".join([word] + [f"{x:.6f}" for x in vector])
+                for word, vector in known.items()])
+        table = self.path("oov.bin")
+        run("legros-oov-table", self.embeddings, "-o", table,
+            "--buckets", "1000")
+        with open(table, "rb") as f_table:
+            bucket_rows = struct.unpack_from("<1000i", f_table.read(), 32)
+        self.assertEqual(
+            {bucket for bucket, row in enumerate(bucket_rows) if row >= 0},
+            {bucket for word in known for bucket in ngram_buckets(word, 1000)})
+        mean = [sum(vector[k] for vector in known.values()) / len(known)
+                for k in range(dim)]
+
+        words = ["walruses", "sealion", "walrusion", "lev", "xyz",
+                 "mořskýlev"]
+        expected, with_mean = [], []
+        for word in words:
+            vector = known.get(word)
+            if vector is None:
+                vector = reference_oov_embedding(word, known, 1000) or mean
+            expected.append(reference_segment(
+                word, vector, self.subwords, self.subword_vectors, "maxmin"))
+            with_mean.append(reference_segment(
+                word, known.get(word, mean), self.subwords,
+                self.subword_vectors, "maxmin"))
+        self.assertEqual(
+            self.segment(words, "--oov-table", table,
+                         "--inference-mode", "maxmin"),
+            expected)
+        self.assertEqual(
+            self.segment(words, "--inference-mode", "maxmin"), with_mean)
+        self.assertNotEqual(expected, with_mean)
+
+    def test_mismatched_embeddings_fail(self):
+        self.subword_path = self.write("subwords.1", ["<w>", "</w>", "wal"])
+        with self.assertRaises(Exception):
+            self.segment(["walrus"])
+
+    def test_corrupted_oov_table_fails(self):
+        table = self.path("oov.bin")
+        run("legros-oov-table", self.embeddings, "-o", table,
+            "--buckets", "1000")
+        with open(table, "rb") as f_table:
+            data = f_table.read()
+        # the header: magic, version, dimension, buckets, min_n, max_n, rows
+        rows = struct.unpack_from("<I", data, 28)[0]
+        bucket_rows = struct.unpack_from("<1000i", data, 32)
+        stored = next(b for b, row in enumerate(bucket_rows) if row >= 0)
+        corruptions = [(20, "<I", 0),  # min_n
+                       (24, "<I", 2),  # max_n below min_n
+                       (32 + 4 * stored, "<i", rows)]  # row past the vectors
+        for offset, fmt, value in corruptions:
+            corrupted = bytearray(data)
+            struct.pack_into(fmt, corrupted, offset, value)
+            with open(table, "wb") as f_table:
+                f_table.write(corrupted)
+            with self.assertRaises(subprocess.CalledProcessError) as context:
+                self.segment(["walrusový"], "--oov-table", table)
+            self.assertEqual(context.exception.returncode, 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,40 @@
+import unittest
+
+from legros.pretokenize import pretokenize
+from legros.tests.native import run
+
+
+SENTENCES = [
+    "This is a sentence (with a bracket). Walrus.",
+    "",
+    "   leading and trailing spaces",
+    "double  space and a tab\there",
+    "numbers 3.14 and 1,000,000 and ½ or ² or ٣",
+    "Příliš žluťoučký kůň úpěl ďábelské ódy.",
+    "Съешь же ещё этих мягких французских булок, да выпей чаю.",
+    "東京は日本の首都です。",
+    "हिन्दी भाषा में लिखा गया वाक्य।",
+    "Combining marks: é and café!",
+    "emoji 🦭 walrus🦭🦭",
+    "already ▁marked ▁▁text",
+    "l'amour, e-mail, C++ and #hashtag@home",
+    "trailing unicode spaces\u00a0\u3000\u2009 \u0085\u205f",
+    "inner\u00a0spaces\u3000stay\t\x1f",
+]
+
+
+class TestNativePretokenize(unittest.TestCase):
+
+    def test_conformance(self):
+        output = run(
+            "legros-pretokenize", stdin="\n".join(SENTENCES) + "\n")
+        lines = output.split("\n")[:-1]
+
+        self.assertEqual(len(lines), len(SENTENCES))
+        for sentence, line in zip(SENTENCES, lines):
+            self.assertEqual(
+                line.split(" "), pretokenize(sentence.rstrip()), sentence)
+
+
+if __name__ == "__main__":
+    unittest.main()
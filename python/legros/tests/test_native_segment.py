@@ -0,0 +1,248 @@
+import json
+import math
+import os
+import struct
+import subprocess
+import tempfile
+import unittest
+
+from legros.tests.native import (
+    BIGRAMS, SENTENCES, UNIGRAMS, binary, run, write_bigram_model)
+
+
+class TestNativeSegment(unittest.TestCase):
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.model = write_bigram_model(self.tmp.name)
+        self.text = "\n".join(SENTENCES) + "\n"
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def test_stats(self):
+        stats_file = os.path.join(self.tmp.name, "stats.jsonl")
+        plain = run("legros", *self.model, stdin=self.text)
+        with_stats = run(
+            "legros", *self.model, "--stats-file", stats_file,
+            "--cache-size", "0", stdin=self.text)
+        self.assertEqual(plain, with_stats)
+
+        with open(stats_file, encoding="utf-8") as f_stats:
+            reports = [json.loads(line) for line in f_stats]
+        final = reports[-1]
+        self.assertTrue(final["final"])
+        self.assertEqual(final["lines"], len(SENTENCES))
+        self.assertEqual(
+            final["tokens"],
+            sum(len([t for t in s.split(" ") if t]) for s in SENTENCES))
+        self.assertEqual(
+            final["bytes"],
+            sum(len(s.replace(" ", "").encode("utf-8")) for s in SENTENCES))
+        self.assertEqual(final["cache_hit_rate"], 0)
+        self.assertEqual(
+            sum(b["tokens"] for b in final["decode_time_by_token_length"]),
+            final["tokens"])
+
+    def test_small_cache(self):
+        # sizes below the 64 cache shards still cache
+        stats_file = os.path.join(self.tmp.name, "stats.jsonl")
+        text = self.text * 3
+        self.assertEqual(
+            run("legros", *self.model, "--stats-file", stats_file,
+                "--cache-size", "10", stdin=text),
+            run("legros", *self.model, "--cache-size", "0", stdin=text))
+        with open(stats_file, encoding="utf-8") as f_stats:
+            final = [json.loads(line) for line in f_stats][-1]
+        self.assertGreater(final["cache_hit_rate"], 0)
+
+    def test_output_formats(self):
+        vocab_file = os.path.join(self.tmp.name, "vocab.txt")
+        text = run("legros", *self.model, stdin=self.text)
+        ids = run("legros", *self.model, "--output-format", "ids",
+                  "--vocab-output", vocab_file, stdin=self.text)
+        with open(vocab_file, encoding="utf-8") as f_vocab:
+            vocab = f_vocab.read().split("\n")[:-1]
+
+        id_lines = [[int(i) for i in line.split()]
+                    for line in ids.split("\n")[:-1]]
+
+        # decoding the IDs gives the tokens back, the characters outside of
+        # the vocabulary as byte pieces
+        def decode(line):
+            decoded = b""
+            for i in line:
+                piece = vocab[i]
+                continued = piece.endswith("@@")
+                piece = piece[:-2] if continued else piece
+                if piece.startswith("<0x") and len(piece) == 6:
+                    decoded += bytes([int(piece[3:5], 16)])
+                else:
+                    decoded += piece.encode("utf-8")
+                if not continued:
+                    decoded += b" "
+            return decoded.decode("utf-8").strip()
+
+        self.assertEqual(
+            [decode(line) for line in id_lines],
+            [" ".join(t for t in s.split(" ") if t) for s in SENTENCES])
+        self.assertEqual(len(id_lines), len(text.split("\n")) - 1)
+
+        binary_output = subprocess.run(
+            [binary("legros"), *self.model, "--output-format", "binary"],
+            input=self.text.encode("utf-8"), capture_output=True,
+            check=True).stdout
+        values = struct.unpack(f"<{len(binary_output) // 4}I", binary_output)
+        binary_lines, pos = [], 0
+        while pos < len(values):
+            binary_lines.append(list(values[pos + 1:pos + 1 + values[pos]]))
+            pos += 1 + values[pos]
+        self.assertEqual(binary_lines, id_lines)
+
+    def test_compiled_model(self):
+        for smoothing in ["kn", "wb"]:
+            model = os.path.join(self.tmp.name, f"model.{smoothing}")
+            run("legros-compile", *self.model, "-o", model,
+                "--smoothing", smoothing)
+
+            exact = run("legros", "--model", model, stdin=self.text)
+            beam = run("legros", "--model", model, "-b", "5", stdin=self.text)
+            self.assertEqual(exact, beam)
+
+            # the segmentation only inserts separators
+            for sentence, segmented in zip(SENTENCES, exact.split("\n")):
+                self.assertEqual(segmented.replace("@@ ", ""), sentence)
+
+            self.assertIn("wal@@", exact.split())
+
+    def test_long_subwords_match_generic_decoder(self):
+        # the decoder keeps windows of 8, 16, 24 or 32 bytes depending on the
+        # longest subword; an unreachable 40-byte subword with no count
+        # forces the generic decoder without changing the scores
+        def write_model(name, unigrams, bigrams):
+            bigram_stats = os.path.join(self.tmp.name, f"{name}.bigrams")
+            unigram_stats = os.path.join(self.tmp.name, f"{name}.unigrams")
+            with open(unigram_stats, "w", encoding="utf-8") as f_uni:
+                for subword, count in unigrams.items():
+                    print(f"{subword}\t{count}", file=f_uni)
+            with open(bigram_stats, "w", encoding="utf-8") as f_bi:
+                for prev, subword, count in bigrams:
+                    print(f"{prev}\t{subword}\t{count}", file=f_bi)
+            return bigram_stats, unigram_stats
+
+        for length in [6, 9, 18, 25, 33]:
+            long = ("mořskýwalrus" * 3).encode("utf-8")[:length].decode(
+                "utf-8")
+            unigrams = dict(UNIGRAMS, **{long: 4, long[:-2]: 3})
+            bigrams = BIGRAMS + [("<w>", long, 3), (long, "es", 2),
+                                 (long[:-2], "sea", 1)]
+            text = "\n".join(SENTENCES + [
+                f"{long} {long}es {long[:-2]}sea {long}{long}",
+                f"{long[1:]} {long[:-2]}walrus"]) + "\n"
+
+            window = run("legros", *write_model(
+                f"window{length}", unigrams, bigrams), stdin=text)
+            generic = run("legros", *write_model(
+                f"generic{length}", dict(unigrams, **{"q" * 40: 0}),
+                bigrams), stdin=text)
+            self.assertEqual(window, generic)
+            self.assertIn(long, window.replace("@@", "").split())
+
+    def test_count_model_beam(self):
+        text = self.text + (
+            "walruseswalrus sealion ▁walrus seals walwal es\n"
+            "walrus▁ walruswalrus\n")
+
+        # with beam 1, the best hypothesis ending at each position is kept
+        # whatever its last subword, which is a greedy search
+        unigram_count = sum(UNIGRAMS.values())
+        bigrams = {(prev, subword): count for prev, subword, count in BIGRAMS}
+
+        def score(subword, prev):
+            if not UNIGRAMS.get(prev) and not UNIGRAMS.get(subword):
+                return -math.log(unigram_count)
+            if not UNIGRAMS.get(prev):
+                return math.log(UNIGRAMS[subword] / unigram_count)
+            return math.log((1 + bigrams.get((prev, subword), 0))
+                            / UNIGRAMS[prev])
+
+        def greedy(token):
+            best = [(0.0, ["<w>"])] + [None] * len(token)
+            for start in range(len(token)):
+                for end in range(start + 1, len(token) + 1):
+                    subword = token[start:end]
+                    if end > start + 1 and subword not in UNIGRAMS:
+                        continue
+                    hyp_score, hyp = best[start]
+                    new_score = hyp_score + score(subword, hyp[-1])
+                    if best[end] is None or new_score > best[end][0]:
+                        best[end] = (new_score, hyp + [subword])
+            return best[-1][1][1:]
+
+        expected = "".join(
+            " ".join("@@ ".join(greedy(token)) for token in line.split(" "))
+            + "\n" for line in text.split("\n")[:-1])
+        self.assertEqual(run("legros", *self.model, "-b", "1", stdin=text),
+                         expected)
+
+        # a beam wider than the lattice is an exact search
+        exact = run("legros", *self.model, stdin=text)
+        self.assertEqual(run("legros", *self.model, "-b", "100", stdin=text),
+                         exact)
+        self.assertNotEqual(expected, exact)
+
+    def test_corrupted_compiled_model_fails(self):
+        model = os.path.join(self.tmp.name, "model")
+        run("legros-compile", *self.model, "-o", model)
+        with open(model, "rb") as f_model:
+            data = f_model.read()
+        # magic, version, smoothing, vocabulary size, nonzeros, unknown
+        # log-probability, the subwords, lower log-probabilities, backoffs,
+        # row offsets and columns
+        vocab_size, nonzeros = struct.unpack_from("<II", data, 16)
+        offset = 28
+        for _ in range(vocab_size):
+            offset += 4 + struct.unpack_from("<I", data, offset)[0]
+        rows = offset + 8 * vocab_size
+        columns = rows + 4 * (vocab_size + 1)
+        first_row = next(prev for prev in range(vocab_size)
+                         if struct.unpack_from("<I", data, rows + 4 * prev)
+                         != struct.unpack_from("<I", data, rows + 4 * prev + 4))
+        corruptions = [(16, 2 ** 31),  # vocabulary size
+                       (20, 2 ** 30),  # nonzeros
+                       (rows + 4 * (first_row + 1), nonzeros + 1),  # offsets
+                       (columns, vocab_size)]  # a column out of range
+        for offset, value in corruptions:
+            corrupted = bytearray(data)
+            struct.pack_into("<I", corrupted, offset, value)
+            with open(model, "wb") as f_model:
+                f_model.write(corrupted)
+            with self.assertRaises(subprocess.CalledProcessError) as context:
+                run("legros", "--model", model, stdin=self.text)
+            self.assertEqual(context.exception.returncode, 1)
+
+    def test_pruned_model(self):
+        heldout = os.path.join(self.tmp.name, "heldout.txt")
+        with open(heldout, "w", encoding="utf-8") as f:
+            f.write("\n".join(self.text.split()) + "\n")
+
+        for method in ["count", "entropy", "relative-entropy"]:
+            model = os.path.join(self.tmp.name, f"model.{method}")
+            result = subprocess.run(
+                [binary("legros-prune"), *self.model, "-o", model,
+                 "--method", method, "--quantize", "8",
+                 "--heldout", heldout],
+                capture_output=True, text=True, check=True)
+            report = json.loads(result.stderr.strip().split("\n")[-1])
+            self.assertLessEqual(report["bigrams_after"],
+                                 report["bigrams_before"])
+            self.assertEqual(report["heldout_words"],
+                             len(self.text.split()))
+
+            segmented = run("legros", "--model", model, stdin=self.text)
+            for sentence, line in zip(SENTENCES, segmented.split("\n")):
+                self.assertEqual(line.replace("@@ ", ""), sentence)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,113 @@
+import json
+import os
+import socket
+import struct
+import subprocess
+import tempfile
+import threading
+import time
+import unittest
+
+from legros.tests.native import (
+    SENTENCES, binary, run, write_bigram_model)
+
+
+class TestNativeServer(unittest.TestCase):
+
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.model = write_bigram_model(self.tmp.name)
+        self.socket_path = os.path.join(self.tmp.name, "legros.sock")
+        self.expected = run(
+            "legros", *self.model,
+            stdin="\n".join(SENTENCES) + "\n").split("\n")[:-1]
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def start_server(self, *args):
+        server = subprocess.Popen(
+            [binary("legros"), "serve", *self.model,
+             "--socket", self.socket_path, *args],
+            stderr=subprocess.DEVNULL)
+        self.addCleanup(server.wait)
+        self.addCleanup(server.terminate)
+        for _ in range(100):
+            if os.path.exists(self.socket_path):
+                return
+            time.sleep(0.05)
+        self.fail("Server did not start.")
+
+    def connect(self):
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        client.connect(self.socket_path)
+        self.addCleanup(client.close)
+        return client
+
+    def test_concurrent_line_clients(self):
+        self.start_server("--max-latency-us", "5000")
+        results = {}
+
+        def client(index):
+            stream = self.connect().makefile("rwb")
+            for sentence in SENTENCES:
+                stream.write(sentence.encode("utf-8") + b"\n")
+            stream.flush()
+            results[index] = [
+                stream.readline().decode("utf-8").rstrip("\n")
+                for _ in SENTENCES]
+
+        threads = [threading.Thread(target=client, args=(i,))
+                   for i in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        for index in range(4):
+            self.assertEqual(results[index], self.expected)
+
+        stream = self.connect().makefile("rwb")
+        stream.write(b"\x01STATS\n")
+        stream.flush()
+        stats = json.loads(stream.readline())
+        self.assertEqual(stats["requests"], 4 * len(SENTENCES))
+        self.assertLessEqual(stats["p50_us"], stats["p99_us"])
+
+    def test_length_prefixed(self):
+        self.start_server("--length-prefixed")
+        client = self.connect()
+        for sentence in SENTENCES:
+            payload = sentence.encode("utf-8")
+            client.sendall(struct.pack("<I", len(payload)) + payload)
+
+        stream = client.makefile("rb")
+        for expected in self.expected:
+            length, = struct.unpack("<I", stream.read(4))
+            self.assertEqual(stream.read(length).decode("utf-8"), expected)
+
+    def test_oversized_requests_close_the_connection(self):
+        self.start_server("--max-request-bytes", "64")
+        stream = self.connect().makefile("rwb")
+        stream.write(SENTENCES[0].encode("utf-8") + b"\n" + b"x" * 100)
+        stream.flush()
+        self.assertEqual(stream.readline().decode("utf-8").rstrip("\n"),
+                         self.expected[0])
+        self.assertEqual(stream.readline(), b"")
+
+        # other connections are still served
+        stream = self.connect().makefile("rwb")
+        stream.write(SENTENCES[1].encode("utf-8") + b"\n")
+        stream.flush()
+        self.assertEqual(stream.readline().decode("utf-8").rstrip("\n"),
+                         self.expected[1])
+
+    def test_oversized_length_prefix_closes_the_connection(self):
+        self.start_server("--length-prefixed")
+        client = self.connect()
+        client.sendall(b"\xff\xff\xff\xff")
+        self.assertEqual(client.makefile("rb").read(), b"")
+
+
+if __name__ == "__main__":
+    unittest.main()
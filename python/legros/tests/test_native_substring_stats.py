@@ -0,0 +1,132 @@
+import ast
+import collections
+import struct
+import unittest
+import zipfile
+
+from legros.tests.native import NativeTestCase, run
+
+
+def read_npy(data):
+    """Parses an .npy file, returns the dtype, shape and values."""
+    assert data[:6] == b"\x93NUMPY"
+    header_size, = struct.unpack_from("<H", data, 8)
+    header = ast.literal_eval(data[10:10 + header_size].decode("ascii"))
+    payload = data[10 + header_size:]
+    descr = header["descr"]
+    if descr.startswith("|S"):
+        return descr, header["shape"], payload.decode("ascii")
+    count = len(payload) // int(descr[2:])
+    code = {"<i4": "i", "<i8": "q", "<f4": "f"}[descr]
+    return descr, header["shape"], list(struct.unpack(f"<{count}{code}", payload))
+
+
+def read_csr(path):
+    """Reads the .npz written by legros-substring-stats into a dict."""
+    with zipfile.ZipFile(path) as archive:
+        self_check = archive.testzip()
+        assert self_check is None, self_check
+        arrays = {
+            name[:-4]: read_npy(archive.read(name))
+            for name in archive.namelist()}
+    assert arrays["format"][2] == "csr"
+    shape = tuple(arrays["shape"][2])
+    indptr, indices = arrays["indptr"][2], arrays["indices"][2]
+    dtype, _, data = arrays["data"]
+    matrix = {}
+    for row in range(shape[0]):
+        for k in range(indptr[row], indptr[row + 1]):
+            matrix[row, indices[k]] = data[k]
+    return shape, dtype, matrix
+
+
+def reference_stats(lines, subwords, words, window_size, max_subword):
+    """The counts of get_substring_contexts.py as a sparse dict."""
+    subword_index = {subword: i for i, subword in enumerate(subwords)}
+    word_index = {word: i for i, word in enumerate(words)}
+    stats = collections.Counter()
+    for line in lines:
+        tokens = line.split()
+        for i, token in enumerate(tokens):
+            substrings = [
+                token[k:k + length]
+                for length in range(1, min(len(token), max_subword) + 1)
+                for k in range(len(token) - length + 1)]
+            for j in range(max(0, i - window_size),
+                           min(len(tokens), i + window_size + 1)):
+                if j == i or tokens[j] not in word_index:
+                    continue
+                for substring in substrings:
+                    if substring in subword_index:
+                        stats[subword_index[substring],
+                              word_index[tokens[j]]] += 1
+    return dict(stats)
+
+
+class TestNativeSubstringStats(NativeTestCase):
+
+    seed = 1
+
+    def setUp(self):
+        super().setUp()
+        rng = self.rng
+        self.words = ["walrus", "walruses", "seal", "sealion", "mořský", "lev"]
+        self.subwords = ["wal", "rus", "es", "sea", "l", "ion", "moř", "ský",
+                         "s", "e", "lev", "walrus"]
+        self.lines = [
+            " ".join(rng.choices(self.words + ["oov"], k=rng.randint(0, 9)))
+            for _ in range(150)]
+        self.subword_path = self.write("subwords.txt", self.subwords)
+        self.word_path = self.write("words.txt", self.words)
+        self.corpus = self.write("corpus.txt", self.lines)
+
+    def stats(self, *args):
+        output = self.path("stats.npz")
+        run("legros-substring-stats", self.subword_path, self.word_path,
+            output, self.corpus, *args)
+        return read_csr(output)
+
+    def test_matches_python_reference(self):
+        shape, dtype, matrix = self.stats("--max-subword", "4")
+        self.assertEqual(shape, (len(self.subwords), len(self.words)))
+        self.assertEqual(dtype, "<i4")
+        self.assertEqual(matrix, reference_stats(
+            self.lines, self.subwords, self.words, 3, 4))
+
+    def test_weighted_allowed_substrings(self):
+        allowed = {
+            "walrus": {"wal": 0.5, "rus": 0.25},
+            "walruses": {"walrus": 1.0, "es": 2.0},
+            "seal": {"sea": 1.0, "l": 1.0},
+            "sealion": {"sea": 0.5, "l": 1.0, "ion": 1.5},
+            "mořský": {"moř": 1.0, "ský": 0.75},
+            "lev": {"lev": 1.0, "unknown": 1.0},
+        }
+        allowed_path = self.write("allowed.txt", [
+            " ".join([word] + [f"{sub} {weight}" for sub, weight in subs.items()])
+            for word, subs in allowed.items()])
+        self.lines = [line.replace("oov", "lev") for line in self.lines]
+        self.corpus = self.write("corpus.txt", self.lines)
+
+        _, dtype, matrix = self.stats(
+            "--allowed-substrings", allowed_path, "--weighted")
+        self.assertEqual(dtype, "<f4")
+
+        expected = collections.Counter()
+        for line in self.lines:
+            tokens = line.split()
+            for i, token in enumerate(tokens):
+                for j in range(max(0, i - 3), min(len(tokens), i + 4)):
+                    if j == i:
+                        continue
+                    for subword, weight in allowed[token].items():
+                        if subword in self.subwords:
+                            expected[self.subwords.index(subword),
+                                     self.words.index(tokens[j])] += weight
+        self.assertEqual(matrix.keys(), expected.keys())
+        for key, value in expected.items():
+            self.assertAlmostEqual(matrix[key], value, places=3)
+
+
+if __name__ == "__main__":
+    unittest.main()
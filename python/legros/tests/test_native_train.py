@@ -0,0 +1,176 @@
+import json
+import os
+import struct
+import subprocess
+import unittest
+
+from legros.tests.native import NativeTestCase, run
+
+
+class TestNativeTrain(NativeTestCase):
+
+    seed = 2
+
+    def setUp(self):
+        super().setUp()
+        rng = self.rng
+        syllables = ["wal", "rus", "es", "sea", "l", "ion", "ka", "mo", "ře"]
+        words = set()
+        while len(words) < 40:
+            words.add("".join(rng.choices(syllables, k=rng.randint(1, 3))))
+        self.words = sorted(words)
+
+        dim = 8
+        self.embeddings = self.write(
+            "embeddings.txt", [f"{len(self.words)} {dim}"] + [
+                " ".join([word] + [f"{rng.gauss(0, 1):.5f}"
+                                   for _ in range(dim)])
+                for word in self.words])
+        self.allowed = self.write("allowed.txt", [
+            " ".join([word] + sorted({
+                word[k:k + length] for length in range(1, 5)
+                for k in range(len(word) - length + 1)}))
+            for word in self.words])
+        self.corpus = self.write("corpus.txt", [
+            " ".join(rng.choices(self.words, k=rng.randint(1, 10)))
+            for _ in range(300)])
+        self.dim = dim
+
+    def train(self, name, *args, threads=1, epochs=2):
+        output = self.path(name)
+        os.makedirs(output, exist_ok=True)
+        run("legros-train", self.embeddings, self.corpus,
+            "--allowed-substrings", self.allowed,
+            "--fasttext-dim", str(self.dim), "--epochs", str(epochs),
+            "--output-directory", output, *args,
+            env={"OMP_NUM_THREADS": str(threads)})
+        outputs = {}
+        for file_name in sorted(os.listdir(output)):
+            with open(os.path.join(output, file_name), "rb") as f_output:
+                outputs[file_name] = f_output.read()
+        return outputs
+
+    def test_deterministic_outputs_do_not_depend_on_threads(self):
+        expected = self.train("single", "--deterministic", threads=1)
+        self.assertIn("bigram_stats.1", expected)
+        for threads in [2, 5]:
+            self.assertEqual(
+                self.train(f"threads{threads}", "--deterministic",
+                           threads=threads),
+                expected)
+
+    def test_deterministic_bigrams_are_sorted(self):
+        outputs = self.train("sorted", "--deterministic", threads=3)
+        lines = [line.split("\t")
+                 for line in outputs["bigram_stats.0"].decode().splitlines()]
+        self.assertNotEqual(lines, [])
+        for previous, current in zip(lines, lines[1:]):
+            if previous[0] == current[0]:
+                self.assertLess(previous[1], current[1])
+
+    def test_resumed_training_matches_uninterrupted(self):
+        expected = self.train("uninterrupted", "--checkpoint", epochs=3)
+        self.assertIn("checkpoint.2", expected)
+        self.train("resumed", "--checkpoint", epochs=2)
+        self.assertEqual(
+            self.train("resumed", "--checkpoint", "--resume-from-epoch", "2",
+                       epochs=3),
+            expected)
+
+    def test_corrupted_checkpoints_are_rejected(self):
+        self.train("corrupted", "--checkpoint", epochs=2)
+        path = self.path("corrupted", "checkpoint.2")
+        with open(path, "rb") as f_checkpoint:
+            checkpoint = f_checkpoint.read()
+        # a truncated file and a subword count past the end of the file
+        # (after the magic and the version)
+        for corrupted in [checkpoint[:len(checkpoint) // 2],
+                          checkpoint[:12] + b"\xff" * 8 + checkpoint[20:]]:
+            with open(path, "wb") as f_checkpoint:
+                f_checkpoint.write(corrupted)
+            with self.assertRaises(subprocess.CalledProcessError) as context:
+                self.train("corrupted", "--checkpoint",
+                           "--resume-from-epoch", "2", epochs=3)
+            self.assertEqual(context.exception.returncode, 1)
+
+    def test_incremental_training_matches_full_epochs(self):
+        expected = self.train("full", epochs=3)
+        outputs = self.train("incremental", "--incremental",
+                             "--incremental-threshold", "0", epochs=3)
+        self.assertEqual(sorted(outputs), sorted(expected))
+        for name, output in outputs.items():
+            if not name.startswith("subword_embeddings."):
+                self.assertEqual(output, expected[name], name)
+                continue
+            # the products of fewer rows differ in rounding
+            rows = [line.split() for line in output.decode().splitlines()]
+            expected_rows = [line.split()
+                             for line in expected[name].decode().splitlines()]
+            self.assertEqual(len(rows), len(expected_rows), name)
+            for row, expected_row in zip(rows, expected_rows):
+                self.assertEqual(len(row), len(expected_row), name)
+                for value, expected_value in zip(row, expected_row):
+                    self.assertAlmostEqual(float(value), float(expected_value),
+                                           delta=1e-4, msg=name)
+
+    def test_report_and_trace(self):
+        report = self.path("report.jsonl")
+        trace = self.path("trace.json")
+        self.train("instrumented", "--report", report, "--trace", trace,
+                   epochs=2)
+
+        with open(report, encoding="utf-8") as f_report:
+            stages = [json.loads(line) for line in f_report]
+        self.assertEqual([stage["stage"] for stage in stages],
+                         ["setup", "epoch", "epoch"])
+        self.assertNotIn("epoch", stages[0])
+        self.assertEqual([stage["epoch"] for stage in stages[1:]], [0, 1])
+        for stage in stages[1:]:
+            self.assertIn("viterbi", stage["phases"])
+            self.assertEqual(stage["phases"]["viterbi"]["calls"], 1)
+            self.assertEqual(stage["counters"]["segmentations"],
+                             len(self.words))
+
+        with open(trace, encoding="utf-8") as f_trace:
+            events = json.load(f_trace)["traceEvents"]
+        phases = [event for event in events if event["ph"] == "X"]
+        self.assertEqual(
+            len([event for event in phases if event["name"] == "viterbi"]), 2)
+        for event in phases:
+            self.assertGreaterEqual(event["dur"], 0)
+            self.assertIn("rss_mb", event["args"])
+
+    def test_binary_allowed_substrings(self):
+        expected = self.train("text", threads=1)
+        index = self.path("allowed.bin")
+        run("legros-index-substrings", self.allowed, "-o", index)
+        self.allowed = index
+        self.assertEqual(self.train("binary", threads=1), expected)
+
+        with open(index, "rb") as f_index:
+            data = f_index.read()
+        # the header: magic, version, words, subwords, reserved, entries,
+        # word and subword characters; then the word, row and subword
+        # offsets and the entries
+        words, subwords = struct.unpack_from("<II", data, 12)
+        entries = struct.unpack_from("<Q", data, 24)[0]
+        rows = 48 + 8 * (words + 1)
+        subword_offsets = rows + 8 * (words + 1)
+        first_entry = subword_offsets + 8 * (subwords + 1)
+        corruptions = [(12, "<I", 2 ** 31),  # words
+                       (48 + 8 * words, "<Q", 1),  # end of the words
+                       (rows + 8, "<Q", entries + 1),  # a row past the end
+                       (subword_offsets + 8, "<Q", 2 ** 40),  # a subword
+                       (first_entry, "<I", subwords)]  # an unknown subword
+        for offset, fmt, value in corruptions:
+            corrupted = bytearray(data)
+            struct.pack_into(fmt, corrupted, offset, value)
+            with open(index, "wb") as f_index:
+                f_index.write(corrupted)
+            with self.assertRaises(subprocess.CalledProcessError) as context:
+                self.train("corrupted", threads=1)
+            self.assertEqual(context.exception.returncode, 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+
+"""Generate the C++ table of alphanumeric code point ranges.
+
+The native pretokenizer has to agree with `str.isalnum` used by
+`legros.pretokenize`, so the table is derived directly from the Python
+interpreter. Regenerate with:
+
+    python3 scripts/generate_unicode_alnum.py > src/unicode_alnum.h
+"""
+
+import sys
+import unicodedata
+
+
+def alnum_ranges():
+    ranges = []
+    start = None
+    for codepoint in range(sys.maxunicode + 1):
+        is_alnum = chr(codepoint).isalnum()
+        if is_alnum and start is None:
+            start = codepoint
+        elif not is_alnum and start is not None:
+            ranges.append((start, codepoint - 1))
+            start = None
+    if start is not None:
+        ranges.append((start, sys.maxunicode))
+    return ranges
+
+
+def main():
+    ranges = alnum_ranges()
+    print("// Generated by scripts/generate_unicode_alnum.py from Unicode "
+          f"{unicodedata.unidata_version}.")
+    print("// Do not edit by hand.")
+    print()
+    print("#ifndef SSEG_UNICODE_ALNUM_H_")
+    print("#define SSEG_UNICODE_ALNUM_H_")
+    print()
+    print("// Inclusive code point ranges for which Python's str.isalnum() "
+          "holds.")
+    print("const char32_t unicode_alnum_ranges[][2] = {")
+    for begin, end in ranges:
+        print(f"  {{0x{begin:04X}, 0x{end:04X}}},")
+    print("};")
+    print()
+    print("#endif  // SSEG_UNICODE_ALNUM_H_")
+
+
+if __name__ == "__main__":
+    main()
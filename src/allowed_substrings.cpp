@@ -0,0 +1,271 @@
+#include "allowed_substrings.h"
+
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+const char magic[8] = {'L', 'E', 'G', 'R', 'O', 'S', 'A', 'S'};
+const uint32_t format_version = 1;
+
+// The binary file is this header followed by the word offsets, the row
+// offsets, the subword offsets, the entries and the characters of the words
+// and of the subwords, so that all the arrays stay 8-byte aligned.
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t words;
+  uint32_t subwords;
+  uint32_t reserved;
+  uint64_t entries;
+  uint64_t word_chars;
+  uint64_t subword_chars;
+};
+
+template<typename T>
+void write_array(std::ostream& os, const T* values, size_t size) {
+  os.write(reinterpret_cast<const char*>(values), size * sizeof(T));
+}
+
+bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v'
+         || c == '\f';
+}
+
+// Splits `line` on whitespace.
+void split_fields(std::vector<std::string_view>& fields, std::string_view line) {
+  fields.clear();
+  size_t pos = 0;
+  while(pos < line.size()) {
+    while(pos < line.size() && is_space(line[pos]))
+      ++pos;
+    size_t end = pos;
+    while(end < line.size() && !is_space(line[end]))
+      ++end;
+    if(end > pos)
+      fields.push_back(line.substr(pos, end - pos));
+    pos = end;
+  }
+}
+
+}  // namespace
+
+
+AllowedSubstrings::AllowedSubstrings() {
+  owned_word_offsets.assign(1, 0);
+  owned_subword_offsets.assign(1, 0);
+  owned_row_offsets.assign(1, 0);
+  use_owned_storage();
+}
+
+
+void AllowedSubstrings::use_owned_storage() {
+  word_offsets = owned_word_offsets.data();
+  word_chars = owned_word_chars.data();
+  subword_offsets = owned_subword_offsets.data();
+  subword_chars = owned_subword_chars.data();
+  row_offsets = owned_row_offsets.data();
+  entries = owned_entries.data();
+}
+
+
+void AllowedSubstrings::index_strings() {
+  word_ids.clear();
+  word_ids.reserve(words);
+  for(int id = 0; id < words; ++id)
+    word_ids.insert({word(id), id});
+
+  subword_ids.clear();
+  subword_ids.reserve(subwords);
+  for(int id = 0; id < subwords; ++id)
+    subword_ids.insert({subword(id), id});
+}
+
+
+AllowedSubstrings AllowedSubstrings::read_text(std::istream& is, bool weighted) {
+  AllowedSubstrings index;
+
+  // subword IDs by the first occurrence
+  std::unordered_map<std::string, int> interned;
+  std::vector<std::string_view> fields;
+  for(std::string line; std::getline(is, line);) {
+    split_fields(fields, line);
+    if(fields.empty())
+      continue;
+
+    index.owned_word_chars.insert(index.owned_word_chars.end(),
+                                  fields[0].begin(), fields[0].end());
+    index.owned_word_offsets.push_back(index.owned_word_chars.size());
+
+    int step = weighted ? 2 : 1;
+    for(size_t i = 1; i < fields.size(); i += step) {
+      auto [it, inserted] = interned.try_emplace(std::string(fields[i]),
+                                                 interned.size());
+      if(inserted) {
+        index.owned_subword_chars.insert(index.owned_subword_chars.end(),
+                                         fields[i].begin(), fields[i].end());
+        index.owned_subword_offsets.push_back(
+            index.owned_subword_chars.size());
+      }
+
+      float weight = 1.0;
+      if(weighted && i + 1 < fields.size())
+        std::from_chars(fields[i + 1].data(),
+                        fields[i + 1].data() + fields[i + 1].size(), weight);
+      index.owned_entries.push_back({(uint32_t)it->second, weight});
+    }
+    index.owned_row_offsets.push_back(index.owned_entries.size());
+  }
+
+  index.words = index.owned_word_offsets.size() - 1;
+  index.subwords = index.owned_subword_offsets.size() - 1;
+  index.entries_size = index.owned_entries.size();
+  index.use_owned_storage();
+  index.index_strings();
+  return index;
+}
+
+
+bool AllowedSubstrings::is_binary(const std::string& path) {
+  std::ifstream is(path, std::ios::binary);
+  char file_magic[sizeof(magic)];
+  is.read(file_magic, sizeof(file_magic));
+  return is && std::memcmp(file_magic, magic, sizeof(magic)) == 0;
+}
+
+
+AllowedSubstrings AllowedSubstrings::load(const std::string& path,
+                                          bool weighted) {
+  if(!is_binary(path)) {
+    std::ifstream is(path);
+    if(!is)
+      throw std::runtime_error(
+          "Cannot read allowed substrings from '" + path + "'");
+    return read_text(is, weighted);
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if(fd < 0 || fstat(fd, &file_stat) != 0) {
+    if(fd >= 0)
+      close(fd);
+    throw std::runtime_error(
+        "Cannot read allowed substrings from '" + path + "'");
+  }
+
+  size_t file_size = file_stat.st_size;
+  void* data = file_size < sizeof(Header)
+               ? MAP_FAILED
+               : mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    throw std::runtime_error("Cannot map allowed substrings '" + path + "'");
+
+  AllowedSubstrings index;
+  index.mapping = std::shared_ptr<void>(
+      data, [file_size](void* data) { munmap(data, file_size); });
+
+  const Header& header = *static_cast<const Header*>(data);
+  // the arrays are bounded by the file size one by one, so that their total
+  // size cannot overflow
+  bool valid = header.version == format_version
+      && header.words <= INT_MAX && header.subwords <= INT_MAX
+      && header.entries <= file_size / sizeof(Entry)
+      && header.word_chars <= file_size && header.subword_chars <= file_size;
+  if(valid) {
+    size_t expected_size = sizeof(Header)
+        + sizeof(uint64_t) * (2 * ((size_t)header.words + 1)
+                              + header.subwords + 1)
+        + sizeof(Entry) * header.entries
+        + header.word_chars + header.subword_chars;
+    valid = file_size == expected_size;
+  }
+  if(!valid)
+    throw std::runtime_error("Allowed substrings '" + path
+                             + "' are corrupted or of another version");
+
+  const char* pos = static_cast<const char*>(data) + sizeof(Header);
+  auto take = [&pos](size_t bytes) {
+    const char* begin = pos;
+    pos += bytes;
+    return begin;
+  };
+
+  index.words = header.words;
+  index.subwords = header.subwords;
+  index.entries_size = header.entries;
+  index.word_offsets = reinterpret_cast<const uint64_t*>(
+      take(sizeof(uint64_t) * (header.words + 1)));
+  index.row_offsets = reinterpret_cast<const uint64_t*>(
+      take(sizeof(uint64_t) * (header.words + 1)));
+  index.subword_offsets = reinterpret_cast<const uint64_t*>(
+      take(sizeof(uint64_t) * (header.subwords + 1)));
+  index.entries = reinterpret_cast<const Entry*>(
+      take(sizeof(Entry) * header.entries));
+  index.word_chars = take(header.word_chars);
+  index.subword_chars = take(header.subword_chars);
+
+  // the accessors follow the offsets and the subword IDs unchecked
+  auto offsets_valid = [](const uint64_t* offsets, size_t count,
+                          uint64_t end) {
+    if(offsets[0] != 0 || offsets[count] != end)
+      return false;
+    for(size_t i = 0; i < count; ++i)
+      if(offsets[i] > offsets[i + 1])
+        return false;
+    return true;
+  };
+  valid = offsets_valid(index.word_offsets, header.words, header.word_chars)
+      && offsets_valid(index.subword_offsets, header.subwords,
+                       header.subword_chars)
+      && offsets_valid(index.row_offsets, header.words, header.entries)
+      && std::all_of(index.entries, index.entries + header.entries,
+                     [&header](const Entry& entry) {
+                       return entry.subword < header.subwords;
+                     });
+  if(!valid)
+    throw std::runtime_error("Allowed substrings '" + path
+                             + "' are corrupted or of another version");
+
+  index.index_strings();
+  return index;
+}
+
+
+void AllowedSubstrings::save(const std::string& path) const {
+  std::ofstream os(path, std::ios::binary);
+  if(!os)
+    throw std::runtime_error(
+        "Cannot write allowed substrings to '" + path + "'");
+
+  Header header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = format_version;
+  header.words = words;
+  header.subwords = subwords;
+  header.entries = entries_size;
+  header.word_chars = word_offsets[words];
+  header.subword_chars = subword_offsets[subwords];
+
+  write_array(os, &header, 1);
+  write_array(os, word_offsets, words + 1);
+  write_array(os, row_offsets, words + 1);
+  write_array(os, subword_offsets, subwords + 1);
+  write_array(os, entries, entries_size);
+  write_array(os, word_chars, header.word_chars);
+  write_array(os, subword_chars, header.subword_chars);
+
+  if(!os)
+    throw std::runtime_error(
+        "Cannot write allowed substrings to '" + path + "'");
+}
@@ -0,0 +1,104 @@
+#ifndef SSEG_ALLOWED_SUBSTRINGS_H_
+#define SSEG_ALLOWED_SUBSTRINGS_H_
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The allowed substrings of each word, as a CSR index: a row of (subword ID,
+// weight) entries per word ID, with the word and subword strings interned
+// once each. The index is read either from the text format (a word followed
+// by its substrings, optionally each with a weight, separated by whitespace)
+// or from the binary format written by `save`, which is memory-mapped, so
+// loading it takes no parsing and the pages are shared between processes.
+class AllowedSubstrings {
+ public:
+  struct Entry {
+    uint32_t subword;
+    float weight;
+  };
+
+  AllowedSubstrings();
+  AllowedSubstrings(AllowedSubstrings&&) = default;
+  AllowedSubstrings& operator=(AllowedSubstrings&&) = default;
+  AllowedSubstrings(const AllowedSubstrings&) = delete;
+  AllowedSubstrings& operator=(const AllowedSubstrings&) = delete;
+
+  // Loads the binary format, or the text format with substring weights
+  // (`weighted`) or without them (weight 1). Throws std::runtime_error when
+  // the file cannot be read.
+  static AllowedSubstrings load(const std::string& path, bool weighted = false);
+  static AllowedSubstrings read_text(std::istream& is, bool weighted = false);
+
+  // Writes the binary format. Throws std::runtime_error on failure.
+  void save(const std::string& path) const;
+
+  // True for a binary file, which `load` maps instead of parsing.
+  static bool is_binary(const std::string& path);
+
+  int word_count() const { return words; }
+  int subword_count() const { return subwords; }
+  long entry_count() const { return entries_size; }
+
+  std::string_view word(int id) const {
+    return {word_chars + word_offsets[id],
+            word_offsets[id + 1] - word_offsets[id]};
+  }
+  std::string_view subword(int id) const {
+    return {subword_chars + subword_offsets[id],
+            subword_offsets[id + 1] - subword_offsets[id]};
+  }
+
+  // IDs of a word and a subword, -1 when they are not in the index. A word
+  // listed more than once keeps its first row.
+  int word_id(std::string_view word) const {
+    auto it = word_ids.find(word);
+    return it == word_ids.end() ? -1 : it->second;
+  }
+  int subword_id(std::string_view subword) const {
+    auto it = subword_ids.find(subword);
+    return it == subword_ids.end() ? -1 : it->second;
+  }
+
+  // The allowed substrings of a word, in the order of the input.
+  std::span<const Entry> substrings(int word_id) const {
+    return {entries + row_offsets[word_id],
+            entries + row_offsets[word_id + 1]};
+  }
+
+ private:
+  int words = 0;
+  int subwords = 0;
+  long entries_size = 0;
+
+  // views of either the owned arrays or the mapped file
+  const uint64_t* word_offsets;  // words + 1, into word_chars
+  const char* word_chars;
+  const uint64_t* subword_offsets;  // subwords + 1, into subword_chars
+  const char* subword_chars;
+  const uint64_t* row_offsets;  // words + 1, into entries
+  const Entry* entries;
+
+  // storage of an index read from text
+  std::vector<uint64_t> owned_word_offsets;
+  std::vector<char> owned_word_chars;
+  std::vector<uint64_t> owned_subword_offsets;
+  std::vector<char> owned_subword_chars;
+  std::vector<uint64_t> owned_row_offsets;
+  std::vector<Entry> owned_entries;
+
+  std::shared_ptr<void> mapping;  // unmaps the file
+
+  std::unordered_map<std::string_view, int> word_ids;
+  std::unordered_map<std::string_view, int> subword_ids;
+
+  void use_owned_storage();
+  void index_strings();
+};
+
+#endif  // SSEG_ALLOWED_SUBSTRINGS_H_
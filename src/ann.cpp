@@ -0,0 +1,194 @@
+/**
+ * ANN -- approximate nearest neighbours of subword embeddings.
+ * Input:
+ * - build: subword embeddings of an epoch (subword_embeddings.N)
+ * - neighbors, redundancy: the subword vocabulary of the epoch (subwords.N),
+ *   the index and for neighbors the query subwords, a subword per line
+ *   (standard input by default, all subwords with --all)
+ *
+ * Output:
+ * - build: binary HNSW index (see hnsw_index.h), memory-mapped when loaded
+ * - neighbors: a query, a neighbour and their cosine similarity per line,
+ *   the `k` most similar subwords of each query
+ * - redundancy: the cosine distance of every subword to the most similar
+ *   other subword, the subword and the neighbour per line, the most
+ *   redundant first; unlike score_subword_redundancy.py, which scores the
+ *   distance to the mean embedding of the subword's own segmentation
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <Eigen/Dense>
+#include "CLI11.hpp"
+#include "hnsw_index.h"
+#include "subword_training.h"
+#include "vocabs.h"
+
+struct opt {
+  std::string subword_embeddings;
+  std::string subwords;
+  std::string index;
+  std::string input = "/dev/stdin";
+  bool all = false;
+  int m = 16;
+  int ef_construction = 200;
+  uint64_t seed = 42;
+  int k = 10;
+  int ef = 64;
+} opt;
+
+void add_query_options(CLI::App& app) {
+  app.add_option("subwords", opt.subwords,
+                 "Subword vocabulary of the indexed epoch.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("index", opt.index, "Index from the build subcommand.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("--ef", opt.ef,
+                 "Candidates explored per query, more is slower and more "
+                 "accurate.")
+      ->check(CLI::PositiveNumber);
+}
+
+void get_options(CLI::App& app, CLI::App*& build, CLI::App*& neighbors,
+                 CLI::App*& redundancy) {
+  app.require_subcommand(1);
+
+  build = app.add_subcommand("build", "Index subword embeddings.");
+  build->add_option("subword_embeddings", opt.subword_embeddings,
+                    "Subword embeddings of an epoch.")
+      ->required()
+      ->check(CLI::ExistingFile);
+  build->add_option("-o,--output", opt.index, "Binary index.")
+      ->required();
+  build->add_option("--m", opt.m,
+                    "Links per subword on the upper layers, twice as many on "
+                    "the bottom one.")
+      ->check(CLI::Range(2, 1 << 16));
+  build->add_option("--ef-construction", opt.ef_construction,
+                    "Candidates explored when linking a subword.")
+      ->check(CLI::PositiveNumber);
+  build->add_option("--seed", opt.seed, "Seed of the layer assignment.");
+
+  neighbors = app.add_subcommand(
+      "neighbors", "Find the most similar subwords of the query subwords.");
+  add_query_options(*neighbors);
+  neighbors->add_option("input", opt.input, "Query subwords.");
+  neighbors->add_flag("--all", opt.all, "Query all the subwords.");
+  neighbors->add_option("-k", opt.k, "Neighbours per query.")
+      ->check(CLI::PositiveNumber);
+
+  redundancy = app.add_subcommand(
+      "redundancy", "Score the subwords by the cosine distance to their "
+      "nearest other subword (not to the mean of their segmentation as "
+      "score_subword_redundancy.py).");
+  add_query_options(*redundancy);
+}
+
+
+// Finds the `k` nearest other subwords of each of `queries`, leaving out the
+// word boundary symbols.
+void subword_neighbors(std::vector<std::vector<HnswIndex::Neighbor>>& results,
+                       const HnswIndex& index,
+                       const Vocab& subwords,
+                       const std::vector<int>& queries,
+                       int k) {
+  Eigen::MatrixXf vectors(queries.size(), index.dim());
+  for(int i = 0; i < queries.size(); ++i)
+    vectors.row(i) = index.item_vector(queries[i]).transpose();
+
+  // the query itself and the boundary symbols may be among the results
+  index.search_batch(results, vectors, k + 3, std::max(opt.ef, k + 3));
+  for(int i = 0; i < queries.size(); ++i) {
+    std::erase_if(results[i], [&](const HnswIndex::Neighbor& neighbor) {
+      return neighbor.id == queries[i] || subwords[neighbor.id] == bow
+             || subwords[neighbor.id] == eow;
+    });
+    if(results[i].size() > k)
+      results[i].resize(k);
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"ANN -- approximate nearest neighbours of subword embeddings."};
+  CLI::App *build, *neighbors, *redundancy;
+  get_options(app, build, neighbors, redundancy);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    if(build->parsed()) {
+      Eigen::MatrixXf embeddings;
+      load_embedding_checkpoint(opt.subword_embeddings, embeddings);
+      std::cerr << "Indexing " << embeddings.rows() << " subword embeddings."
+                << std::endl;
+      HnswIndex index = HnswIndex::build(
+          embeddings, opt.m, opt.ef_construction, opt.seed);
+      index.save(opt.index);
+      return 0;
+    }
+
+    Vocab subwords(opt.subwords);
+    HnswIndex index = HnswIndex::load(opt.index);
+    if(index.size() != subwords.size())
+      throw std::runtime_error(
+          "The number of subwords does not match the index.");
+
+    std::vector<int> queries;
+    if(redundancy->parsed() || opt.all) {
+      for(int i = 0; i < subwords.size(); ++i)
+        if(subwords[i] != bow && subwords[i] != eow)
+          queries.push_back(i);
+    } else {
+      std::ifstream input(opt.input);
+      if(!input)
+        throw std::runtime_error("Cannot read " + opt.input);
+      for(std::string line; std::getline(input, line);) {
+        if(!subwords.contains(line)) {
+          std::cerr << "Skipping unknown subword '" << line << "'"
+                    << std::endl;
+          continue;
+        }
+        queries.push_back(subwords[line]);
+      }
+    }
+
+    std::vector<std::vector<HnswIndex::Neighbor>> results;
+    subword_neighbors(results, index, subwords, queries,
+                      neighbors->parsed() ? opt.k : 1);
+
+    if(neighbors->parsed()) {
+      for(int i = 0; i < queries.size(); ++i)
+        for(const auto& neighbor : results[i])
+          std::cout << subwords[queries[i]] << '\t' << subwords[neighbor.id]
+                    << '\t' << neighbor.similarity << '\n';
+      return 0;
+    }
+
+    // the cosine distance, the subword and its nearest neighbour
+    std::vector<std::tuple<float, int, int>> scored;
+    for(int i = 0; i < queries.size(); ++i)
+      if(!results[i].empty())
+        scored.push_back({1 - results[i][0].similarity, queries[i],
+                          results[i][0].id});
+    std::sort(scored.begin(), scored.end());
+    std::cout << std::setprecision(5);
+    for(const auto& [distance, subword, neighbor] : scored)
+      std::cout << distance << '\t' << subwords[subword] << '\t'
+                << subwords[neighbor] << '\n';
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
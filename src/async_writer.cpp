@@ -0,0 +1,101 @@
+#include "async_writer.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const size_t stream_buffer_size = 4 << 20;
+
+}  // namespace
+
+
+AsyncWriter::AsyncWriter(size_t memory_budget) : memory_budget(memory_budget) {
+  if(memory_budget > 0)
+    worker = std::thread(&AsyncWriter::run, this);
+}
+
+
+AsyncWriter::~AsyncWriter() {
+  if(!worker.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  queued.notify_one();
+  worker.join();
+}
+
+
+void AsyncWriter::write_file(const Job& job) {
+  std::vector<char> buffer(stream_buffer_size);
+  std::ofstream os;
+  // must precede open to take effect
+  os.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+  os.open(job.path);
+  job.writer(os);
+  os.close();
+  if(!os)
+    throw std::runtime_error("Cannot write " + job.path.string());
+}
+
+
+void AsyncWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    queued.wait(lock, [this] { return stopping || !jobs.empty(); });
+    if(jobs.empty())
+      return;
+
+    // the job stays queued, and counted in `in_flight`, until it is written
+    const Job& job = jobs.front();
+    lock.unlock();
+    std::string job_error;
+    try {
+      write_file(job);
+    } catch(const std::exception& e) {
+      job_error = e.what();
+    }
+    lock.lock();
+
+    if(error.empty())
+      error = job_error;
+    in_flight -= job.bytes;
+    jobs.pop_front();
+    done.notify_all();
+  }
+}
+
+
+void AsyncWriter::write(const std::filesystem::path& path, size_t bytes,
+                        Writer writer) {
+  if(memory_budget == 0) {
+    try {
+      write_file({path, bytes, std::move(writer)});
+    } catch(const std::exception& e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(error.empty())
+        error = e.what();
+    }
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this, bytes] {
+    return in_flight == 0 || in_flight + bytes <= memory_budget;
+  });
+  in_flight += bytes;
+  jobs.push_back({path, bytes, std::move(writer)});
+  lock.unlock();
+  queued.notify_one();
+}
+
+
+void AsyncWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return jobs.empty(); });
+  if(!error.empty())
+    throw std::runtime_error(error);
+}
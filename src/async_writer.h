@@ -0,0 +1,64 @@
+#ifndef SSEG_ASYNC_WRITER_H_
+#define SSEG_ASYNC_WRITER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// Writes files on a background thread, so that the computation continues
+// while its outputs are serialized. Each file is written by a function that
+// owns a snapshot of the data, which the caller moves into it (e.g. through
+// a shared_ptr), into a large stream buffer.
+//
+// The snapshots queued or being written take at most `memory_budget` bytes,
+// as estimated by the caller: `write` blocks until enough of the earlier
+// files are done. A snapshot larger than the budget waits for the queue to
+// empty. With a budget of 0, the files are written synchronously.
+class AsyncWriter {
+ public:
+  typedef std::function<void(std::ostream&)> Writer;
+
+  explicit AsyncWriter(size_t memory_budget);
+  // Waits for the queued files; their errors are lost, call `wait` first.
+  ~AsyncWriter();
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  // Queues writing `path` with `writer`, whose snapshot takes `bytes`.
+  // Write errors are reported by `wait`.
+  void write(const std::filesystem::path& path, size_t bytes, Writer writer);
+
+  // Waits until all queued files are written. Throws std::runtime_error if
+  // any of them could not be written.
+  void wait();
+
+ private:
+  struct Job {
+    std::filesystem::path path;
+    size_t bytes;
+    Writer writer;
+  };
+
+  static void write_file(const Job& job);
+  void run();
+
+  size_t memory_budget;
+  size_t in_flight = 0;  // bytes of the queued and the running jobs
+  bool stopping = false;
+  std::string error;  // of the first failed file
+
+  std::mutex mutex;
+  std::condition_variable queued;  // a job was queued or stopping was set
+  std::condition_variable done;  // a job finished
+  std::deque<Job> jobs;
+  std::thread worker;
+};
+
+#endif  // SSEG_ASYNC_WRITER_H_
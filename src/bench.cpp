@@ -0,0 +1,336 @@
+/**
+ * Benchmarks of the segmentation and training kernels on a synthetic corpus.
+ *
+ * The corpus, vocabularies, statistics and embeddings are generated from a
+ * seed (see synthetic_corpus.h), so runs on different machines or commits
+ * measure the same work. The results can be written as JSON in the format
+ * of Google Benchmark, so that its compare.py can be used to compare runs.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "CLI11.hpp"
+#include "allowed_substrings.h"
+#include "bigram_model.h"
+#include "cosine_viterbi.h"
+#include "segmenter.h"
+#include "substring_stats.h"
+#include "synthetic_corpus.h"
+#include "utf8.h"
+#include "vocabs.h"
+
+namespace fs = std::filesystem;
+
+struct opt {
+  uint64_t seed = 42;
+  double scale = 1.0;
+  double min_time = 0.5;
+  std::string filter = ".*";
+  std::string json_file;
+  std::string corpus_dir;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option("--seed", opt.seed, "Seed of the synthetic data.");
+
+  app.add_option("--scale", opt.scale,
+                 "Multiplies the number of words and lines of the corpus.")
+      ->check(CLI::PositiveNumber);
+
+  app.add_option("--min-time", opt.min_time,
+                 "Minimum time to run each benchmark, in seconds.")
+      ->check(CLI::NonNegativeNumber);
+
+  app.add_option("--filter", opt.filter,
+                 "Run only benchmarks whose name matches this regex.");
+
+  app.add_option("--json", opt.json_file,
+                 "Write the results in Google Benchmark JSON format.");
+
+  app.add_option("--write-corpus", opt.corpus_dir,
+                 "Keep the generated data files in this directory.");
+}
+
+
+// A benchmark body runs the measured operation once and returns the number
+// of items it processed.
+struct Benchmark {
+  std::string name;
+  std::function<long()> body;
+};
+
+struct BenchmarkResult {
+  std::string name;
+  long iterations;
+  double real_time;  // ns per iteration
+  double cpu_time;  // ns per iteration
+  double items_per_second;
+};
+
+
+BenchmarkResult run_benchmark(const Benchmark& benchmark) {
+  long iterations = 0;
+  long items = 0;
+  double real_seconds = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  std::clock_t cpu_start = std::clock();
+  do {
+    items += benchmark.body();
+    ++iterations;
+    real_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+  } while(real_seconds < opt.min_time);
+  double cpu_seconds = (double)(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+  return {benchmark.name, iterations,
+          1e9 * real_seconds / iterations, 1e9 * cpu_seconds / iterations,
+          items / real_seconds};
+}
+
+
+std::string json_escape(const std::string& text) {
+  std::string escaped;
+  for(char c : text) {
+    if(c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+
+void write_json(std::ostream& out, const std::vector<BenchmarkResult>& results,
+                const std::string& executable, const SyntheticOptions& options) {
+  char host_name[256] = "";
+  gethostname(host_name, sizeof(host_name) - 1);
+  std::time_t now = std::time(nullptr);
+  char date[64];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+
+  #ifdef SSEG_RELEASE_BUILD
+  const char* build_type = "release";
+  #else
+  const char* build_type = "debug";
+  #endif
+
+  out << std::setprecision(10);
+  out << "{\n  \"context\": {\n"
+      << "    \"date\": \"" << date << "\",\n"
+      << "    \"host_name\": \"" << json_escape(host_name) << "\",\n"
+      << "    \"executable\": \"" << json_escape(executable) << "\",\n"
+      << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+      << "    \"library_build_type\": \"" << build_type << "\",\n"
+      << "    \"seed\": " << options.seed << ",\n"
+      << "    \"word_count\": " << options.word_count << ",\n"
+      << "    \"line_count\": " << options.line_count << "\n"
+      << "  },\n  \"benchmarks\": [";
+  for(size_t i = 0; i < results.size(); ++i) {
+    const auto& result = results[i];
+    out << (i > 0 ? "," : "") << "\n    {\n"
+        << "      \"name\": \"" << result.name << "\",\n"
+        << "      \"run_name\": \"" << result.name << "\",\n"
+        << "      \"run_type\": \"iteration\",\n"
+        << "      \"iterations\": " << result.iterations << ",\n"
+        << "      \"real_time\": " << result.real_time << ",\n"
+        << "      \"cpu_time\": " << result.cpu_time << ",\n"
+        << "      \"time_unit\": \"ns\",\n"
+        << "      \"items_per_second\": " << result.items_per_second << "\n"
+        << "    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+
+int max_length_in_bytes(const std::vector<std::string>& subwords) {
+  int max_length = 0;
+  for(const auto& subword : subwords)
+    max_length = std::max(max_length, (int)subword.size());
+  return max_length;
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Benchmarks of the segmentation and training kernels."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  SyntheticOptions options;
+  options.seed = opt.seed;
+  options.word_count = (int)(options.word_count * opt.scale);
+  options.line_count = (int)(options.line_count * opt.scale);
+
+  std::cerr << "Generating synthetic data (seed " << options.seed << ", "
+            << options.word_count << " words, " << options.line_count
+            << " lines)" << std::endl;
+  SyntheticData data;
+  generate_synthetic_data(data, options);
+
+  // the loading benchmarks and the segmenter read the files
+  bool keep_files = !opt.corpus_dir.empty();
+  fs::path dir = keep_files
+      ? fs::path(opt.corpus_dir)
+      : fs::temp_directory_path() / ("legros-bench-" + std::to_string(getpid()));
+  write_synthetic_data(data, dir.string());
+  auto file = [&dir](const std::string& name) { return (dir / name).string(); };
+  AllowedSubstrings::load(file("allowed_substrings.txt"))
+      .save(file("allowed_substrings.bin"));
+
+  Vocab word_vocab;
+  word_vocab.insert(data.words);
+  Vocab subword_vocab;
+  subword_vocab.insert(data.subwords);
+  int max_subword_length = max_length_in_bytes(data.subwords);
+  int max_subword_chars = 0;
+  for(const auto& subword : data.subwords) {
+    std::vector<int> boundaries;
+    utf8_boundaries(boundaries, subword);
+    max_subword_chars = std::max(max_subword_chars, (int)boundaries.size() - 1);
+  }
+
+  Segmenter segmenter(file("bigram_stats.txt"), file("unigram_stats.txt"),
+                      0, false, 0);
+
+  std::vector<Benchmark> benchmarks = {
+    {"BM_load_unigrams", [&]() {
+      unigram_table unigrams;
+      std::vector<std::string> subwords;
+      load_unigrams(unigrams, subwords, file("unigram_stats.txt"));
+      return (long)subwords.size();
+    }},
+    {"BM_load_bigrams", [&]() {
+      bigram_table bigrams;
+      load_bigrams(bigrams, file("bigram_stats.txt"));
+      return (long)bigrams.size();
+    }},
+    {"BM_load_embeddings", [&]() {
+      Embeddings embeddings(file("embeddings.txt"));
+      return (long)embeddings.size();
+    }},
+    {"BM_load_allowed_substrings", [&]() {
+      AllowedSubstrings allowed_substrings =
+          AllowedSubstrings::load(file("allowed_substrings.txt"));
+      return (long)allowed_substrings.word_count();
+    }},
+    {"BM_load_allowed_substrings_mapped", [&]() {
+      AllowedSubstrings allowed_substrings =
+          AllowedSubstrings::load(file("allowed_substrings.bin"));
+      return (long)allowed_substrings.word_count();
+    }},
+    {"BM_get_all_substrings", [&]() {
+      std::vector<std::pair<std::string, float>> substrings;
+      for(const auto& word : data.words) {
+        substrings.clear();
+        get_all_substrings(substrings, subword_vocab, word, max_subword_chars);
+      }
+      return (long)data.words.size();
+    }},
+    {"BM_segment_token", [&]() {
+      std::vector<std::string> segmentation;
+      for(const auto& word : data.words) {
+        segmentation.clear();
+        segment_token(segmentation, word, data.unigrams, data.bigrams,
+                      data.unigram_count, max_subword_length);
+      }
+      return (long)data.words.size();
+    }},
+    {"BM_segment_token_kernel", [&]() {
+      segment_token_fn kernel = select_segment_token_kernel(max_subword_length);
+      std::vector<std::string> segmentation;
+      for(const auto& word : data.words) {
+        segmentation.clear();
+        kernel(segmentation, word, data.unigrams, data.bigrams,
+               data.unigram_count, max_subword_length);
+      }
+      return (long)data.words.size();
+    }},
+    {"BM_beam_search_segment/5", [&]() {
+      std::vector<std::string> segmentation;
+      for(const auto& word : data.words)
+        beam_search_segment(segmentation, word, data.unigrams, data.bigrams,
+                            data.unigram_count, max_subword_length, 5);
+      return (long)data.words.size();
+    }},
+    {"BM_viterbi_decode", [&]() {
+      std::vector<std::string> segmentation;
+      for(int i = 0; i < data.words.size(); ++i) {
+        segmentation.clear();
+        viterbi_decode(segmentation, data.words[i],
+                       data.word_embeddings.row(i).transpose(),
+                       subword_vocab, data.subword_embeddings);
+      }
+      return (long)data.words.size();
+    }},
+    {"BM_populate_word_stats", [&]() {
+      CooccurrenceMatrix stats = CooccurrenceMatrix::Zero(
+          data.words.size(), data.words.size());
+      std::vector<int> word_frequencies(data.words.size(), 0);
+      populate_word_stats<CooccurrenceMatrix>(
+          stats, word_frequencies, word_vocab, file("corpus.txt"), 3);
+      return (long)data.corpus.size();
+    }},
+    {"BM_populate_substring_stats", [&]() {
+      CooccurrenceMatrix stats = CooccurrenceMatrix::Zero(
+          data.subwords.size(), data.words.size());
+      populate_substring_stats<CooccurrenceMatrix>(
+          stats, word_vocab, subword_vocab, file("corpus.txt"),
+          file("allowed_substrings.txt"), 3, max_subword_chars, false);
+      return (long)data.corpus.size();
+    }},
+    {"BM_Segmenter_segment_batch", [&]() {
+      std::vector<std::vector<int>> ids;
+      segmenter.segment_batch(ids, data.corpus);
+      return (long)data.corpus.size();
+    }},
+  };
+
+  std::regex filter(opt.filter);
+  std::vector<BenchmarkResult> results;
+  std::cout << std::left << std::setw(32) << "Benchmark" << std::right
+            << std::setw(16) << "Time (ns)" << std::setw(16) << "CPU (ns)"
+            << std::setw(12) << "Iterations" << std::setw(16) << "Items/s"
+            << std::endl;
+  for(const auto& benchmark : benchmarks) {
+    if(!std::regex_search(benchmark.name, filter))
+      continue;
+
+    // the training kernels report their progress, silence them
+    std::streambuf* cerr_buffer = std::cerr.rdbuf();
+    std::ostringstream discarded;
+    std::cerr.rdbuf(discarded.rdbuf());
+    results.push_back(run_benchmark(benchmark));
+    std::cerr.rdbuf(cerr_buffer);
+
+    const auto& result = results.back();
+    std::cout << std::left << std::setw(32) << result.name << std::right
+              << std::fixed << std::setprecision(0)
+              << std::setw(16) << result.real_time
+              << std::setw(16) << result.cpu_time
+              << std::setw(12) << result.iterations
+              << std::setw(16) << result.items_per_second << std::endl;
+  }
+
+  if(!opt.json_file.empty()) {
+    std::ofstream json(opt.json_file);
+    write_json(json, results, argv[0], options);
+  }
+
+  if(!keep_files)
+    fs::remove_all(dir);
+
+  return 0;
+}
@@ -0,0 +1,271 @@
+#include "bigram_model.h"
+
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <algorithm>
+
+#include "vocabs.h"
+#include "utf8.h"
+#include "lattice_decoder.h"
+
+
+int load_unigrams(unigram_table& unigram_frequencies,
+                  std::vector<std::string>& subwords,
+                  const std::string& path) {
+  int total_count = 0;
+  std::ifstream ifs(path);
+  for(std::string line; std::getline(ifs, line);) {
+    std::istringstream iss(line);
+    std::string subword;
+    iss >> subword;
+    int frequency;
+    iss >> frequency;
+    total_count += frequency;
+
+    if(unigram_frequencies.insert({subword, frequency}).second)
+      subwords.push_back(subword);
+  }
+  return total_count;
+}
+
+void load_bigrams(bigram_table& bigram_frequencies,
+                  const std::string& path) {
+
+  std::ifstream ifs(path);
+  for(std::string line; std::getline(ifs, line);) {
+    std::istringstream iss(line);
+    std::string subword1, subword2;
+    iss >> subword1;
+    iss >> subword2;
+    int frequency;
+    iss >> frequency;
+
+    bigram_frequencies[subword1][subword2] = frequency;
+  }
+}
+
+static int score_table_column_argmax(
+    const std::vector<std::vector<float>>& table, int col) {
+  int best_index = -1;
+  float best_value = -std::numeric_limits<float>::infinity();
+
+  for(int row = 0; row < table.size(); ++row) {
+    if(table[row][col] > best_value) {
+      best_value = table[row][col];
+      best_index = row;
+    }
+  }
+
+  assert(best_index != -1);
+  return best_index;
+}
+
+float score_bigram(const std::string& subword,
+                   const std::string& prev,
+                   const unigram_table& unigrams,
+                   const bigram_table& bigrams,
+                   int unigram_count) {
+
+  // in case everything is OOV, return log uniform prob
+  if((unigrams.count(prev) == 0 || unigrams.at(prev) == 0) && (unigrams.count(subword) == 0 || unigrams.at(subword) == 0))
+    return -std::log(unigram_count); // technically this should be vocab size
+
+  // for prev OOVs, return log unigram prob
+  if(unigrams.count(prev) == 0 || unigrams.at(prev) == 0)
+    return std::log((float)unigrams.at(subword) / (float)unigram_count);
+
+  // for subword OOVs, use trivial add-one smoothing
+  int bigram_count = 1;
+  if(bigrams.count(prev) != 0 && (bigrams.at(prev).count(subword) != 0 && bigrams.at(prev).at(subword) != 0))
+    bigram_count += bigrams.at(prev).at(subword);
+
+  return std::log((float)(bigram_count) / (float)unigrams.at(prev));
+}
+
+
+void segment_token(std::vector<std::string>& segmentation,
+                   const std::string& token,
+                   const unigram_table& unigrams,
+                   const bigram_table& bigrams,
+                   int unigram_count,
+                   int max_subword_length) {
+
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, token);
+  int units = boundaries.size() - 1;
+
+  auto span = [&](int begin, int end) {
+    return token.substr(boundaries[begin], boundaries[end] - boundaries[begin]);
+  };
+
+  std::vector<std::vector<float>> score_table(
+      units, std::vector<float>(
+          units, -std::numeric_limits<float>::infinity()));
+
+  std::vector<std::vector<int>> prev_rows(
+      units, std::vector<int>(units, -1));
+
+  for(int row = 0; row < units; ++row) {
+    // the earliest start of a previous subword within the length limit
+    int min_prev_row = std::max(0, row - 1);
+    while(min_prev_row > 0 && boundaries[row] - boundaries[min_prev_row - 1]
+                              <= max_subword_length)
+      --min_prev_row;
+
+    for(int col = row; col < units; ++col) {
+      if(col > row
+         && boundaries[col + 1] - boundaries[row] > max_subword_length)
+        break;
+
+      std::string subword = span(row, col + 1);
+
+      if(unigrams.count(subword) == 0 && col > row)
+        // we want to allow single-character OOVs
+        continue;
+
+      if(row == 0) {
+        float sc = score_bigram(
+            subword, bow, unigrams, bigrams, unigram_count);
+        score_table[row][col] = sc;
+        continue;
+      }
+
+      float best_prev_score = -std::numeric_limits<float>::infinity();
+      int best_prev_index = -1;
+
+      for(int prev_row = min_prev_row; prev_row < row; ++prev_row) {
+        std::string prev_subword = span(prev_row, row);
+
+        if(unigrams.count(prev_subword) == 0 && row - prev_row > 1)
+          // if previous one was a single character, proceed even if it was an OOV
+          continue;
+
+        if(score_table[prev_row][row - 1] ==
+           -std::numeric_limits<float>::infinity())
+          continue;
+
+        float bigram_score = score_bigram(subword, prev_subword, unigrams,
+                                          bigrams, unigram_count)
+                             + score_table[prev_row][row - 1];
+
+        if(bigram_score > best_prev_score) {
+          best_prev_score = bigram_score;
+          best_prev_index = prev_row;
+        }
+      } // for prev_row
+
+      assert(best_prev_index != -1);
+      prev_rows[row][col] = best_prev_index;
+      score_table[row][col] = best_prev_score;
+    } // for col
+  } // for row
+
+  int subword_end = units;
+  int row = score_table_column_argmax(score_table, units - 1);
+
+  while(subword_end > 0) {
+    int subword_begin = row;
+    segmentation.push_back(span(subword_begin, subword_end));
+    row = prev_rows[row][subword_end - 1];
+    subword_end = subword_begin;
+  }
+
+  std::reverse(segmentation.begin(), segmentation.end());
+}
+
+
+namespace {
+
+// The counts as a model for the lattice decoders, scoring as score_bigram.
+struct CountModel {
+  const unigram_table& unigrams;
+  const bigram_table& bigrams;
+  int unigram_count;
+
+  struct Candidate {
+    std::string text;
+    bool allowed = false;  // in the unigram table, or a single code point
+    int unigram = 0;  // 0 also for subwords not in the table
+    const std::unordered_map<std::string, int>* successors = nullptr;
+
+    // the entry in the unigram table, nullptr for subwords with zero counts
+    const void* state = nullptr;
+  };
+
+  void fill(Candidate& candidate, std::string text, bool single_unit) const {
+    auto unigram = unigrams.find(text);
+    candidate.allowed = single_unit || unigram != unigrams.end();
+    candidate.unigram = unigram == unigrams.end() ? 0 : unigram->second;
+    candidate.state = candidate.unigram == 0 ? nullptr : &*unigram;
+
+    auto successors = bigrams.find(text);
+    candidate.successors =
+        successors == bigrams.end() ? nullptr : &successors->second;
+    candidate.text = std::move(text);
+  }
+
+  void fill_begin(Candidate& candidate) const {
+    fill(candidate, bow, false);
+  }
+
+  float score(const Candidate& subword, const Candidate& prev) const {
+    if(prev.unigram == 0 && subword.unigram == 0)
+      return -std::log(unigram_count);
+
+    if(prev.unigram == 0)
+      return std::log((float)subword.unigram / (float)unigram_count);
+
+    int bigram_count = 1;
+    if(prev.successors != nullptr) {
+      auto it = prev.successors->find(subword.text);
+      if(it != prev.successors->end() && it->second != 0)
+        bigram_count += it->second;
+    }
+
+    return std::log((float)(bigram_count) / (float)prev.unigram);
+  }
+};
+
+
+template<int Window>
+void segment_token_window(std::vector<std::string>& segmentation,
+                          const std::string& token,
+                          const unigram_table& unigrams,
+                          const bigram_table& bigrams,
+                          int unigram_count,
+                          int max_subword_length) {
+  viterbi_window<Window>(segmentation, token,
+                         CountModel{unigrams, bigrams, unigram_count},
+                         max_subword_length);
+}
+
+}  // namespace
+
+
+segment_token_fn select_segment_token_kernel(int max_subword_length) {
+  if(max_subword_length <= 8)
+    return segment_token_window<8>;
+  if(max_subword_length <= 16)
+    return segment_token_window<16>;
+  if(max_subword_length <= 24)
+    return segment_token_window<24>;
+  if(max_subword_length <= 32)
+    return segment_token_window<32>;
+  return segment_token;
+}
+
+
+void beam_search_segment(std::vector<std::string>& segmentation,
+                         const std::string& token,
+                         const unigram_table& unigrams,
+                         const bigram_table& bigrams,
+                         int unigram_count,
+                         int max_subword_length,
+                         int beam_size) {
+  beam_search(segmentation, token,
+              CountModel{unigrams, bigrams, unigram_count},
+              max_subword_length, beam_size);
+}
@@ -0,0 +1,67 @@
+#ifndef SSEG_BIGRAM_MODEL_H_
+#define SSEG_BIGRAM_MODEL_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef std::unordered_map<std::string, int> unigram_table;
+typedef std::unordered_map<std::string,
+                           std::unordered_map<std::string, int>> bigram_table;
+
+// Loads unigram statistics (tab-separated subword and count per line) into
+// `unigram_frequencies` and appends the subwords in file order to `subwords`.
+// Returns the total count, i.e. the data size, not the vocabulary size.
+int load_unigrams(unigram_table& unigram_frequencies,
+                  std::vector<std::string>& subwords,
+                  const std::string& path);
+
+// Loads bigram statistics (tab-separated previous subword, subword and count
+// per line) into `bigram_frequencies`.
+void load_bigrams(bigram_table& bigram_frequencies,
+                  const std::string& path);
+
+// Log-probability of `subword` following `prev` with add-one smoothing of the
+// bigram counts and unigram fallback for out-of-vocabulary predecessors.
+float score_bigram(const std::string& subword,
+                   const std::string& prev,
+                   const unigram_table& unigrams,
+                   const bigram_table& bigrams,
+                   int unigram_count);
+
+// Segments `token` with a Viterbi search over the bigram model. The lattice
+// is built over code point boundaries, so subwords never split a UTF-8
+// sequence. A single code point that is not in the unigram table (or a single
+// byte of malformed UTF-8) is still allowed as a subword, so that every token
+// can be segmented.
+void segment_token(std::vector<std::string>& segmentation,
+                   const std::string& token,
+                   const unigram_table& unigrams,
+                   const bigram_table& bigrams,
+                   int unigram_count,
+                   int max_subword_length);
+
+// Signature of segment_token and its specialized variants.
+typedef void (*segment_token_fn)(std::vector<std::string>& segmentation,
+                                 const std::string& token,
+                                 const unigram_table& unigrams,
+                                 const bigram_table& bigrams,
+                                 int unigram_count,
+                                 int max_subword_length);
+
+// Returns a variant of segment_token compiled for subwords of at most 8, 16,
+// 24 or 32 bytes, the smallest one that fits `max_subword_length`, or the
+// generic segment_token for longer subwords. The results are the same.
+segment_token_fn select_segment_token_kernel(int max_subword_length);
+
+// Segments `token` keeping at most `beam_size` hypotheses per lattice
+// position, otherwise the same as `segment_token`.
+void beam_search_segment(std::vector<std::string>& segmentation,
+                         const std::string& token,
+                         const unigram_table& unigrams,
+                         const bigram_table& bigrams,
+                         int unigram_count,
+                         int max_subword_length,
+                         int beam_size);
+
+#endif  // SSEG_BIGRAM_MODEL_H_
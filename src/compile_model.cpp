@@ -0,0 +1,72 @@
+/**
+ * Compile -- precompute a smoothed bigram model for legros.
+ * Input:
+ * - bigram counts
+ * - unigram counts
+ *
+ * Output:
+ * - binary model with interpolated Kneser-Ney or Witten-Bell
+ *   log-probabilities, to be used with `legros --model`
+ */
+
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include "CLI11.hpp"
+#include "compiled_model.h"
+
+struct opt {
+  std::string bigram_stats;
+  std::string unigram_stats;
+  std::string output;
+  Smoothing smoothing = Smoothing::kneser_ney;
+  float discount = 0;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option(
+      "bigrams", opt.bigram_stats, "Bigram statistics.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option(
+      "unigrams", opt.unigram_stats, "Unigram statistics.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("-o,--output", opt.output, "Compiled model.")
+      ->required();
+
+  std::map<std::string, Smoothing> smoothings = {
+    {"kn", Smoothing::kneser_ney}, {"wb", Smoothing::witten_bell}};
+  app.add_option("--smoothing", opt.smoothing,
+                 "Interpolated Kneser-Ney (kn) or Witten-Bell (wb).")
+      ->transform(CLI::CheckedTransformer(smoothings));
+
+  app.add_option("--discount", opt.discount,
+                 "Kneser-Ney discount, estimated from the counts by default.")
+      ->check(CLI::Range(0.0, 1.0));
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Compile -- precompute a smoothed bigram model for legros."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    CompiledBigramModel model = CompiledBigramModel::compile(
+        opt.bigram_stats, opt.unigram_stats, opt.smoothing, opt.discount);
+    model.save(opt.output);
+
+    std::cerr << "Compiled " << model.size() << " subwords and "
+              << model.nonzeros() << " bigrams into " << opt.output
+              << std::endl;
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
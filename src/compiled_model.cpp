@@ -0,0 +1,451 @@
+#include "compiled_model.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "lattice_decoder.h"
+#include "vocabs.h"
+
+
+namespace {
+
+const char magic[8] = {'L', 'E', 'G', 'R', 'O', 'S', 'B', 'M'};
+// version 2 adds the quantization
+const uint32_t format_version = 2;
+
+template<typename T>
+void write_pod(std::ostream& os, const T& value) {
+  os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void write_vector(std::ostream& os, const std::vector<T>& values) {
+  os.write(reinterpret_cast<const char*>(values.data()),
+           values.size() * sizeof(T));
+}
+
+template<typename T>
+void read_pod(std::istream& is, T& value) {
+  is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void read_vector(std::istream& is, std::vector<T>& values, size_t size) {
+  values.resize(size);
+  is.read(reinterpret_cast<char*>(values.data()), size * sizeof(T));
+}
+
+
+// The compiled model as a model for the lattice decoders.
+struct CompiledModelScorer {
+  const CompiledBigramModel& model;
+
+  struct Candidate {
+    std::string text;
+    bool allowed = false;
+    int id = -1;
+    const void* state = nullptr;
+  };
+
+  void fill(Candidate& candidate, std::string text, bool single_unit) const {
+    candidate.id = model.id(text);
+    candidate.allowed = single_unit || candidate.id >= 0;
+    candidate.state =
+        candidate.id >= 0 ? &model.vocabulary()[candidate.id] : nullptr;
+    candidate.text = std::move(text);
+  }
+
+  void fill_begin(Candidate& candidate) const {
+    fill(candidate, bow, false);
+  }
+
+  float score(const Candidate& subword, const Candidate& prev) const {
+    return model.score(subword.id, prev.id);
+  }
+};
+
+}  // namespace
+
+
+CompiledBigramModel CompiledBigramModel::compile(
+    const std::string& bigram_stats,
+    const std::string& unigram_stats,
+    Smoothing smoothing,
+    float discount) {
+  for(const auto& path : {bigram_stats, unigram_stats})
+    if(!std::ifstream(path))
+      throw std::runtime_error("Cannot read statistics from '" + path + "'");
+
+  CompiledBigramModel model;
+  model.smoothing_method = smoothing;
+
+  unigram_table unigrams;
+  bigram_table bigrams;
+  long unigram_total = load_unigrams(unigrams, model.subwords, unigram_stats);
+  load_bigrams(bigrams, bigram_stats);
+  model.index_vocabulary();
+  int vocab_size = model.size();
+
+  // observed bigrams per previous subword, sorted by subword ID
+  std::vector<std::vector<std::pair<int, int>>> rows(vocab_size);
+  for(const auto& [prev, successors] : bigrams) {
+    int prev_id = model.id(prev);
+    if(prev_id < 0)
+      continue;
+    for(const auto& [subword, count] : successors) {
+      int id = model.id(subword);
+      if(id >= 0 && count > 0)
+        rows[prev_id].push_back({id, count});
+    }
+    std::sort(rows[prev_id].begin(), rows[prev_id].end());
+  }
+
+  // lower-order distribution: continuation counts for Kneser-Ney, unigram
+  // counts for Witten-Bell, with add-one smoothing which leaves mass for
+  // the unknown subwords
+  std::vector<long> lower_counts(vocab_size, 0);
+  long lower_total = 0;
+  long n1 = 0, n2 = 0;
+  for(const auto& row : rows) {
+    for(const auto& [id, count] : row) {
+      lower_counts[id]++;
+      n1 += count == 1;
+      n2 += count == 2;
+    }
+  }
+  if(smoothing == Smoothing::kneser_ney) {
+    for(long count : lower_counts)
+      lower_total += count;
+  } else {
+    for(int id = 0; id < vocab_size; ++id)
+      lower_counts[id] = unigrams.at(model.subwords[id]);
+    lower_total = unigram_total;
+  }
+
+  double lower_denominator = lower_total + vocab_size + 1;
+  model.unknown_logprob = std::log(1.0 / lower_denominator);
+  model.lower_logprobs.resize(vocab_size);
+  for(int id = 0; id < vocab_size; ++id)
+    model.lower_logprobs[id] =
+        std::log((lower_counts[id] + 1) / lower_denominator);
+
+  if(discount <= 0)
+    discount = n1 > 0 ? (double)n1 / (n1 + 2 * n2) : 0.75;
+
+  model.backoffs.assign(vocab_size, 0.0f);
+  model.row_offsets.assign(1, 0);
+  for(int prev = 0; prev < vocab_size; ++prev) {
+    long total = 0;
+    for(const auto& entry : rows[prev])
+      total += entry.second;
+    long types = rows[prev].size();
+
+    // interpolation weight of the lower-order distribution
+    double lambda = 1;
+    if(total > 0) {
+      lambda = smoothing == Smoothing::kneser_ney
+               ? discount * types / total
+               : (double)types / (total + types);
+      model.backoffs[prev] = std::log(lambda);
+    }
+
+    for(const auto& [id, count] : rows[prev]) {
+      double higher = smoothing == Smoothing::kneser_ney
+                      ? std::max(count - discount, 0.0f) / total
+                      : (double)count / (total + types);
+      double lower = std::exp((double)model.lower_logprobs[id]);
+      model.columns.push_back(id);
+      model.logprobs.push_back(std::log(higher + lambda * lower));
+    }
+    model.row_offsets.push_back(model.columns.size());
+  }
+
+  return model;
+}
+
+
+void CompiledBigramModel::index_vocabulary() {
+  ids.clear();
+  max_length = 0;
+  for(int id = 0; id < subwords.size(); ++id) {
+    ids.insert({subwords[id], id});
+    max_length = std::max(max_length, (int)subwords[id].size());
+  }
+}
+
+
+CompiledBigramModel CompiledBigramModel::load(const std::string& path) {
+  std::ifstream is(path, std::ios::binary);
+  if(!is)
+    throw std::runtime_error("Cannot read compiled model from '" + path + "'");
+
+  char file_magic[sizeof(magic)];
+  uint32_t version;
+  is.read(file_magic, sizeof(file_magic));
+  read_pod(is, version);
+  if(!is || std::memcmp(file_magic, magic, sizeof(magic)) != 0
+     || version < 1 || version > format_version)
+    throw std::runtime_error("'" + path + "' is not a compiled legros model");
+
+  // the sizes are checked against the rest of the file before allocating
+  is.seekg(0, std::ios::end);
+  uint64_t file_size = is.tellg();
+  is.seekg(sizeof(magic) + sizeof(version));
+  auto fits = [&is, file_size](uint64_t count, uint64_t item_size) {
+    std::streamoff pos = is.tellg();
+    return is && pos >= 0 && count <= (file_size - pos) / item_size;
+  };
+  auto corrupted = [&path]() {
+    return std::runtime_error("Compiled model '" + path
+                              + "' is truncated or corrupted");
+  };
+
+  CompiledBigramModel model;
+  uint32_t smoothing, vocab_size, nonzeros;
+  read_pod(is, smoothing);
+  read_pod(is, vocab_size);
+  read_pod(is, nonzeros);
+  read_pod(is, model.unknown_logprob);
+  model.smoothing_method = static_cast<Smoothing>(smoothing);
+  if(vocab_size > INT_MAX || nonzeros > INT_MAX
+     || !fits(vocab_size, 3 * sizeof(float) + sizeof(uint32_t))
+     || !fits(nonzeros, sizeof(int32_t) + sizeof(uint8_t)))
+    throw corrupted();
+
+  model.subwords.resize(vocab_size);
+  for(auto& subword : model.subwords) {
+    uint32_t length = 0;
+    read_pod(is, length);
+    if(!fits(length, 1))
+      throw corrupted();
+    subword.resize(length);
+    is.read(subword.data(), length);
+  }
+  read_vector(is, model.lower_logprobs, vocab_size);
+  read_vector(is, model.backoffs, vocab_size);
+  read_vector(is, model.row_offsets, vocab_size + 1);
+  read_vector(is, model.columns, nonzeros);
+
+  uint32_t bits = 0;
+  if(version >= 2)
+    read_pod(is, bits);
+  model.quantization_bits = bits;
+  if(bits == 0) {
+    read_vector(is, model.logprobs, nonzeros);
+  } else {
+    if(bits != 8 && bits != 16)
+      throw std::runtime_error("Compiled model '" + path
+                               + "' has unsupported quantization");
+    uint32_t codebook_size = 0;
+    read_pod(is, codebook_size);
+    if(codebook_size > (1u << bits) || !fits(codebook_size, sizeof(float)))
+      throw corrupted();
+    read_vector(is, model.codebook, codebook_size);
+    if(bits == 8)
+      read_vector(is, model.codes8, nonzeros);
+    else
+      read_vector(is, model.codes16, nonzeros);
+  }
+  if(!is)
+    throw corrupted();
+
+  // `score` and the decoders follow the offsets, columns and codes unchecked
+  bool valid = model.row_offsets[0] == 0
+               && model.row_offsets.back() == nonzeros;
+  for(uint32_t prev = 0; prev < vocab_size && valid; ++prev) {
+    uint32_t begin = model.row_offsets[prev];
+    uint32_t end = model.row_offsets[prev + 1];
+    valid = begin <= end && end <= nonzeros;
+    for(uint32_t entry = begin; entry < end && valid; ++entry) {
+      int32_t column = model.columns[entry];
+      // sorted within the row for the binary search
+      valid = column >= 0 && column < vocab_size
+              && (entry == begin || model.columns[entry - 1] < column);
+    }
+  }
+  for(uint32_t entry = 0; entry < nonzeros && valid; ++entry) {
+    if(bits == 8)
+      valid = model.codes8[entry] < model.codebook.size();
+    else if(bits == 16)
+      valid = model.codes16[entry] < model.codebook.size();
+  }
+  if(!valid)
+    throw corrupted();
+
+  model.index_vocabulary();
+  return model;
+}
+
+
+void CompiledBigramModel::save(const std::string& path) const {
+  std::ofstream os(path, std::ios::binary);
+  if(!os)
+    throw std::runtime_error("Cannot write compiled model to '" + path + "'");
+
+  os.write(magic, sizeof(magic));
+  write_pod(os, format_version);
+  write_pod(os, static_cast<uint32_t>(smoothing_method));
+  write_pod(os, static_cast<uint32_t>(subwords.size()));
+  write_pod(os, static_cast<uint32_t>(columns.size()));
+  write_pod(os, unknown_logprob);
+  for(const auto& subword : subwords) {
+    write_pod(os, static_cast<uint32_t>(subword.size()));
+    os.write(subword.data(), subword.size());
+  }
+  write_vector(os, lower_logprobs);
+  write_vector(os, backoffs);
+  write_vector(os, row_offsets);
+  write_vector(os, columns);
+
+  write_pod(os, static_cast<uint32_t>(quantization_bits));
+  if(quantization_bits == 0) {
+    write_vector(os, logprobs);
+  } else {
+    write_pod(os, static_cast<uint32_t>(codebook.size()));
+    write_vector(os, codebook);
+    write_vector(os, codes8);
+    write_vector(os, codes16);
+  }
+
+  os.close();
+  if(!os)
+    throw std::runtime_error("Cannot write compiled model to '" + path + "'");
+}
+
+
+float CompiledBigramModel::score(int id, int prev) const {
+  float lower = id < 0 ? unknown_logprob : lower_logprobs[id];
+  if(prev < 0)
+    return lower;
+
+  if(id >= 0) {
+    auto begin = columns.begin() + row_offsets[prev];
+    auto end = columns.begin() + row_offsets[prev + 1];
+    auto it = std::lower_bound(begin, end, id);
+    if(it != end && *it == id)
+      return entry_logprob(it - columns.begin());
+  }
+  return backoffs[prev] + lower;
+}
+
+
+void CompiledBigramModel::remove_bigrams(const std::vector<bool>& keep) {
+  std::vector<uint32_t> offsets(1, 0);
+  std::vector<int32_t> kept_columns;
+  std::vector<float> kept_logprobs;
+
+  for(int prev = 0; prev < size(); ++prev) {
+    // probability mass of the kept bigrams and of their lower-order
+    // probabilities, the rest of the row backs off
+    double higher_mass = 0;
+    double lower_mass = 0;
+    bool removed = false;
+    for(int entry = row_begin(prev); entry < row_end(prev); ++entry) {
+      if(!keep[entry]) {
+        removed = true;
+        continue;
+      }
+      kept_columns.push_back(columns[entry]);
+      kept_logprobs.push_back(entry_logprob(entry));
+      higher_mass += std::exp((double)entry_logprob(entry));
+      lower_mass += std::exp((double)lower_logprobs[columns[entry]]);
+    }
+    offsets.push_back(kept_columns.size());
+
+    if(removed) {
+      double remaining = std::max(1.0 - higher_mass, 1e-12);
+      backoffs[prev] = std::log(remaining / std::max(1.0 - lower_mass, 1e-12));
+    }
+  }
+
+  row_offsets = std::move(offsets);
+  columns = std::move(kept_columns);
+  logprobs = std::move(kept_logprobs);
+
+  // the kept values are exact codebook entries, quantize them again
+  if(quantization_bits != 0) {
+    int bits = quantization_bits;
+    quantization_bits = 0;
+    quantize(bits);
+  }
+}
+
+
+void CompiledBigramModel::quantize(int bits) {
+  if(bits != 8 && bits != 16)
+    throw std::runtime_error("Only 8 and 16 bit quantization is supported");
+  if(quantization_bits != 0)
+    return;
+
+  std::vector<float> sorted(logprobs);
+  std::sort(sorted.begin(), sorted.end());
+  size_t bins = std::min(sorted.size(), (size_t)1 << bits);
+
+  // bin b holds the values up to upper[b], represented by their mean
+  std::vector<float> upper(bins);
+  codebook.assign(bins, 0.0f);
+  for(size_t b = 0; b < bins; ++b) {
+    size_t first = b * sorted.size() / bins;
+    size_t last = (b + 1) * sorted.size() / bins;
+    double sum = 0;
+    for(size_t i = first; i < last; ++i)
+      sum += sorted[i];
+    codebook[b] = sum / (last - first);
+    upper[b] = sorted[last - 1];
+  }
+
+  codes8.clear();
+  codes16.clear();
+  for(float value : logprobs) {
+    size_t code = std::lower_bound(upper.begin(), upper.end(), value)
+                  - upper.begin();
+    if(bits == 8)
+      codes8.push_back(code);
+    else
+      codes16.push_back(code);
+  }
+
+  logprobs.clear();
+  logprobs.shrink_to_fit();
+  quantization_bits = bits;
+}
+
+
+size_t CompiledBigramModel::memory_bytes() const {
+  return sizeof(float) * (lower_logprobs.size() + backoffs.size()
+                          + logprobs.size() + codebook.size())
+         + sizeof(uint32_t) * row_offsets.size()
+         + sizeof(int32_t) * columns.size()
+         + sizeof(uint8_t) * codes8.size()
+         + sizeof(uint16_t) * codes16.size();
+}
+
+
+void CompiledBigramModel::segment_token(std::vector<std::string>& segmentation,
+                                        const std::string& token,
+                                        int beam_size) const {
+  CompiledModelScorer scorer{*this};
+
+  if(beam_size > 0) {
+    std::vector<std::string> segm;
+    beam_search(segm, token, scorer, max_length, beam_size);
+    segmentation.insert(segmentation.end(), segm.begin(), segm.end());
+  } else if(max_length <= 8) {
+    viterbi_window<8>(segmentation, token, scorer, max_length);
+  } else if(max_length <= 16) {
+    viterbi_window<16>(segmentation, token, scorer, max_length);
+  } else if(max_length <= 24) {
+    viterbi_window<24>(segmentation, token, scorer, max_length);
+  } else if(max_length <= 32) {
+    viterbi_window<32>(segmentation, token, scorer, max_length);
+  } else {
+    // with recombination, a beam wider than the lattice is exact
+    std::vector<std::string> segm;
+    beam_search(segm, token, scorer, max_length, INT_MAX);
+    segmentation.insert(segmentation.end(), segm.begin(), segm.end());
+  }
+}
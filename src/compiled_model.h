@@ -0,0 +1,120 @@
+#ifndef SSEG_COMPILED_MODEL_H_
+#define SSEG_COMPILED_MODEL_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bigram_model.h"
+
+// Smoothing of the bigram probabilities in a compiled model.
+enum class Smoothing : uint32_t {
+  kneser_ney = 0,  // interpolated Kneser-Ney
+  witten_bell = 1,  // interpolated Witten-Bell
+};
+
+// A bigram model with smoothed log-probabilities precomputed from the counts
+// written by legros-train (see `compile`), so that decoding needs no
+// arithmetic on counts.
+//
+// The subwords get IDs in the order of the unigram statistics. Every subword
+// has a lower-order log-probability and a backoff weight; the observed
+// bigrams are stored in CSR form, a row per previous subword with the
+// subword IDs sorted. The score of a bigram is its stored log-probability,
+// or the backoff weight of the previous subword plus the lower-order
+// log-probability of the subword. Subwords outside of the vocabulary (only
+// single code points are allowed by the decoders) get
+// `unknown_logprob` as their lower-order log-probability and no backoff.
+//
+// The bigram log-probabilities can be quantized to 8 or 16 bit codes into a
+// codebook, which shrinks the working set of the decoder.
+class CompiledBigramModel {
+ public:
+  CompiledBigramModel() {}
+
+  // Estimates the model from unigram and bigram statistics. For Kneser-Ney,
+  // `discount` <= 0 means estimating it from the count-of-counts as
+  // n1 / (n1 + 2 n2).
+  static CompiledBigramModel compile(const std::string& bigram_stats,
+                                     const std::string& unigram_stats,
+                                     Smoothing smoothing,
+                                     float discount = 0);
+
+  // Reads and writes the binary format. Throw std::runtime_error on
+  // failure.
+  static CompiledBigramModel load(const std::string& path);
+  void save(const std::string& path) const;
+
+  int size() const { return subwords.size(); }
+  int nonzeros() const { return columns.size(); }
+  Smoothing smoothing() const { return smoothing_method; }
+  const std::vector<std::string>& vocabulary() const { return subwords; }
+  int max_subword_length() const { return max_length; }
+
+  // ID of a subword, -1 outside of the vocabulary.
+  int id(const std::string& subword) const {
+    auto it = ids.find(subword);
+    return it == ids.end() ? -1 : it->second;
+  }
+
+  // Log-probability of subword `id` after subword `prev`, -1 for unknown.
+  float score(int id, int prev) const;
+
+  // The bigrams after subword `prev` are the entries row_begin(prev) to
+  // row_end(prev) - 1, with subword ID `column(entry)`.
+  int row_begin(int prev) const { return row_offsets[prev]; }
+  int row_end(int prev) const { return row_offsets[prev + 1]; }
+  int column(int entry) const { return columns[entry]; }
+  float entry_logprob(int entry) const {
+    switch(quantization_bits) {
+      case 8: return codebook[codes8[entry]];
+      case 16: return codebook[codes16[entry]];
+      default: return logprobs[entry];
+    }
+  }
+  float lower_logprob(int id) const { return lower_logprobs[id]; }
+  float backoff(int prev) const { return backoffs[prev]; }
+
+  // Removes the bigrams whose `keep` flag (per entry) is false and
+  // recomputes the backoff weights of their rows, so that the distributions
+  // stay normalized.
+  void remove_bigrams(const std::vector<bool>& keep);
+
+  // Replaces the bigram log-probabilities with 8 or 16 bit codes of a
+  // codebook with equally populated bins.
+  void quantize(int bits);
+  int quantization() const { return quantization_bits; }
+
+  // Size of the scoring arrays in bytes, excluding the vocabulary.
+  size_t memory_bytes() const;
+
+  // Segments `token` with exact search (beam_size 0) or beam search,
+  // appending the subwords to `segmentation`.
+  void segment_token(std::vector<std::string>& segmentation,
+                     const std::string& token,
+                     int beam_size = 0) const;
+
+ private:
+  Smoothing smoothing_method = Smoothing::kneser_ney;
+  std::vector<std::string> subwords;
+  std::unordered_map<std::string, int> ids;
+  int max_length = 0;
+
+  float unknown_logprob = 0;
+  std::vector<float> lower_logprobs;
+  std::vector<float> backoffs;
+
+  std::vector<uint32_t> row_offsets;  // size() + 1
+  std::vector<int32_t> columns;
+  std::vector<float> logprobs;  // unless quantized
+
+  int quantization_bits = 0;
+  std::vector<float> codebook;
+  std::vector<uint8_t> codes8;
+  std::vector<uint16_t> codes16;
+
+  void index_vocabulary();
+};
+
+#endif  // SSEG_COMPILED_MODEL_H_
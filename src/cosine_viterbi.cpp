@@ -4,6 +4,8 @@
 #include <algorithm>
 #include <cassert>
 
+#include "utf8.h"
+
 
 void subword_cosine_similarities(
     std::map<int, float>& similarities,
@@ -14,10 +16,14 @@ void subword_cosine_similarities(
 
   float emb_norm = word_embedding.norm();
 
-  // iterate over all non-empty substrings of the word
-  for(size_t begin = 0; begin < word.size(); ++begin) {
-    for(size_t end = begin + 1; end < word.size() + 1; ++end) {
-      std::string subword = word.substr(begin, end - begin);
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, word);
+
+  // iterate over all non-empty substrings of the word on code point boundaries
+  for(size_t begin = 0; begin + 1 < boundaries.size(); ++begin) {
+    for(size_t end = begin + 1; end < boundaries.size(); ++end) {
+      std::string subword = word.substr(
+          boundaries[begin], boundaries[end] - boundaries[begin]);
 
       // if the substring is not in the vocabulary, skip it
       if(!subwords.contains(subword))
@@ -41,7 +47,8 @@ void viterbi_decode(
     const std::string& word,
     const Eigen::VectorXf& word_embedding,
     const Vocab& subwords,
-    const Eigen::MatrixXf& subword_embeddings) {
+    const Eigen::MatrixXf& subword_embeddings,
+    CosineInference inference) {
 
   // pre-compute cosine similarities between the word and subwords in the
   // vocabulary which are contained in the word
@@ -49,22 +56,30 @@ void viterbi_decode(
   subword_cosine_similarities(similarities, word, word_embedding, subwords,
                               subword_embeddings);
 
-  // If the path goes through index i, then predecesors[i] is the index of the
-  // previous subword on the path. The vector `sw_predecesors` contains the
-  // actual corresponding subwords, not the indices.
-  std::vector<int> predecesors(word.size(), 0);
-  std::vector<std::string> sw_predecesors(word.size());
-
-  // scores[i] is the score of the best path-prefix which ends at index i. The
-  // vector starts *before* the first letter, so scores[0] is the score of the
-  // empty prefix, initialized to zero. Note that the scores are always
-  // negative.
-  std::vector<float> scores(word.size() + 1,
+  // The lattice positions are code point boundaries, position i is at byte
+  // boundaries[i].
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, word);
+  int units = boundaries.size() - 1;
+
+  // If the path goes through position i, then predecesors[i] is the position
+  // of the previous subword on the path. The vector `sw_predecesors` contains
+  // the actual corresponding subwords, not the positions.
+  std::vector<int> predecesors(units, 0);
+  std::vector<std::string> sw_predecesors(units);
+
+  // scores[i] is the score of the best path-prefix which ends at position i.
+  // The vector starts *before* the first letter, so scores[0] is the score of
+  // the empty prefix, initialized to zero (or to infinity with maxmin, where it
+  // is the minimum of no subwords). Note that the scores of non-empty
+  // prefixes are always negative.
+  std::vector<float> scores(units + 1,
                             -std::numeric_limits<float>::infinity());
-  scores[0] = 0.0f;
+  scores[0] = inference == CosineInference::sum
+              ? 0.0f : std::numeric_limits<float>::infinity();
 
   // iterate from after the first letter (scores array begins before the word)
-  for(size_t i = 1; i < word.size() + 1; ++i) {
+  for(int i = 1; i < units + 1; ++i) {
 
     // one iteration choses the best predecessor for the i-th position
     float max_score = -std::numeric_limits<float>::infinity();
@@ -72,13 +87,15 @@ void viterbi_decode(
     std::string sw_best_pred;
 
     // Going from j to i (every possible preceding subword, aka. `candidate`):
-    for(size_t j = 0; j < i; ++j) {
+    for(int j = 0; j < i; ++j) {
 
-      std::string candidate = word.substr(j, i - j);
+      std::string candidate = word.substr(
+          boundaries[j], boundaries[i] - boundaries[j]);
       float candidate_similarity;
 
-      // if the candidate is not in the vocabulary, skip it, unless it is
-      // length 1 - in that case assign it with the lowest similarity of -1.
+      // if the candidate is not in the vocabulary, skip it, unless it is a
+      // single code point - in that case assign it with the lowest similarity
+      // of -1.
       if(!subwords.contains(candidate)) {
         if(j == i - 1) {
           candidate_similarity = -1;
@@ -94,7 +111,9 @@ void viterbi_decode(
 
       // we subtract one from the similarity because we want it to be less than
       // zero, so the word does not get segmented into individual letters.
-      float path_score = scores[j] + candidate_similarity - 1;
+      float path_score = inference == CosineInference::sum
+                         ? scores[j] + candidate_similarity - 1
+                         : std::min(scores[j], candidate_similarity - 1);
 
       if(path_score > max_score) {
         max_score = path_score;
@@ -110,7 +129,7 @@ void viterbi_decode(
     scores[i] = max_score;
   }
 
-  int index = word.size() - 1;
+  int index = units - 1;
   while(index >= 0) {
     segmentation.push_back(sw_predecesors[index]);
     index = predecesors[index] - 1;
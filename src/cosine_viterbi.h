@@ -8,7 +8,8 @@
 #include "vocabs.h"
 
 // Pre-computes the cosine similarities between a word and all subwords
-// contained in it. Similarity(x, y) = dot(x, y) / (norm(x) * norm(y)).
+// contained in it (on code point boundaries).
+// Similarity(x, y) = dot(x, y) / (norm(x) * norm(y)).
 void subword_cosine_similarities(
     std::map<int, float>& similarities,
     const std::string& word,
@@ -17,14 +18,23 @@ void subword_cosine_similarities(
     const Eigen::MatrixXf& subword_embeddings);
 
 
+// How the scores of the subwords on a path combine, as the inference modes of
+// unigram_segment.py: `sum` adds them (as the training does), `maxmin` takes
+// the score of the worst subword.
+enum class CosineInference { sum, maxmin };
+
+
 // Segments a single word using the viterbi algorithm to find path with highest
 // score, according to cosine similarities of the word embedding with the
-// subword embeddings. Fills `segmentation` with the resulting segments.
+// subword embeddings. Fills `segmentation` with the resulting segments. The
+// lattice is over code points, a single out-of-vocabulary code point is
+// allowed as a segment with the lowest similarity.
 void viterbi_decode(
     std::vector<std::string>& segmentation,
     const std::string& word,
     const Eigen::VectorXf& word_embedding,
     const Vocab& subwords,
-    const Eigen::MatrixXf& subword_embeddings);
+    const Eigen::MatrixXf& subword_embeddings,
+    CosineInference inference = CosineInference::sum);
 
 #endif  // SSEG_COSINE_VITERBI_H_
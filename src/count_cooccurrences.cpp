@@ -0,0 +1,103 @@
+/**
+ * Count -- count word cooccurrences in a corpus shard.
+ * Input:
+ * - corpus shard, a sentence per line
+ * - word vocabulary, a word per line, or the word embeddings given to
+ *   legros-train (--embeddings)
+ *
+ * Output:
+ * - partial counts: word frequencies and sorted cooccurrence counts, to be
+ *   merged with the other shards by legros-merge
+ */
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "CLI11.hpp"
+#include "vocabs.h"
+#include "word_counts.h"
+
+struct opt {
+  std::string corpus;
+  std::string vocabulary;
+  std::string output;
+  bool embeddings = false;
+  int window_size = 3;
+  bool pretokenize = false;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option("corpus", opt.corpus, "Corpus shard.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("vocabulary", opt.vocabulary, "Word vocabulary.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("-o,--output", opt.output, "Partial counts.")
+      ->required();
+
+  app.add_flag("--embeddings", opt.embeddings,
+               "The vocabulary is a word embeddings file in the text format, "
+               "as given to legros-train.");
+
+  app.add_option("--window-size", opt.window_size, "Window size.")
+      ->check(CLI::PositiveNumber);
+
+  app.add_flag("--pretokenize", opt.pretokenize,
+               "Split the corpus with the native pretokenizer instead of on "
+               "whitespace.");
+}
+
+
+// The words of an embeddings file, without reading the vectors.
+Vocab load_embedding_words(const std::string& path) {
+  std::ifstream is(path);
+  std::string line;
+  std::getline(is, line);  // the word count and the dimension
+
+  std::vector<std::string> words;
+  while(std::getline(is, line))
+    words.push_back(line.substr(0, line.find(' ')));
+
+  Vocab vocab;
+  vocab.insert(words);
+  return vocab;
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Count -- count word cooccurrences in a corpus shard."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    Vocab words = opt.embeddings ? load_embedding_words(opt.vocabulary)
+                                 : Vocab(opt.vocabulary);
+
+    std::cerr << "Counting cooccurrences of " << words.size()
+              << " words in " << opt.corpus << std::endl;
+    std::ifstream corpus(opt.corpus);
+    std::vector<WordPairCount> pairs;
+    WordCountsInfo info;
+    count_word_cooccurrences(pairs, info, words, corpus, opt.window_size,
+                             opt.pretokenize);
+
+    WordCountsWriter writer(opt.output, info);
+    for(const auto& pair : pairs)
+      writer.add(pair);
+    writer.close();
+
+    std::cerr << "Counted " << info.lines << " lines, " << info.tokens
+              << " tokens and " << info.pairs << " word pairs into "
+              << opt.output << std::endl;
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
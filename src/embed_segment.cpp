@@ -0,0 +1,174 @@
+/**
+ * Embed segment -- segment words by the cosine similarity of their embedding
+ * with the trained subword embeddings (the inference counterpart of the
+ * legros-train Viterbi decoding).
+ * Input:
+ * - word embeddings (the legros-train input)
+ * - subword vocabulary and subword embeddings of an epoch (subwords.N and
+ *   subword_embeddings.N)
+ * - words to segment, a word per line (standard input by default)
+ * - optionally n-gram vectors for words without an embedding, from
+ *   legros-oov-table
+ *
+ * Output:
+ * - STDOUT: the subwords of each word separated by spaces, a word per line
+ */
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+#include "CLI11.hpp"
+#include "cosine_viterbi.h"
+#include "oov_embeddings.h"
+#include "subword_training.h"
+#include "vocabs.h"
+
+struct opt {
+  std::string word_embeddings;
+  std::string subwords;
+  std::string subword_embeddings;
+  std::string input = "/dev/stdin";
+  std::string oov_table;
+  CosineInference inference = CosineInference::sum;
+  int batch_size = 10000;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option("word_embeddings", opt.word_embeddings, "Word embeddings.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("subwords", opt.subwords,
+                 "Subword vocabulary of an epoch, subword per line.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("subword_embeddings", opt.subword_embeddings,
+                 "Subword embeddings of the same epoch.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("input", opt.input, "Words to segment, word per line.");
+
+  app.add_option("--oov-table", opt.oov_table,
+                 "Compose the embeddings of words that have none from the "
+                 "character n-gram vectors of legros-oov-table instead of "
+                 "using the mean word embedding.")
+      ->check(CLI::ExistingFile);
+
+  std::map<std::string, CosineInference> modes = {
+    {"sum", CosineInference::sum},
+    {"maxmin", CosineInference::maxmin}};
+  app.add_option("--inference-mode", opt.inference,
+                 "Maximize the sum of the subword scores (sum) or the score "
+                 "of the worst subword (maxmin).")
+      ->transform(CLI::CheckedTransformer(modes));
+
+  app.add_option("--batch-size", opt.batch_size,
+                 "Words segmented in parallel at once.")
+      ->check(CLI::PositiveNumber);
+}
+
+
+void segment_batch(const std::vector<std::string>& words,
+                   const Embeddings& word_vocab,
+                   const OovEmbeddings* oov,
+                   const Eigen::VectorXf& oov_embedding,
+                   const Vocab& subwords,
+                   const Eigen::MatrixXf& subword_embeddings) {
+  std::vector<std::vector<std::string>> segmentations(words.size());
+
+#pragma omp parallel for schedule(dynamic, 16)
+  for(int i = 0; i < words.size(); ++i) {
+    const std::string& word = words[i];
+    Eigen::VectorXf composed;
+    if(word_vocab.contains(word))
+      viterbi_decode(segmentations[i], word,
+                     word_vocab.emb.row(word_vocab[word]), subwords,
+                     subword_embeddings, opt.inference);
+    else if(oov != nullptr && oov->embed(word, composed))
+      viterbi_decode(segmentations[i], word, composed, subwords,
+                     subword_embeddings, opt.inference);
+    else
+      viterbi_decode(segmentations[i], word, oov_embedding, subwords,
+                     subword_embeddings, opt.inference);
+  }
+
+  for(const auto& segmentation : segmentations) {
+    std::string sep = "";
+    for(const auto& subword : segmentation) {
+      std::cout << sep << subword;
+      sep = " ";
+    }
+    std::cout << '\n';
+  }
+  std::cout.flush();
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Embed segment -- segment words by the cosine similarity of "
+               "word and subword embeddings."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    std::cerr << "Loading word embeddings: " << opt.word_embeddings
+              << std::endl;
+    Embeddings word_vocab(opt.word_embeddings);
+
+    Vocab subwords(opt.subwords);
+    Eigen::MatrixXf subword_embeddings;
+    load_embedding_checkpoint(opt.subword_embeddings, subword_embeddings);
+    if(subword_embeddings.rows() != subwords.size())
+      throw std::runtime_error(
+          "The number of subwords does not match the embedding count.");
+    if(subword_embeddings.cols() != word_vocab.embedding_dim)
+      throw std::runtime_error(
+          "The subword and word embeddings differ in dimension.");
+    std::cerr << "Loaded " << subwords.size() << " subwords with embeddings."
+              << std::endl;
+
+    OovEmbeddings oov_table;
+    const OovEmbeddings* oov = nullptr;
+    if(!opt.oov_table.empty()) {
+      oov_table = OovEmbeddings::load(opt.oov_table);
+      if(oov_table.dim() != word_vocab.embedding_dim)
+        throw std::runtime_error(
+            "The OOV table and word embeddings differ in dimension.");
+      oov = &oov_table;
+    }
+
+    // words without an embedding (or any n-gram in the table) get the mean
+    // one, as in segment_vocab_with_subword_embeddings.py
+    Eigen::VectorXf oov_embedding = word_vocab.emb.colwise().mean();
+
+    std::ifstream input(opt.input);
+    if(!input)
+      throw std::runtime_error("Cannot read " + opt.input);
+
+    std::vector<std::string> words;
+    for(std::string line; std::getline(input, line);) {
+      size_t begin = line.find_first_not_of(" \t\r");
+      size_t end = line.find_last_not_of(" \t\r");
+      words.push_back(begin == std::string::npos
+                      ? "" : line.substr(begin, end - begin + 1));
+      if(words.size() == opt.batch_size) {
+        segment_batch(words, word_vocab, oov, oov_embedding, subwords,
+                      subword_embeddings);
+        words.clear();
+      }
+    }
+    segment_batch(words, word_vocab, oov, oov_embedding, subwords,
+                  subword_embeddings);
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
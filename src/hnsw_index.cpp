@@ -0,0 +1,484 @@
+#include "hnsw_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <random>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+const char magic[8] = {'L', 'E', 'G', 'R', 'O', 'S', 'H', 'N'};
+const uint32_t format_version = 1;
+
+// The binary file is this header followed by the upper offsets, the vectors,
+// the levels, the bottom links and the upper links, so that the offsets stay
+// 8-byte aligned.
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  uint32_t dimension;
+  uint32_t m;
+  uint32_t max_level;
+  uint32_t entry_point;
+  uint64_t upper_links;
+};
+
+typedef std::pair<float, uint32_t> Candidate;  // distance and item
+
+template<typename T>
+void write_array(std::ostream& os, const T* values, size_t size) {
+  os.write(reinterpret_cast<const char*>(values), size * sizeof(T));
+}
+
+}  // namespace
+
+
+void HnswIndex::Visited::reset(int size) {
+  if(tags.size() != (size_t)size) {
+    tags.assign(size, 0);
+    tag = 0;
+  }
+  if(++tag == 0) {
+    std::fill(tags.begin(), tags.end(), 0);
+    tag = 1;
+  }
+}
+
+
+float HnswIndex::distance(const float* query, uint32_t id) const {
+  return 1 - Eigen::Map<const Eigen::VectorXf>(query, dimension).dot(
+      item_vector(id));
+}
+
+
+void HnswIndex::search_level(std::vector<Candidate>& result,
+                             const float* query,
+                             uint32_t entry,
+                             int ef,
+                             int level,
+                             Visited& visited,
+                             std::mutex* locks) const {
+  visited.reset(count);
+  std::priority_queue<Candidate, std::vector<Candidate>,
+                      std::greater<Candidate>> candidates;
+  std::priority_queue<Candidate> nearest;  // the farthest on top
+
+  float entry_distance = distance(query, entry);
+  candidates.push({entry_distance, entry});
+  nearest.push({entry_distance, entry});
+  visited.tags[entry] = visited.tag;
+
+  std::vector<uint32_t> neighbors;
+  while(!candidates.empty()) {
+    auto [candidate_distance, candidate] = candidates.top();
+    if(nearest.size() >= ef && candidate_distance > nearest.top().first)
+      break;
+    candidates.pop();
+
+    const uint32_t* list = links(candidate, level);
+    if(locks != nullptr) {
+      std::lock_guard<std::mutex> lock(locks[candidate]);
+      neighbors.assign(list + 1, list + 1 + list[0]);
+    } else {
+      neighbors.assign(list + 1, list + 1 + list[0]);
+    }
+
+    for(uint32_t neighbor : neighbors) {
+      if(visited.tags[neighbor] == visited.tag)
+        continue;
+      visited.tags[neighbor] = visited.tag;
+
+      float neighbor_distance = distance(query, neighbor);
+      if(nearest.size() < ef || neighbor_distance < nearest.top().first) {
+        candidates.push({neighbor_distance, neighbor});
+        nearest.push({neighbor_distance, neighbor});
+        if(nearest.size() > ef)
+          nearest.pop();
+      }
+    }
+  }
+
+  result.resize(nearest.size());
+  for(int i = nearest.size() - 1; i >= 0; --i) {
+    result[i] = nearest.top();
+    nearest.pop();
+  }
+}
+
+
+uint32_t HnswIndex::descend(const float* query, uint32_t entry, int top,
+                            int level, std::mutex* locks) const {
+  float entry_distance = distance(query, entry);
+  std::vector<uint32_t> neighbors;
+  for(int l = top; l > level; --l) {
+    for(bool changed = true; changed;) {
+      changed = false;
+      const uint32_t* list = links(entry, l);
+      if(locks != nullptr) {
+        std::lock_guard<std::mutex> lock(locks[entry]);
+        neighbors.assign(list + 1, list + 1 + list[0]);
+      } else {
+        neighbors.assign(list + 1, list + 1 + list[0]);
+      }
+
+      for(uint32_t neighbor : neighbors) {
+        float neighbor_distance = distance(query, neighbor);
+        if(neighbor_distance < entry_distance) {
+          entry = neighbor;
+          entry_distance = neighbor_distance;
+          changed = true;
+        }
+      }
+    }
+  }
+  return entry;
+}
+
+
+// Inserts the items into an index with allocated links, from any number of
+// threads at once.
+class HnswBuilder {
+ public:
+  HnswBuilder(HnswIndex& index, int ef_construction)
+      : index(index), ef_construction(ef_construction), locks(index.count) {}
+
+  void insert(uint32_t id, HnswIndex::Visited& visited) {
+    int level = index.levels[id];
+
+    // an item above the current top becomes the entry point, so it holds
+    // the lock until it is linked
+    std::unique_lock<std::mutex> entry_lock(entry_mutex);
+    uint32_t entry = index.entry_point;
+    int top = index.max_level;
+    if(level <= top)
+      entry_lock.unlock();
+
+    const float* query = index.vectors + (size_t)id * index.dimension;
+    entry = index.descend(query, entry, top, level, locks.data());
+
+    std::vector<Candidate> candidates;
+    for(int l = std::min(level, top); l >= 0; --l) {
+      index.search_level(candidates, query, entry, ef_construction, l,
+                         visited, locks.data());
+      // another thread may have linked the item on this level already
+      std::erase_if(candidates, [id](const Candidate& candidate) {
+        return candidate.second == id;
+      });
+      if(!candidates.empty())
+        entry = candidates[0].second;
+
+      select_neighbors(candidates, index.m);
+      {
+        std::lock_guard<std::mutex> lock(locks[id]);
+        uint32_t* list = index.mutable_links(id, l);
+        list[0] = candidates.size();
+        for(int i = 0; i < candidates.size(); ++i)
+          list[i + 1] = candidates[i].second;
+      }
+      for(const auto& candidate : candidates)
+        connect(candidate.second, id, l);
+    }
+
+    if(level > top) {
+      index.entry_point = id;
+      index.max_level = level;
+    }
+  }
+
+ private:
+  HnswIndex& index;
+  int ef_construction;
+  std::vector<std::mutex> locks;
+  std::mutex entry_mutex;
+
+  // Keeps at most `max` of the `candidates` (sorted by the distance), each
+  // closer to the base item than to the kept ones, so the links lead in
+  // different directions.
+  void select_neighbors(std::vector<Candidate>& candidates, int max) {
+    std::vector<Candidate> selected;
+    for(const auto& candidate : candidates) {
+      if(selected.size() >= max)
+        break;
+      const float* vector =
+          index.vectors + (size_t)candidate.second * index.dimension;
+      bool diverse = std::all_of(
+          selected.begin(), selected.end(),
+          [&](const Candidate& kept) {
+            return index.distance(vector, kept.second) >= candidate.first;
+          });
+      if(diverse)
+        selected.push_back(candidate);
+    }
+    candidates = std::move(selected);
+  }
+
+  // Links `item` from `neighbor` on `level`, selecting the links of
+  // `neighbor` again when it has no free slot.
+  void connect(uint32_t neighbor, uint32_t item, int level) {
+    std::lock_guard<std::mutex> lock(locks[neighbor]);
+    uint32_t* list = index.mutable_links(neighbor, level);
+    int max = index.max_links(level);
+    if(list[0] < max) {
+      list[++list[0]] = item;
+      return;
+    }
+
+    const float* vector = index.vectors + (size_t)neighbor * index.dimension;
+    std::vector<Candidate> candidates;
+    for(uint32_t i = 1; i <= list[0]; ++i)
+      candidates.push_back({index.distance(vector, list[i]), list[i]});
+    candidates.push_back({index.distance(vector, item), item});
+    std::sort(candidates.begin(), candidates.end());
+
+    select_neighbors(candidates, max);
+    list[0] = candidates.size();
+    for(int i = 0; i < candidates.size(); ++i)
+      list[i + 1] = candidates[i].second;
+  }
+};
+
+
+HnswIndex HnswIndex::build(const Eigen::MatrixXf& vectors,
+                           int m,
+                           int ef_construction,
+                           uint64_t seed) {
+  if(m < 2 || ef_construction < 1)
+    throw std::runtime_error("Invalid HNSW parameters");
+
+  HnswIndex index;
+  index.count = vectors.rows();
+  index.dimension = vectors.cols();
+  index.m = m;
+
+  // row-major and normalized, zero vectors stay zero
+  index.owned_vectors.resize((size_t)index.count * index.dimension);
+  for(uint32_t i = 0; i < index.count; ++i) {
+    Eigen::Map<Eigen::VectorXf> row(
+        index.owned_vectors.data() + (size_t)i * index.dimension,
+        index.dimension);
+    row = vectors.row(i).transpose();
+    float norm = row.norm();
+    if(norm > 0)
+      row /= norm;
+  }
+
+  // the level of an item is geometrically distributed with the ratio 1 / m
+  std::mt19937_64 generator(seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  double level_scale = 1 / std::log((double)m);
+  index.owned_levels.resize(index.count);
+  index.owned_upper_offsets.assign(index.count + 1, 0);
+  for(uint32_t i = 0; i < index.count; ++i) {
+    index.owned_levels[i] = -std::log(1 - uniform(generator)) * level_scale;
+    index.owned_upper_offsets[i + 1] = index.owned_upper_offsets[i]
+        + (uint64_t)index.owned_levels[i] * (m + 1);
+  }
+  index.owned_bottom_links.assign((size_t)index.count * (2 * m + 1), 0);
+  index.owned_upper_links.assign(index.owned_upper_offsets[index.count], 0);
+  index.use_owned_storage();
+  if(index.count == 0)
+    return index;
+
+  index.entry_point = 0;
+  index.max_level = index.levels[0];
+  HnswBuilder builder(index, ef_construction);
+
+#pragma omp parallel
+  {
+    Visited visited;
+#pragma omp for schedule(dynamic, 64)
+    for(uint32_t i = 1; i < index.count; ++i)
+      builder.insert(i, visited);
+  }
+
+  return index;
+}
+
+
+void HnswIndex::use_owned_storage() {
+  vectors = owned_vectors.data();
+  levels = owned_levels.data();
+  bottom_links = owned_bottom_links.data();
+  upper_offsets = owned_upper_offsets.data();
+  upper_links = owned_upper_links.data();
+}
+
+
+HnswIndex HnswIndex::load(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if(fd < 0 || fstat(fd, &file_stat) != 0) {
+    if(fd >= 0)
+      close(fd);
+    throw std::runtime_error("Cannot read HNSW index from '" + path + "'");
+  }
+
+  size_t file_size = file_stat.st_size;
+  void* data = file_size < sizeof(Header)
+               ? MAP_FAILED
+               : mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    throw std::runtime_error("Cannot map HNSW index '" + path + "'");
+
+  HnswIndex index;
+  index.mapping = std::shared_ptr<void>(
+      data, [file_size](void* data) { munmap(data, file_size); });
+
+  const Header& header = *static_cast<const Header*>(data);
+  // the arrays are bounded by the file size one by one, so that their total
+  // size cannot overflow
+  size_t bottom_size = sizeof(uint32_t) * (2 * (size_t)header.m + 1);
+  bool valid = std::memcmp(header.magic, magic, sizeof(magic)) == 0
+      && header.version == format_version && header.m >= 2
+      && (header.count == 0 || header.entry_point < header.count)
+      && header.count <= file_size / bottom_size
+      && (size_t)header.count * header.dimension <= file_size / sizeof(float)
+      && header.upper_links <= file_size / sizeof(uint32_t);
+  if(valid) {
+    size_t expected_size = sizeof(Header)
+        + sizeof(uint64_t) * ((size_t)header.count + 1)
+        + sizeof(float) * (size_t)header.count * header.dimension
+        + sizeof(int32_t) * (size_t)header.count
+        + bottom_size * header.count
+        + sizeof(uint32_t) * header.upper_links;
+    valid = file_size == expected_size;
+  }
+  if(!valid)
+    throw std::runtime_error("HNSW index '" + path
+                             + "' is corrupted or of another version");
+
+  index.count = header.count;
+  index.dimension = header.dimension;
+  index.m = header.m;
+  index.max_level = header.max_level;
+  index.entry_point = header.entry_point;
+
+  const char* pos = static_cast<const char*>(data) + sizeof(Header);
+  auto take = [&pos](size_t bytes) {
+    const char* begin = pos;
+    pos += bytes;
+    return begin;
+  };
+
+  index.upper_offsets = reinterpret_cast<const uint64_t*>(
+      take(sizeof(uint64_t) * ((size_t)header.count + 1)));
+  index.vectors = reinterpret_cast<const float*>(
+      take(sizeof(float) * (size_t)header.count * header.dimension));
+  index.levels = reinterpret_cast<const int32_t*>(
+      take(sizeof(int32_t) * header.count));
+  index.bottom_links = reinterpret_cast<const uint32_t*>(
+      take(sizeof(uint32_t) * (size_t)header.count * (2 * header.m + 1)));
+  index.upper_links = reinterpret_cast<const uint32_t*>(
+      take(sizeof(uint32_t) * header.upper_links));
+
+  // the searches follow the levels, offsets and links unchecked
+  valid = index.upper_offsets[0] == 0
+          && index.upper_offsets[index.count] == header.upper_links
+          && (index.count == 0
+              || index.levels[index.entry_point] == (int64_t)index.max_level);
+  for(uint32_t id = 0; id < index.count && valid; ++id) {
+    int32_t level = index.levels[id];
+    valid = level >= 0 && level <= (int64_t)index.max_level
+            && index.upper_offsets[id + 1] >= index.upper_offsets[id]
+            && index.upper_offsets[id + 1] - index.upper_offsets[id]
+               == (uint64_t)level * (index.m + 1);
+  }
+  for(uint32_t id = 0; id < index.count && valid; ++id) {
+    for(int level = 0; level <= index.levels[id] && valid; ++level) {
+      const uint32_t* item_links = index.links(id, level);
+      valid = item_links[0] <= (uint32_t)index.max_links(level)
+              && std::all_of(item_links + 1, item_links + 1 + item_links[0],
+                             [&index](uint32_t link) {
+                               return link < index.count;
+                             });
+    }
+  }
+  if(!valid)
+    throw std::runtime_error("HNSW index '" + path
+                             + "' is corrupted or of another version");
+  return index;
+}
+
+
+void HnswIndex::save(const std::string& path) const {
+  std::ofstream os(path, std::ios::binary);
+
+  Header header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = format_version;
+  header.count = count;
+  header.dimension = dimension;
+  header.m = m;
+  header.max_level = max_level;
+  header.entry_point = entry_point;
+  header.upper_links = upper_offsets[count];
+
+  write_array(os, &header, 1);
+  write_array(os, upper_offsets, (size_t)count + 1);
+  write_array(os, vectors, (size_t)count * dimension);
+  write_array(os, levels, count);
+  write_array(os, bottom_links, (size_t)count * (2 * m + 1));
+  write_array(os, upper_links, header.upper_links);
+  if(!os)
+    throw std::runtime_error("Cannot write HNSW index to '" + path + "'");
+}
+
+
+void HnswIndex::search(std::vector<Neighbor>& result,
+                       const Eigen::VectorXf& query,
+                       int k,
+                       int ef,
+                       Visited& visited) const {
+  result.clear();
+  if(count == 0 || k <= 0)
+    return;
+
+  Eigen::VectorXf normalized = query;
+  float norm = normalized.norm();
+  if(norm > 0)
+    normalized /= norm;
+
+  uint32_t entry = descend(normalized.data(), entry_point, max_level, 0);
+  std::vector<Candidate> candidates;
+  search_level(candidates, normalized.data(), entry, std::max(ef, k), 0,
+               visited);
+
+  for(int i = 0; i < candidates.size() && i < k; ++i)
+    result.push_back({(int)candidates[i].second, 1 - candidates[i].first});
+}
+
+
+void HnswIndex::search(std::vector<Neighbor>& result,
+                       const Eigen::VectorXf& query,
+                       int k,
+                       int ef) const {
+  Visited visited;
+  search(result, query, k, ef, visited);
+}
+
+
+void HnswIndex::search_batch(std::vector<std::vector<Neighbor>>& results,
+                             const Eigen::MatrixXf& queries,
+                             int k,
+                             int ef) const {
+  results.resize(queries.rows());
+
+#pragma omp parallel
+  {
+    Visited visited;
+#pragma omp for schedule(dynamic, 64)
+    for(int i = 0; i < queries.rows(); ++i)
+      search(results[i], queries.row(i).transpose(), k, ef, visited);
+  }
+}
@@ -0,0 +1,139 @@
+#ifndef SSEG_HNSW_INDEX_H_
+#define SSEG_HNSW_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+// Approximate nearest neighbours by cosine similarity in a hierarchical
+// navigable small world graph (Malkov and Yashunin, 2018). The vectors are
+// stored normalized, every item links to at most `m` neighbours on the upper
+// layers and `2 * m` on the bottom one, which contains all items. The index
+// is built in parallel, queries are const and safe to run from multiple
+// threads, and the binary file written by `save` is memory-mapped by `load`.
+class HnswIndex {
+ public:
+  struct Neighbor {
+    int id;
+    float similarity;
+  };
+
+  HnswIndex() = default;
+  HnswIndex(HnswIndex&&) = default;
+  HnswIndex& operator=(HnswIndex&&) = default;
+  HnswIndex(const HnswIndex&) = delete;
+  HnswIndex& operator=(const HnswIndex&) = delete;
+
+  // Indexes the rows of `vectors`. The layers of the items are drawn from
+  // `seed`; with several threads, the links also depend on the order in
+  // which the items are inserted.
+  static HnswIndex build(const Eigen::MatrixXf& vectors,
+                         int m = 16,
+                         int ef_construction = 200,
+                         uint64_t seed = 42);
+
+  // Loads and saves the binary format. Throw std::runtime_error when the
+  // file cannot be read or written.
+  static HnswIndex load(const std::string& path);
+  void save(const std::string& path) const;
+
+  // Fills `result` with the (at most) `k` items most similar to `query`,
+  // the most similar first, exploring `ef` candidates (at least `k`).
+  void search(std::vector<Neighbor>& result,
+              const Eigen::VectorXf& query,
+              int k,
+              int ef = 64) const;
+
+  // Searches the rows of `queries` in parallel.
+  void search_batch(std::vector<std::vector<Neighbor>>& results,
+                    const Eigen::MatrixXf& queries,
+                    int k,
+                    int ef = 64) const;
+
+  int size() const { return count; }
+  int dim() const { return dimension; }
+
+  // The normalized vector of an item.
+  Eigen::Map<const Eigen::VectorXf> item_vector(int id) const {
+    return {vectors + (size_t)id * dimension, dimension};
+  }
+
+ private:
+  // Marks the items visited by a search, reset by increasing the tag.
+  struct Visited {
+    std::vector<uint32_t> tags;
+    uint32_t tag = 0;
+
+    void reset(int size);
+  };
+
+  uint32_t count = 0;
+  uint32_t dimension = 0;
+  uint32_t m = 0;
+  uint32_t max_level = 0;
+  uint32_t entry_point = 0;
+
+  // views of either the owned arrays or the mapped file
+  const float* vectors = nullptr;  // count x dimension
+  const int32_t* levels = nullptr;  // count
+  // bottom layer, per item the number of links and 2 * m slots
+  const uint32_t* bottom_links = nullptr;
+  // upper layers, per item from upper_offsets[id] a block of the number of
+  // links and m slots for each of its levels above the bottom
+  const uint64_t* upper_offsets = nullptr;  // count + 1
+  const uint32_t* upper_links = nullptr;
+
+  std::vector<float> owned_vectors;
+  std::vector<int32_t> owned_levels;
+  std::vector<uint32_t> owned_bottom_links;
+  std::vector<uint64_t> owned_upper_offsets;
+  std::vector<uint32_t> owned_upper_links;
+
+  std::shared_ptr<void> mapping;  // unmaps the file
+
+  int max_links(int level) const { return level == 0 ? 2 * m : m; }
+
+  // The links of an item on a level: their number followed by the slots.
+  const uint32_t* links(uint32_t id, int level) const {
+    if(level == 0)
+      return bottom_links + (size_t)id * (2 * m + 1);
+    return upper_links + upper_offsets[id] + (size_t)(level - 1) * (m + 1);
+  }
+  uint32_t* mutable_links(uint32_t id, int level) {
+    return const_cast<uint32_t*>(links(id, level));
+  }
+
+  float distance(const float* query, uint32_t id) const;
+
+  // The `ef` items closest to `query` reachable on `level` from `entry`, the
+  // closest first, as pairs of the distance and the item. During the build,
+  // the links of an item are read under its lock in `locks`.
+  void search_level(std::vector<std::pair<float, uint32_t>>& result,
+                    const float* query,
+                    uint32_t entry,
+                    int ef,
+                    int level,
+                    Visited& visited,
+                    std::mutex* locks = nullptr) const;
+
+  // Greedy search from `entry` on the levels from `top` down to above
+  // `level`.
+  uint32_t descend(const float* query, uint32_t entry, int top, int level,
+                   std::mutex* locks = nullptr) const;
+
+  void search(std::vector<Neighbor>& result,
+              const Eigen::VectorXf& query,
+              int k,
+              int ef,
+              Visited& visited) const;
+
+  void use_owned_storage();
+
+  friend class HnswBuilder;
+};
+
+#endif  // SSEG_HNSW_INDEX_H_
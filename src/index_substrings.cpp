@@ -0,0 +1,57 @@
+/**
+ * Index substrings -- convert allowed substrings to the binary index.
+ * Input:
+ * - allowed substrings: a word and its substrings per line, optionally each
+ *   followed by a weight (--weighted)
+ *
+ * Output:
+ * - binary CSR index, which legros-train and the substring statistics map
+ *   into memory instead of parsing the text
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "CLI11.hpp"
+#include "allowed_substrings.h"
+
+struct opt {
+  std::string input;
+  std::string output;
+  bool weighted = false;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option(
+      "allowed_substrings", opt.input, "Allowed substrings in the text format.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("-o,--output", opt.output, "Binary index.")
+      ->required();
+
+  app.add_flag("--weighted", opt.weighted,
+               "Every substring is followed by its weight.");
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Index substrings -- convert allowed substrings to the binary index."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    AllowedSubstrings index = AllowedSubstrings::load(opt.input, opt.weighted);
+    index.save(opt.output);
+
+    std::cerr << "Indexed " << index.word_count() << " words, "
+              << index.subword_count() << " subwords and "
+              << index.entry_count() << " allowed substrings into "
+              << opt.output << std::endl;
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,215 @@
+#include "instrumentation.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+long current_rss_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  long size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+long peak_rss_bytes() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss * 1024L;  // kilobytes on Linux
+}
+
+
+namespace {
+
+double to_mb(long bytes) {
+  return bytes / (1024.0 * 1024.0);
+}
+
+}  // namespace
+
+
+Profiler::Profiler() : start(std::chrono::steady_clock::now()) {}
+
+
+Profiler::~Profiler() {
+  if(sampling) {
+    sampling = false;
+    sampler.join();
+  }
+}
+
+
+double Profiler::now_us() const {
+  return std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+
+void Profiler::start_rss_sampling(int interval_ms) {
+  if(sampling)
+    return;
+  sampling = true;
+  sampler = std::thread([this, interval_ms]() {
+    while(sampling) {
+      sample_rss();
+      std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+  });
+}
+
+
+void Profiler::sample_rss() {
+  long rss = current_rss_bytes();
+  std::lock_guard<std::mutex> lock(mutex);
+  for(size_t index : open_phases)
+    phases[index].peak_rss = std::max(phases[index].peak_rss, rss);
+}
+
+
+void Profiler::begin_phase(const std::string& name) {
+  long rss = current_rss_bytes();
+  std::lock_guard<std::mutex> lock(mutex);
+  phases.push_back({name, (int)open_phases.size(), now_us()});
+  phases.back().peak_rss = rss;
+  open_phases.push_back(phases.size() - 1);
+}
+
+
+void Profiler::end_phase() {
+  long rss = current_rss_bytes();
+  std::lock_guard<std::mutex> lock(mutex);
+  if(open_phases.empty())
+    return;
+
+  Phase& phase = phases[open_phases.back()];
+  open_phases.pop_back();
+  phase.duration_us = now_us() - phase.start_us;
+  phase.closed = true;
+  phase.rss = rss;
+  phase.peak_rss = std::max(phase.peak_rss, rss);
+
+  // the enclosing phase contains this one
+  if(!open_phases.empty()) {
+    Phase& parent = phases[open_phases.back()];
+    parent.peak_rss = std::max(parent.peak_rss, phase.peak_rss);
+  }
+}
+
+
+void Profiler::count(const std::string& name, long value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for(auto& counter : counters) {
+    if(counter.name == name) {
+      counter.value += value;
+      return;
+    }
+  }
+  std::string phase = open_phases.empty() ? "" : phases[open_phases.back()].name;
+  counters.push_back({name, phase, value});
+}
+
+
+void Profiler::write_report(std::ostream& out, const std::string& stage,
+                            int epoch) {
+  struct PhaseSummary {
+    std::string name;
+    int calls = 0;
+    double seconds = 0;
+    long rss = 0;
+    long peak_rss = 0;
+  };
+
+  std::vector<PhaseSummary> summaries;
+  std::vector<Counter> reported_counters;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& phase : phases) {
+      if(phase.reported || !phase.closed)
+        continue;
+      phase.reported = true;
+
+      auto summary = std::find_if(
+          summaries.begin(), summaries.end(),
+          [&](const PhaseSummary& s) { return s.name == phase.name; });
+      if(summary == summaries.end()) {
+        summaries.push_back({phase.name});
+        summary = summaries.end() - 1;
+      }
+      summary->calls++;
+      summary->seconds += phase.duration_us / 1e6;
+      summary->rss = phase.rss;
+      summary->peak_rss = std::max(summary->peak_rss, phase.peak_rss);
+    }
+    reported_counters.swap(counters);
+  }
+
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(6);
+  line << "{\"stage\": \"" << stage << "\"";
+  if(epoch >= 0)
+    line << ", \"epoch\": " << epoch;
+  line << ", \"time\": " << now_us() / 1e6
+       << ", \"peak_rss_mb\": " << to_mb(peak_rss_bytes());
+
+  line << ", \"phases\": {";
+  for(size_t i = 0; i < summaries.size(); ++i) {
+    const auto& summary = summaries[i];
+    line << (i > 0 ? ", " : "") << "\"" << summary.name << "\": {"
+         << "\"calls\": " << summary.calls
+         << ", \"seconds\": " << summary.seconds
+         << ", \"rss_mb\": " << to_mb(summary.rss)
+         << ", \"peak_rss_mb\": " << to_mb(summary.peak_rss) << "}";
+  }
+
+  line << "}, \"counters\": {";
+  for(size_t i = 0; i < reported_counters.size(); ++i) {
+    const auto& counter = reported_counters[i];
+    line << (i > 0 ? ", " : "") << "\"" << counter.name << "\": "
+         << counter.value;
+
+    auto summary = std::find_if(
+        summaries.begin(), summaries.end(),
+        [&](const PhaseSummary& s) { return s.name == counter.phase; });
+    if(summary != summaries.end() && summary->seconds > 0)
+      line << ", \"" << counter.name << "_per_second\": "
+           << counter.value / summary->seconds;
+  }
+  line << "}}";
+
+  out << line.str() << std::endl;
+}
+
+
+void Profiler::write_trace(const std::string& path) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::ofstream out(path);
+  out << std::fixed << std::setprecision(3);
+  out << "{\"traceEvents\": [";
+  bool first = true;
+  for(const auto& phase : phases) {
+    if(!phase.closed)
+      continue;
+
+    out << (first ? "" : ",") << "\n  {\"name\": \"" << phase.name
+        << "\", \"cat\": \"legros\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1"
+        << ", \"ts\": " << phase.start_us << ", \"dur\": " << phase.duration_us
+        << ", \"args\": {\"rss_mb\": " << to_mb(phase.rss)
+        << ", \"peak_rss_mb\": " << to_mb(phase.peak_rss) << "}}";
+    out << ",\n  {\"name\": \"rss_mb\", \"ph\": \"C\", \"pid\": 1"
+        << ", \"ts\": " << phase.start_us + phase.duration_us
+        << ", \"args\": {\"rss_mb\": " << to_mb(phase.rss) << "}}";
+    first = false;
+  }
+  out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
+
+
+Profiler& profiler() {
+  static Profiler instance;
+  return instance;
+}
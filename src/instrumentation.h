@@ -0,0 +1,101 @@
+#ifndef SSEG_INSTRUMENTATION_H_
+#define SSEG_INSTRUMENTATION_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Resident set size of the process, in bytes.
+long current_rss_bytes();
+
+// Peak resident set size of the process since its start, in bytes.
+long peak_rss_bytes();
+
+
+// Records the duration and memory use of the phases of a computation and
+// named counters. Phases are nested scopes on the main thread (see
+// ScopedTimer); counters may be incremented from any thread.
+//
+// The recorded phases and counters are written as a JSON line per stage
+// (e.g. per epoch) with `write_report`, after which they start from zero
+// again. All phases are also kept for `write_trace`, which writes them in
+// the Chrome trace-event format (chrome://tracing, Perfetto).
+class Profiler {
+ public:
+  Profiler();
+  ~Profiler();
+
+  Profiler(const Profiler&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+
+  // Samples the resident set size every `interval_ms` milliseconds in a
+  // background thread, so that the peak within each phase is measured.
+  // Without sampling, only the sizes at the phase boundaries are seen.
+  void start_rss_sampling(int interval_ms = 10);
+
+  void begin_phase(const std::string& name);
+  void end_phase();
+
+  // Adds `value` to the counter `name`. The report also gives the counter
+  // per second of the phase that was running when it was first counted.
+  void count(const std::string& name, long value);
+
+  // Writes the phases and counters since the last report as a JSON line
+  // with the given stage name and epoch (omitted when negative).
+  void write_report(std::ostream& out, const std::string& stage, int epoch = -1);
+
+  // Writes all phases recorded so far as a Chrome trace.
+  void write_trace(const std::string& path) const;
+
+ private:
+  struct Phase {
+    std::string name;
+    int depth;
+    double start_us;
+    double duration_us = 0;
+    long rss = 0;
+    long peak_rss = 0;
+    bool closed = false;
+    bool reported = false;
+  };
+
+  struct Counter {
+    std::string name;
+    std::string phase;
+    long value;
+  };
+
+  double now_us() const;
+  void sample_rss();
+
+  std::chrono::steady_clock::time_point start;
+
+  mutable std::mutex mutex;
+  std::vector<Phase> phases;  // all phases, for the trace
+  std::vector<size_t> open_phases;  // indices into `phases`, innermost last
+  std::vector<Counter> counters;  // since the last report
+
+  std::atomic<bool> sampling = false;
+  std::thread sampler;
+};
+
+// The process-wide profiler.
+Profiler& profiler();
+
+
+// Measures a phase from the construction to the end of the scope.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(const std::string& name) { profiler().begin_phase(name); }
+  ~ScopedTimer() { profiler().end_phase(); }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+#endif  // SSEG_INSTRUMENTATION_H_
@@ -0,0 +1,259 @@
+#ifndef SSEG_LATTICE_DECODER_H_
+#define SSEG_LATTICE_DECODER_H_
+
+// Decoders of the subword lattice of a token, shared by the bigram models.
+//
+// A model type provides the type of its lattice candidates and the scoring:
+//
+//   struct Model {
+//     struct Candidate {
+//       std::string text;
+//       bool allowed;       // may be a subword: in the vocabulary, or a
+//                           // single code point
+//       const void* state;  // equal for subwords that score the following
+//                           // subword the same, nullptr shared by the OOVs
+//       ...                 // whatever the scoring needs
+//     };
+//     void fill(Candidate& candidate, std::string text, bool single_unit) const;
+//     void fill_begin(Candidate& candidate) const;  // the word beginning
+//     float score(const Candidate& subword, const Candidate& prev) const;
+//   };
+//
+// The candidates are filled once per token, so that the inner loops only
+// score pairs of candidates.
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "utf8.h"
+
+// Viterbi search for subwords of at most `Window` bytes (and at most
+// `max_subword_length` bytes, which must not be more). The lattice is stored
+// as fixed-size windows of `Window` columns per position instead of the full
+// quadratic table.
+template<int Window, typename Model>
+void viterbi_window(std::vector<std::string>& segmentation,
+                    const std::string& token,
+                    const Model& model,
+                    int max_subword_length) {
+  typedef typename Model::Candidate Candidate;
+
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, token);
+  int units = boundaries.size() - 1;
+
+  // candidates[row][k] spans the units row..row+k, no subword within the
+  // length limit has more units than bytes
+  std::vector<std::array<Candidate, Window>> candidates(units);
+  std::vector<std::array<float, Window>> scores(units);
+  std::vector<std::array<int, Window>> prev_rows(units);
+
+  for(int row = 0; row < units; ++row) {
+    scores[row].fill(-std::numeric_limits<float>::infinity());
+    prev_rows[row].fill(-1);
+    for(int k = 0; k < Window && row + k < units; ++k) {
+      int length = boundaries[row + k + 1] - boundaries[row];
+      if(k > 0 && length > max_subword_length)
+        break;
+      model.fill(candidates[row][k], token.substr(boundaries[row], length),
+                 k == 0);
+    }
+  }
+
+  Candidate begin;
+  model.fill_begin(begin);
+
+  for(int row = 0; row < units; ++row) {
+    int min_prev_row = std::max(0, row - 1);
+    while(min_prev_row > 0 && boundaries[row] - boundaries[min_prev_row - 1]
+                              <= max_subword_length)
+      --min_prev_row;
+
+    for(int k = 0; k < Window && row + k < units; ++k) {
+      const Candidate& subword = candidates[row][k];
+      if(subword.text.empty())
+        break;  // over the length limit
+      if(!subword.allowed)
+        continue;
+
+      if(row == 0) {
+        scores[row][k] = model.score(subword, begin);
+        continue;
+      }
+
+      float best_prev_score = -std::numeric_limits<float>::infinity();
+      int best_prev_index = -1;
+
+      for(int prev_row = min_prev_row; prev_row < row; ++prev_row) {
+        int prev_k = row - 1 - prev_row;
+        const Candidate& prev = candidates[prev_row][prev_k];
+        if(!prev.allowed)
+          continue;
+
+        float prev_score = scores[prev_row][prev_k];
+        if(prev_score == -std::numeric_limits<float>::infinity())
+          continue;
+
+        float bigram_score = model.score(subword, prev) + prev_score;
+
+        if(bigram_score > best_prev_score) {
+          best_prev_score = bigram_score;
+          best_prev_index = prev_row;
+        }
+      }
+
+      assert(best_prev_index != -1);
+      prev_rows[row][k] = best_prev_index;
+      scores[row][k] = best_prev_score;
+    }
+  }
+
+  // the best subword ending at the last unit
+  int row = -1;
+  float best_score = -std::numeric_limits<float>::infinity();
+  for(int r = std::max(0, units - Window); r < units; ++r) {
+    if(scores[r][units - 1 - r] > best_score) {
+      best_score = scores[r][units - 1 - r];
+      row = r;
+    }
+  }
+  assert(row != -1);
+
+  int subword_end = units;
+  while(subword_end > 0) {
+    int subword_begin = row;
+    int k = subword_end - 1 - subword_begin;
+    segmentation.push_back(candidates[subword_begin][k].text);
+    row = prev_rows[subword_begin][k];
+    subword_end = subword_begin;
+  }
+
+  std::reverse(segmentation.begin(), segmentation.end());
+}
+
+
+// Beam search keeping at most `beam_size` hypotheses per position.
+// Hypotheses ending with the same subword (state) are recombined, so with a
+// beam at least as large as the number of subwords that can end at one
+// position, this is an exact search for any subword length. Replaces the
+// content of `segmentation`.
+template<typename Model>
+void beam_search(std::vector<std::string>& segmentation,
+                 const std::string& token,
+                 const Model& model,
+                 int max_subword_length,
+                 int beam_size) {
+  typedef typename Model::Candidate Candidate;
+
+  // A hypothesis ends with the subword spanning `length` units from `begin`
+  // and continues the hypothesis at index `back` in the arena.
+  struct Hypothesis {
+    int begin;
+    int length;
+    float score;
+    int back;
+  };
+
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, token);
+  int units = boundaries.size() - 1;
+
+  // candidates[start * window + k] spans the units start..start+k
+  int window = std::max(1, std::min(units, max_subword_length));
+  std::vector<Candidate> candidates(units * window);
+  for(int start = 0; start < units; ++start) {
+    for(int k = 0; k < window && start + k < units; ++k) {
+      int length = boundaries[start + k + 1] - boundaries[start];
+      if(k > 0 && length > max_subword_length)
+        break;
+      model.fill(candidates[start * window + k],
+                 token.substr(boundaries[start], length), k == 0);
+    }
+  }
+
+  Candidate begin;
+  model.fill_begin(begin);
+  auto last_subword = [&](const Hypothesis& hyp) -> const Candidate& {
+    if(hyp.begin < 0)
+      return begin;
+    return candidates[hyp.begin * window + hyp.length - 1];
+  };
+
+  // The beam of position p is arena[beam_offsets[p], beam_offsets[p + 1]).
+  // Each position is pruned once, when all subwords ending there are scored.
+  std::vector<Hypothesis> arena;
+  arena.reserve(1 + units * std::min(beam_size, window));
+  std::vector<int> beam_offsets(units + 2);
+  arena.push_back({-1, 0, 0.0f, -1});
+  beam_offsets[1] = 1;
+
+  std::vector<Hypothesis> pending;
+  for(int end = 1; end <= units; ++end) {
+    pending.clear();
+    int pending_oov = -1;  // the hypothesis with the nullptr state
+
+    for(int start = std::max(0, end - window); start < end; ++start) {
+      const Candidate& subword = candidates[start * window + end - 1 - start];
+      if(subword.text.empty() || !subword.allowed)
+        continue;  // over the length limit or not in the vocabulary
+
+      // hypotheses ending with the same subword are recombined, only the
+      // best one can be continued to the best path
+      int best_back = -1;
+      float best_score = -std::numeric_limits<float>::infinity();
+      for(int h = beam_offsets[start]; h < beam_offsets[start + 1]; ++h) {
+        float score = arena[h].score
+                      + model.score(subword, last_subword(arena[h]));
+        if(score > best_score) {
+          best_score = score;
+          best_back = h;
+        }
+      }
+      if(best_back == -1)
+        continue;
+
+      Hypothesis hyp{start, end - start, best_score, best_back};
+      if(subword.state != nullptr) {
+        pending.push_back(hyp);
+      } else if(pending_oov == -1) {
+        pending_oov = pending.size();
+        pending.push_back(hyp);
+      } else if(best_score > pending[pending_oov].score) {
+        pending[pending_oov] = hyp;
+      }
+    }
+
+    if(pending.size() > beam_size) {
+      std::nth_element(
+          pending.begin(), pending.begin() + beam_size, pending.end(),
+          [](const Hypothesis& a, const Hypothesis& b) {
+            return a.score > b.score;
+          });
+      pending.resize(beam_size);
+    }
+
+    arena.insert(arena.end(), pending.begin(), pending.end());
+    beam_offsets[end + 1] = arena.size();
+  }
+
+  int winner = -1;
+  float best_score = -std::numeric_limits<float>::infinity();
+  for(int h = beam_offsets[units]; h < beam_offsets[units + 1]; ++h) {
+    if(winner == -1 || arena[h].score > best_score) {
+      best_score = arena[h].score;
+      winner = h;
+    }
+  }
+  assert(winner != -1);
+
+  segmentation.clear();
+  for(int h = winner; arena[h].begin >= 0; h = arena[h].back)
+    segmentation.push_back(last_subword(arena[h]).text);
+  std::reverse(segmentation.begin(), segmentation.end());
+}
+
+#endif  // SSEG_LATTICE_DECODER_H_
@@ -0,0 +1,62 @@
+#include "legros_c.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+#include "segmenter.h"
+
+struct legros_segmenter {
+  Segmenter segmenter;
+};
+
+
+legros_segmenter* legros_segmenter_load(const char* bigram_stats,
+                                        const char* unigram_stats,
+                                        int beam_size,
+                                        int pretokenize) {
+  try {
+    return new legros_segmenter{
+        Segmenter(bigram_stats, unigram_stats, beam_size, pretokenize != 0)};
+  } catch(const std::exception& e) {
+    std::cerr << "legros: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+
+void legros_segmenter_free(legros_segmenter* segmenter) {
+  delete segmenter;
+}
+
+
+size_t legros_segment(const legros_segmenter* segmenter,
+                      const char* text, size_t length,
+                      int32_t* ids, size_t capacity) {
+  std::vector<int> result = segmenter->segmenter.segment(
+      std::string_view(text, length));
+
+  std::copy_n(result.begin(), std::min(capacity, result.size()), ids);
+  return result.size();
+}
+
+
+int32_t legros_vocab_size(const legros_segmenter* segmenter) {
+  return segmenter->segmenter.vocab_size();
+}
+
+
+int32_t legros_id_to_piece(const legros_segmenter* segmenter, int32_t id,
+                           char* piece, size_t capacity) {
+  if(id < 0 || id >= segmenter->segmenter.vocab_size())
+    return -1;
+
+  std::string result = segmenter->segmenter.id_to_piece(id);
+  if(capacity > 0) {
+    size_t length = std::min(capacity - 1, result.size());
+    std::memcpy(piece, result.data(), length);
+    piece[length] = '\0';
+  }
+  return result.size();
+}
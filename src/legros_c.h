@@ -0,0 +1,51 @@
+/**
+ * C interface to the legros bigram segmenter, for use through FFI.
+ *
+ * A segmenter is loaded once and can then be used from multiple threads at
+ * the same time. IDs refer to the output vocabulary described in
+ * segmenter.h.
+ */
+
+#ifndef SSEG_LEGROS_C_H_
+#define SSEG_LEGROS_C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct legros_segmenter legros_segmenter;
+
+// Loads a segmenter from bigram and unigram statistics. Returns NULL when
+// the model cannot be loaded.
+legros_segmenter* legros_segmenter_load(const char* bigram_stats,
+                                        const char* unigram_stats,
+                                        int beam_size,
+                                        int pretokenize);
+
+void legros_segmenter_free(legros_segmenter* segmenter);
+
+// Segments `length` bytes of `text` (a single line). Writes at most
+// `capacity` IDs to `ids` and returns the total number of IDs of the
+// segmentation, so the call can be repeated with a larger buffer when the
+// result exceeds `capacity`.
+size_t legros_segment(const legros_segmenter* segmenter,
+                      const char* text, size_t length,
+                      int32_t* ids, size_t capacity);
+
+// Size of the output vocabulary.
+int32_t legros_vocab_size(const legros_segmenter* segmenter);
+
+// Copies the output vocabulary item with the given ID into `piece` as a
+// null-terminated string of at most `capacity` bytes. Returns the length of
+// the item, or -1 for an unknown ID.
+int32_t legros_id_to_piece(const legros_segmenter* segmenter, int32_t id,
+                           char* piece, size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SSEG_LEGROS_C_H_
@@ -0,0 +1,122 @@
+/**
+ * Merge -- merge partial word cooccurrence counts.
+ * Input:
+ * - partial counts written by legros-count or by legros-merge, all with the
+ *   same vocabulary and window size
+ *
+ * Output:
+ * - merged counts in the same format, for legros-train --word-counts or for
+ *   a further merge
+ */
+
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "CLI11.hpp"
+#include "word_counts.h"
+
+struct opt {
+  std::vector<std::string> inputs;
+  std::string output;
+  uint64_t min_count = 1;
+  uint64_t min_word_count = 1;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option("inputs", opt.inputs, "Partial counts.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("-o,--output", opt.output, "Merged counts.")
+      ->required();
+
+  app.add_option("--min-count", opt.min_count,
+                 "Drop the word pairs with a merged count below this.");
+
+  app.add_option("--min-word-count", opt.min_word_count,
+                 "Drop the word pairs with a word whose merged frequency is "
+                 "below this. Filter only in the final merge, the counts "
+                 "dropped from a partial merge are lost.");
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Merge -- merge partial word cooccurrence counts."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    std::vector<std::unique_ptr<WordCountsReader>> readers;
+    for(const auto& input : opt.inputs)
+      readers.push_back(std::make_unique<WordCountsReader>(input));
+
+    // the merged header; the shards must agree on everything but the sizes
+    WordCountsInfo info = readers[0]->info();
+    for(int i = 1; i < readers.size(); ++i) {
+      const WordCountsInfo& other = readers[i]->info();
+      if(other.vocabulary_size != info.vocabulary_size
+         || other.vocabulary_fingerprint != info.vocabulary_fingerprint
+         || other.window_size != info.window_size)
+        throw std::runtime_error(
+            "'" + opt.inputs[i] + "' has another vocabulary or window size "
+            "than '" + opt.inputs[0] + "'");
+
+      info.lines += other.lines;
+      info.tokens += other.tokens;
+      for(int w = 0; w < info.vocabulary_size; ++w)
+        info.word_frequencies[w] += other.word_frequencies[w];
+    }
+
+    // the next pair of every input, the smallest on the top
+    typedef std::pair<WordPairCount, int> Head;
+    auto greater = [](const Head& a, const Head& b) {
+      if(a.first.word != b.first.word)
+        return a.first.word > b.first.word;
+      return a.first.context > b.first.context;
+    };
+    std::priority_queue<Head, std::vector<Head>, decltype(greater)> heads(
+        greater);
+    for(int i = 0; i < readers.size(); ++i) {
+      WordPairCount pair;
+      if(readers[i]->next(pair))
+        heads.push({pair, i});
+    }
+
+    std::cerr << "Merging " << readers.size() << " partial counts"
+              << std::endl;
+    WordCountsWriter writer(opt.output, info);
+    uint64_t input_pairs = 0;
+    while(!heads.empty()) {
+      WordPairCount merged = heads.top().first;
+      merged.count = 0;
+      while(!heads.empty() && heads.top().first.word == merged.word
+            && heads.top().first.context == merged.context) {
+        auto [pair, i] = heads.top();
+        heads.pop();
+        merged.count += pair.count;
+        ++input_pairs;
+        if(readers[i]->next(pair))
+          heads.push({pair, i});
+      }
+
+      if(merged.count >= opt.min_count
+         && info.word_frequencies[merged.word] >= opt.min_word_count
+         && info.word_frequencies[merged.context] >= opt.min_word_count)
+        writer.add(merged);
+    }
+    writer.close();
+
+    std::cerr << "Merged " << input_pairs << " word pairs of " << info.lines
+              << " lines and " << info.tokens << " tokens into "
+              << writer.pairs() << " word pairs in " << opt.output
+              << std::endl;
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
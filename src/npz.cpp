@@ -0,0 +1,217 @@
+#include "npz.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t zip64_limit = 0xFFFFFFFF;
+
+uint32_t crc32(const std::string& bytes) {
+  static const std::array<uint32_t, 256> table = [] {
+    std::array<uint32_t, 256> table;
+    for(uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for(int k = 0; k < 8; ++k)
+        c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+    return table;
+  }();
+
+  uint32_t crc = 0xFFFFFFFF;
+  for(unsigned char c : bytes)
+    crc = table[(crc ^ c) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFF;
+}
+
+template<typename T>
+void append_pod(std::string& bytes, T value) {
+  bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// An .npy file with a C-order array of `descr` values of the given shape
+// (e.g. "(3,)", "()" for a scalar), whose data are `data`.
+std::string npy(const std::string& descr, const std::string& shape,
+                const std::string& data) {
+  std::string header = "{'descr': '" + descr + "', 'fortran_order': False, "
+                       "'shape': " + shape + ", }";
+  // the data start at a multiple of 64 bytes, after a newline
+  const size_t preamble = 10;
+  header.append(63 - (preamble + header.size()) % 64, ' ');
+  header += '\n';
+
+  std::string bytes("\x93NUMPY\x01\x00", 8);
+  append_pod(bytes, (uint16_t)header.size());
+  bytes += header;
+  bytes += data;
+  return bytes;
+}
+
+template<typename To, typename From>
+std::string npy_array(const std::string& descr, const std::vector<From>& values) {
+  std::string data;
+  data.reserve(values.size() * sizeof(To));
+  for(const auto& value : values)
+    append_pod(data, (To)value);
+  return npy(descr, "(" + std::to_string(values.size()) + ",)", data);
+}
+
+// Writes the members of an uncompressed zip archive, with the zip64
+// extensions where the sizes or offsets need them.
+class ZipWriter {
+ public:
+  explicit ZipWriter(const std::string& path)
+      : path(path), os(path, std::ios::binary) {
+    if(!os)
+      throw std::runtime_error("Cannot write '" + path + "'");
+  }
+
+  void add(const std::string& name, const std::string& bytes) {
+    Member member{name, crc32(bytes), bytes.size(), offset};
+    bool zip64 = member.size >= zip64_limit;
+
+    std::string header;
+    append_pod(header, (uint32_t)0x04034b50);
+    append_pod(header, (uint16_t)(zip64 ? 45 : 20));  // version needed
+    append_pod(header, (uint16_t)0);  // flags
+    append_pod(header, (uint16_t)0);  // stored
+    append_pod(header, (uint16_t)0);  // time
+    append_pod(header, (uint16_t)0x21);  // date, 1980-01-01
+    append_pod(header, member.crc);
+    append_pod(header, (uint32_t)(zip64 ? zip64_limit : member.size));
+    append_pod(header, (uint32_t)(zip64 ? zip64_limit : member.size));
+    append_pod(header, (uint16_t)name.size());
+    append_pod(header, (uint16_t)(zip64 ? 20 : 0));
+    header += name;
+    if(zip64) {
+      append_pod(header, (uint16_t)0x0001);
+      append_pod(header, (uint16_t)16);
+      append_pod(header, (uint64_t)member.size);
+      append_pod(header, (uint64_t)member.size);
+    }
+
+    os.write(header.data(), header.size());
+    os.write(bytes.data(), bytes.size());
+    offset += header.size() + bytes.size();
+    members.push_back(member);
+  }
+
+  void close() {
+    uint64_t directory_offset = offset;
+    std::string directory;
+    for(const auto& member : members) {
+      bool large = member.size >= zip64_limit;
+      bool far = member.offset >= zip64_limit;
+      std::string extra;
+      if(large) {
+        append_pod(extra, (uint64_t)member.size);
+        append_pod(extra, (uint64_t)member.size);
+      }
+      if(far)
+        append_pod(extra, (uint64_t)member.offset);
+      if(!extra.empty()) {
+        std::string field;
+        append_pod(field, (uint16_t)0x0001);
+        append_pod(field, (uint16_t)extra.size());
+        extra = field + extra;
+      }
+
+      uint16_t version = large || far ? 45 : 20;
+      append_pod(directory, (uint32_t)0x02014b50);
+      append_pod(directory, version);  // made by
+      append_pod(directory, version);  // needed
+      append_pod(directory, (uint16_t)0);  // flags
+      append_pod(directory, (uint16_t)0);  // stored
+      append_pod(directory, (uint16_t)0);  // time
+      append_pod(directory, (uint16_t)0x21);  // date
+      append_pod(directory, member.crc);
+      append_pod(directory, (uint32_t)(large ? zip64_limit : member.size));
+      append_pod(directory, (uint32_t)(large ? zip64_limit : member.size));
+      append_pod(directory, (uint16_t)member.name.size());
+      append_pod(directory, (uint16_t)extra.size());
+      append_pod(directory, (uint16_t)0);  // comment
+      append_pod(directory, (uint16_t)0);  // disk
+      append_pod(directory, (uint16_t)0);  // internal attributes
+      append_pod(directory, (uint32_t)0);  // external attributes
+      append_pod(directory, (uint32_t)(far ? zip64_limit : member.offset));
+      directory += member.name;
+      directory += extra;
+    }
+
+    std::string end;
+    bool zip64 = directory_offset >= zip64_limit;
+    if(zip64) {
+      uint64_t record_offset = directory_offset + directory.size();
+      append_pod(end, (uint32_t)0x06064b50);
+      append_pod(end, (uint64_t)44);  // size of the rest of the record
+      append_pod(end, (uint16_t)45);
+      append_pod(end, (uint16_t)45);
+      append_pod(end, (uint32_t)0);
+      append_pod(end, (uint32_t)0);
+      append_pod(end, (uint64_t)members.size());
+      append_pod(end, (uint64_t)members.size());
+      append_pod(end, (uint64_t)directory.size());
+      append_pod(end, directory_offset);
+
+      append_pod(end, (uint32_t)0x07064b50);
+      append_pod(end, (uint32_t)0);
+      append_pod(end, record_offset);
+      append_pod(end, (uint32_t)1);
+    }
+    append_pod(end, (uint32_t)0x06054b50);
+    append_pod(end, (uint16_t)0);
+    append_pod(end, (uint16_t)0);
+    append_pod(end, (uint16_t)members.size());
+    append_pod(end, (uint16_t)members.size());
+    append_pod(end, (uint32_t)directory.size());
+    append_pod(end, (uint32_t)(zip64 ? zip64_limit : directory_offset));
+    append_pod(end, (uint16_t)0);  // comment
+
+    os.write(directory.data(), directory.size());
+    os.write(end.data(), end.size());
+    os.close();
+    if(!os)
+      throw std::runtime_error("Cannot write '" + path + "'");
+  }
+
+ private:
+  struct Member {
+    std::string name;
+    uint32_t crc;
+    uint64_t size;
+    uint64_t offset;
+  };
+
+  std::string path;
+  std::ofstream os;
+  uint64_t offset = 0;
+  std::vector<Member> members;
+};
+
+}  // namespace
+
+
+void save_csr_npz(const std::string& path,
+                  int64_t rows, int64_t cols,
+                  const std::vector<int64_t>& indptr,
+                  const std::vector<int32_t>& indices,
+                  const std::vector<double>& data,
+                  bool integer_data) {
+  bool wide = indices.size() > (size_t)std::numeric_limits<int32_t>::max();
+
+  ZipWriter zip(path);
+  zip.add("indices.npy", wide ? npy_array<int64_t>("<i8", indices)
+                              : npy_array<int32_t>("<i4", indices));
+  zip.add("indptr.npy", wide ? npy_array<int64_t>("<i8", indptr)
+                             : npy_array<int32_t>("<i4", indptr));
+  zip.add("format.npy", npy("|S3", "()", "csr"));
+  zip.add("shape.npy", npy_array<int64_t>(
+      "<i8", std::vector<int64_t>{rows, cols}));
+  zip.add("data.npy", integer_data ? npy_array<int32_t>("<i4", data)
+                                   : npy_array<float>("<f4", data));
+  zip.close();
+}
@@ -0,0 +1,22 @@
+#ifndef SSEG_NPZ_H_
+#define SSEG_NPZ_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Writes a sparse matrix in CSR form as an uncompressed .npz archive in the
+// layout of scipy.sparse.save_npz, so that scipy.sparse.load_npz reads it
+// (and numpy.load gives the arrays `indptr`, `indices`, `data`, `shape` and
+// `format`). The index arrays are stored as int32 when the number of
+// nonzeros allows it and as int64 otherwise, the data as int32 with
+// `integer_data` and as float32 otherwise. Throws std::runtime_error on
+// failure.
+void save_csr_npz(const std::string& path,
+                  int64_t rows, int64_t cols,
+                  const std::vector<int64_t>& indptr,
+                  const std::vector<int32_t>& indices,
+                  const std::vector<double>& data,
+                  bool integer_data);
+
+#endif  // SSEG_NPZ_H_
@@ -0,0 +1,212 @@
+#include "oov_embeddings.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utf8.h"
+
+
+namespace {
+
+const char magic[8] = {'L', 'E', 'G', 'R', 'O', 'S', 'O', 'V'};
+const uint32_t format_version = 2;
+
+// The binary file is this header followed by the row of every bucket and by
+// the vectors of the stored buckets.
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t dimension;
+  uint32_t buckets;
+  uint32_t min_n;
+  uint32_t max_n;
+  uint32_t rows;
+};
+
+// FNV-1a as fastText hashes its n-grams, including its sign extension of
+// the bytes above 0x7F
+uint32_t hash_ngram(std::string_view ngram) {
+  uint32_t hash = 2166136261u;
+  for(char c : ngram)
+    hash = (hash ^ (uint32_t)(int8_t)c) * 16777619u;
+  return hash;
+}
+
+}  // namespace
+
+
+void OovEmbeddings::ngram_buckets(std::vector<uint32_t>& result,
+                                  std::string_view word) const {
+  std::string bracketed = "<" + std::string(word) + ">";
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, bracketed);
+  int units = boundaries.size() - 1;
+
+  for(int begin = 0; begin < units; ++begin) {
+    for(int n = min_n; n <= max_n && begin + n <= units; ++n) {
+      if(begin == 0 && n == units)
+        continue;  // the whole word
+      result.push_back(
+          hash_ngram(std::string_view(bracketed).substr(
+              boundaries[begin], boundaries[begin + n] - boundaries[begin]))
+          % buckets);
+    }
+  }
+}
+
+
+OovEmbeddings OovEmbeddings::build(const Embeddings& words,
+                                   uint32_t buckets,
+                                   int min_n,
+                                   int max_n) {
+  if(buckets == 0 || min_n < 1 || max_n < min_n)
+    throw std::runtime_error("Invalid n-gram bucket parameters");
+
+  OovEmbeddings table;
+  table.dimension = words.emb.cols();
+  table.buckets = buckets;
+  table.min_n = min_n;
+  table.max_n = max_n;
+
+  // the sums of the normalized word embeddings in the vectors, in the order
+  // in which the buckets are first used
+  table.owned_bucket_rows.assign(buckets, -1);
+  std::vector<int> counts;
+  std::vector<uint32_t> word_buckets;
+  for(int i = 0; i < words.size(); ++i) {
+    float norm = words.emb.row(i).norm();
+    if(norm == 0)
+      continue;
+
+    word_buckets.clear();
+    table.ngram_buckets(word_buckets, words[i]);
+    for(uint32_t bucket : word_buckets) {
+      int32_t& row = table.owned_bucket_rows[bucket];
+      if(row == -1) {
+        row = table.rows++;
+        table.owned_vectors.resize((size_t)table.rows * table.dimension);
+        counts.push_back(0);
+      }
+      Eigen::Map<Eigen::VectorXf>(
+          table.owned_vectors.data() + (size_t)row * table.dimension,
+          table.dimension) += words.emb.row(i).transpose() / norm;
+      ++counts[row];
+    }
+  }
+
+  for(uint32_t row = 0; row < table.rows; ++row) {
+    Eigen::Map<Eigen::VectorXf>(
+        table.owned_vectors.data() + (size_t)row * table.dimension,
+        table.dimension) /= counts[row];
+  }
+
+  table.bucket_rows = table.owned_bucket_rows.data();
+  table.vectors = table.owned_vectors.data();
+  return table;
+}
+
+
+OovEmbeddings OovEmbeddings::load(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if(fd < 0 || fstat(fd, &file_stat) != 0) {
+    if(fd >= 0)
+      close(fd);
+    throw std::runtime_error(
+        "Cannot read OOV embeddings from '" + path + "'");
+  }
+
+  size_t file_size = file_stat.st_size;
+  void* data = file_size < sizeof(Header)
+               ? MAP_FAILED
+               : mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED)
+    throw std::runtime_error("Cannot map OOV embeddings '" + path + "'");
+
+  OovEmbeddings table;
+  table.mapping = std::shared_ptr<void>(
+      data, [file_size](void* data) { munmap(data, file_size); });
+
+  const Header& header = *static_cast<const Header*>(data);
+  size_t expected_size = sizeof(Header)
+      + sizeof(int32_t) * header.buckets
+      + sizeof(float) * (size_t)header.rows * header.dimension;
+  if(std::memcmp(header.magic, magic, sizeof(magic)) != 0
+     || header.version != format_version || file_size != expected_size
+     || header.buckets == 0 || header.min_n < 1 || header.max_n < header.min_n)
+    throw std::runtime_error("OOV embeddings '" + path
+                             + "' are corrupted or of another version");
+
+  table.dimension = header.dimension;
+  table.buckets = header.buckets;
+  table.min_n = header.min_n;
+  table.max_n = header.max_n;
+  table.rows = header.rows;
+
+  const char* pos = static_cast<const char*>(data) + sizeof(Header);
+  table.bucket_rows = reinterpret_cast<const int32_t*>(pos);
+  table.vectors = reinterpret_cast<const float*>(
+      pos + sizeof(int32_t) * header.buckets);
+
+  // `embed` reads the rows of the buckets unchecked
+  for(uint32_t bucket = 0; bucket < table.buckets; ++bucket) {
+    int32_t row = table.bucket_rows[bucket];
+    if(row < -1 || (row >= 0 && (uint32_t)row >= table.rows))
+      throw std::runtime_error("OOV embeddings '" + path
+                               + "' are corrupted or of another version");
+  }
+  return table;
+}
+
+
+void OovEmbeddings::save(const std::string& path) const {
+  std::ofstream os(path, std::ios::binary);
+
+  Header header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = format_version;
+  header.dimension = dimension;
+  header.buckets = buckets;
+  header.min_n = min_n;
+  header.max_n = max_n;
+  header.rows = rows;
+
+  os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  os.write(reinterpret_cast<const char*>(bucket_rows),
+           sizeof(int32_t) * buckets);
+  os.write(reinterpret_cast<const char*>(vectors),
+           sizeof(float) * (size_t)rows * dimension);
+  if(!os)
+    throw std::runtime_error(
+        "Cannot write OOV embeddings to '" + path + "'");
+}
+
+
+bool OovEmbeddings::embed(std::string_view word,
+                          Eigen::VectorXf& embedding) const {
+  std::vector<uint32_t> word_buckets;
+  ngram_buckets(word_buckets, word);
+
+  embedding.setZero(dimension);
+  int found = 0;
+  for(uint32_t bucket : word_buckets) {
+    int32_t row = bucket_rows[bucket];
+    if(row == -1)
+      continue;
+    embedding += Eigen::Map<const Eigen::VectorXf>(
+        vectors + (size_t)row * dimension, dimension);
+    ++found;
+  }
+
+  if(found == 0)
+    return false;
+  embedding /= found;
+  return true;
+}
@@ -0,0 +1,69 @@
+#ifndef SSEG_OOV_EMBEDDINGS_H_
+#define SSEG_OOV_EMBEDDINGS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "vocabs.h"
+
+// Embeddings of out-of-vocabulary words composed from character n-grams, as
+// in fastText: the n-grams of "<word>" of `min_n` to `max_n` code points
+// (without the whole "<word>") are hashed into buckets, and the embedding of
+// a word is the mean of the vectors of its n-gram buckets. The vector of a
+// bucket is the mean of the normalized embeddings of the vocabulary words
+// with an n-gram in it. Only the buckets used by the vocabulary are stored,
+// and the binary file written by `save` is memory-mapped by `load`.
+class OovEmbeddings {
+ public:
+  OovEmbeddings() = default;
+  OovEmbeddings(OovEmbeddings&&) = default;
+  OovEmbeddings& operator=(OovEmbeddings&&) = default;
+  OovEmbeddings(const OovEmbeddings&) = delete;
+  OovEmbeddings& operator=(const OovEmbeddings&) = delete;
+
+  // Computes the bucket vectors from the embeddings of `words`.
+  static OovEmbeddings build(const Embeddings& words,
+                             uint32_t buckets = 1 << 18,
+                             int min_n = 3,
+                             int max_n = 6);
+
+  // Loads and saves the binary format. Throw std::runtime_error when the
+  // file cannot be read or written.
+  static OovEmbeddings load(const std::string& path);
+  void save(const std::string& path) const;
+
+  // Composes the embedding of `word`, false when none of its n-grams falls
+  // into a stored bucket.
+  bool embed(std::string_view word, Eigen::VectorXf& embedding) const;
+
+  // Appends the buckets of the n-grams of `word`.
+  void ngram_buckets(std::vector<uint32_t>& buckets,
+                     std::string_view word) const;
+
+  int dim() const { return dimension; }
+  uint32_t bucket_count() const { return buckets; }
+  uint32_t stored_buckets() const { return rows; }
+
+ private:
+  uint32_t dimension = 0;
+  uint32_t buckets = 0;
+  uint32_t min_n = 0;
+  uint32_t max_n = 0;
+  uint32_t rows = 0;
+
+  // views of either the owned arrays or the mapped file
+  const int32_t* bucket_rows = nullptr;  // buckets, -1 for unused buckets
+  const float* vectors = nullptr;  // rows x dimension
+
+  std::vector<int32_t> owned_bucket_rows;
+  std::vector<float> owned_vectors;
+
+  std::shared_ptr<void> mapping;  // unmaps the file
+};
+
+#endif  // SSEG_OOV_EMBEDDINGS_H_
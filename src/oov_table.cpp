@@ -0,0 +1,73 @@
+/**
+ * OOV table -- precompute character n-gram vectors for the embeddings of
+ * out-of-vocabulary words.
+ * Input:
+ * - word embeddings (the legros-train input)
+ *
+ * Output:
+ * - binary table of the n-gram bucket vectors (see oov_embeddings.h), which
+ *   legros-embed-segment --oov-table maps into memory
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "CLI11.hpp"
+#include "oov_embeddings.h"
+#include "vocabs.h"
+
+struct opt {
+  std::string embeddings;
+  std::string output;
+  uint32_t buckets = 1 << 18;
+  int min_n = 3;
+  int max_n = 6;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option("embeddings", opt.embeddings, "Word embeddings.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("-o,--output", opt.output, "Binary n-gram table.")
+      ->required();
+
+  app.add_option("--buckets", opt.buckets,
+                 "Number of hash buckets of the n-grams.")
+      ->check(CLI::PositiveNumber);
+
+  app.add_option("--min-n", opt.min_n,
+                 "Minimum length of the n-grams in code points.")
+      ->check(CLI::PositiveNumber);
+
+  app.add_option("--max-n", opt.max_n,
+                 "Maximum length of the n-grams in code points.")
+      ->check(CLI::PositiveNumber);
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"OOV table -- precompute character n-gram vectors for the "
+               "embeddings of out-of-vocabulary words."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    std::cerr << "Loading word embeddings: " << opt.embeddings << std::endl;
+    Embeddings words(opt.embeddings);
+
+    OovEmbeddings table = OovEmbeddings::build(
+        words, opt.buckets, opt.min_n, opt.max_n);
+    table.save(opt.output);
+
+    std::cerr << "Saved " << table.stored_buckets() << " of "
+              << table.bucket_count() << " n-gram buckets to " << opt.output
+              << std::endl;
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include "pretokenize.h"
+
+#include "utf8.h"
+
+
+void pretokenize(std::vector<std::string>& tokens, std::string_view text) {
+  // the text conceptually starts with the marker
+  std::string token = space_marker;
+  bool prev_is_marker = true;
+  bool prev_is_alnum = false;
+
+  for(size_t pos = 0; pos < text.size();) {
+    char32_t codepoint;
+    int length = utf8_decode(text, pos, codepoint);
+
+    bool is_space = codepoint == ' ';
+    bool is_marker = is_space || codepoint == 0x2581;
+    bool alnum = codepoint != invalid_codepoint && is_alnum(codepoint);
+
+    if(!prev_is_marker && (!alnum || !prev_is_alnum)) {
+      tokens.push_back(std::move(token));
+      token.clear();
+    }
+
+    if(is_space)
+      token += space_marker;
+    else
+      token.append(text.substr(pos, length));
+
+    prev_is_marker = is_marker;
+    prev_is_alnum = alnum;
+    pos += length;
+  }
+
+  tokens.push_back(std::move(token));
+}
+
+
+void pretokenize_line(std::vector<std::string>& tokens, std::string_view line) {
+  // strip the trailing whitespace as Python's str.rstrip()
+  size_t end = 0;
+  for(size_t pos = 0; pos < line.size();) {
+    char32_t codepoint;
+    pos += utf8_decode(line, pos, codepoint);
+    if(codepoint == invalid_codepoint || !is_space(codepoint))
+      end = pos;
+  }
+  pretokenize(tokens, line.substr(0, end));
+}
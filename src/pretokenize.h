@@ -0,0 +1,22 @@
+#ifndef SSEG_PRETOKENIZE_H_
+#define SSEG_PRETOKENIZE_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Word-boundary marker used by the pretokenizer (U+2581, "▁").
+const std::string space_marker = "\xE2\x96\x81";
+
+// Splits `text` into tokens with the same semantics as
+// `legros.pretokenize.pretokenize`: spaces are replaced with the marker (which
+// is also prepended to the text) and a new token starts at every boundary
+// between an alphanumeric and a non-alphanumeric character, unless the
+// preceding character is the marker. Appends the tokens to `tokens`.
+void pretokenize(std::vector<std::string>& tokens, std::string_view text);
+
+// Pretokenizes a line of input after stripping its trailing whitespace, the
+// way the Python tools call `pretokenize(line.rstrip())`.
+void pretokenize_line(std::vector<std::string>& tokens, std::string_view line);
+
+#endif  // SSEG_PRETOKENIZE_H_
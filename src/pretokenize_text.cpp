@@ -0,0 +1,37 @@
+/**
+ * Pretokenize -- native version of `legros.pretokenize`.
+ * Input:
+ * - STDIN with plain text
+ *
+ * Output:
+ * - STDOUT with space-separated pretokenized tokens
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "CLI11.hpp"
+#include "pretokenize.h"
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Pretokenize -- split plain text on word boundaries."};
+  CLI11_PARSE(app, argc, argv);
+
+  std::ios::sync_with_stdio(false);
+
+  std::vector<std::string> tokens;
+  for(std::string line; std::getline(std::cin, line);) {
+    tokens.clear();
+    pretokenize_line(tokens, line);
+
+    std::string sep = "";
+    for(const auto& token : tokens) {
+      std::cout << sep << token;
+      sep = " ";
+    }
+    std::cout << '\n';
+  }
+
+  return 0;
+}
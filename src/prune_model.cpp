@@ -0,0 +1,223 @@
+/**
+ * Prune -- shrink a compiled bigram model for legros.
+ * Input:
+ * - bigram counts
+ * - unigram counts
+ * - optionally a held-out word list
+ *
+ * Output:
+ * - compiled model (see legros-compile) without the bigrams that the
+ *   pruning criterion considers redundant, optionally with quantized
+ *   log-probabilities
+ * - a JSON line on stderr with the model size before and after and the rate
+ *   of changed segmentations of the held-out words
+ */
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "CLI11.hpp"
+#include "bigram_model.h"
+#include "compiled_model.h"
+
+enum class Pruning { count, entropy, relative_entropy };
+
+struct opt {
+  std::string bigram_stats;
+  std::string unigram_stats;
+  std::string output;
+  Smoothing smoothing = Smoothing::kneser_ney;
+  Pruning method = Pruning::relative_entropy;
+  double threshold = 0;
+  int quantize = 0;
+  std::string heldout;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option(
+      "bigrams", opt.bigram_stats, "Bigram statistics.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option(
+      "unigrams", opt.unigram_stats, "Unigram statistics.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("-o,--output", opt.output, "Pruned compiled model.")
+      ->required();
+
+  std::map<std::string, Smoothing> smoothings = {
+    {"kn", Smoothing::kneser_ney}, {"wb", Smoothing::witten_bell}};
+  app.add_option("--smoothing", opt.smoothing,
+                 "Interpolated Kneser-Ney (kn) or Witten-Bell (wb).")
+      ->transform(CLI::CheckedTransformer(smoothings));
+
+  std::map<std::string, Pruning> methods = {
+    {"count", Pruning::count},
+    {"entropy", Pruning::entropy},
+    {"relative-entropy", Pruning::relative_entropy}};
+  app.add_option("--method", opt.method,
+                 "Remove bigrams with a count of at most the threshold "
+                 "(count), a weighted log-probability difference to the "
+                 "backoff below it (entropy) or a relative entropy of the "
+                 "model change below it (relative-entropy, Stolcke 1998).")
+      ->transform(CLI::CheckedTransformer(methods));
+
+  app.add_option("--threshold", opt.threshold,
+                 "Pruning threshold, 1 for count and 1e-7 for the entropy "
+                 "methods by default.")
+      ->check(CLI::NonNegativeNumber);
+
+  app.add_option("--quantize", opt.quantize,
+                 "Quantize the log-probabilities to 8 or 16 bits (0 keeps "
+                 "floats).")
+      ->check(CLI::IsMember({0, 8, 16}));
+
+  app.add_option("--heldout", opt.heldout,
+                 "Words (first tab-separated field per line) for measuring "
+                 "how many segmentations the pruning changes.")
+      ->check(CLI::ExistingFile);
+}
+
+
+// Selects the bigrams to keep. The entropy criteria are computed for each
+// bigram in the unpruned model, independently of the other removals.
+std::vector<bool> select_bigrams(const CompiledBigramModel& model,
+                                 const bigram_table& bigrams,
+                                 const unigram_table& unigrams,
+                                 long unigram_total) {
+  std::vector<bool> keep(model.nonzeros(), true);
+  const auto& vocabulary = model.vocabulary();
+
+  for(int prev = 0; prev < model.size(); ++prev) {
+    int begin = model.row_begin(prev);
+    int end = model.row_end(prev);
+    if(begin == end)
+      continue;
+
+    if(opt.method == Pruning::count) {
+      const auto& successors = bigrams.at(vocabulary[prev]);
+      for(int entry = begin; entry < end; ++entry)
+        keep[entry] = successors.at(vocabulary[model.column(entry)])
+                      > opt.threshold;
+      continue;
+    }
+
+    double prev_prob = (double)unigrams.at(vocabulary[prev]) / unigram_total;
+    double backoff = model.backoff(prev);
+
+    // mass of the bigrams in the row and of their lower-order probabilities
+    double higher_mass = 0;
+    double lower_mass = 0;
+    for(int entry = begin; entry < end; ++entry) {
+      higher_mass += std::exp((double)model.entry_logprob(entry));
+      lower_mass += std::exp((double)model.lower_logprob(model.column(entry)));
+    }
+
+    for(int entry = begin; entry < end; ++entry) {
+      double logprob = model.entry_logprob(entry);
+      double prob = std::exp(logprob);
+      double lower_logprob = model.lower_logprob(model.column(entry));
+      double lower_prob = std::exp(lower_logprob);
+
+      double difference;
+      if(opt.method == Pruning::entropy) {
+        difference = prev_prob * prob * (logprob - backoff - lower_logprob);
+      } else {
+        // the backoff weight after removing just this bigram, which changes
+        // the probability of this and of all the unseen subwords
+        double new_backoff = std::log(
+            std::max(1.0 - higher_mass + prob, 1e-12)
+            / std::max(1.0 - lower_mass + lower_prob, 1e-12));
+        difference = prev_prob * (
+            prob * (logprob - new_backoff - lower_logprob)
+            - (1.0 - higher_mass) * (new_backoff - backoff));
+      }
+      keep[entry] = difference >= opt.threshold;
+    }
+  }
+
+  return keep;
+}
+
+
+// Number of `words` segmented differently by the two models.
+long changed_segmentations(const CompiledBigramModel& original,
+                           const CompiledBigramModel& pruned,
+                           const std::vector<std::string>& words) {
+  long changed = 0;
+  std::vector<std::string> expected, segmentation;
+  for(const auto& word : words) {
+    expected.clear();
+    segmentation.clear();
+    original.segment_token(expected, word);
+    pruned.segment_token(segmentation, word);
+    changed += segmentation != expected;
+  }
+  return changed;
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Prune -- shrink a compiled bigram model for legros."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  if(app.count("--threshold") == 0)
+    opt.threshold = opt.method == Pruning::count ? 1 : 1e-7;
+
+  try {
+    CompiledBigramModel original = CompiledBigramModel::compile(
+        opt.bigram_stats, opt.unigram_stats, opt.smoothing);
+
+    unigram_table unigrams;
+    bigram_table bigrams;
+    std::vector<std::string> subwords;
+    long unigram_total = load_unigrams(unigrams, subwords, opt.unigram_stats);
+    if(opt.method == Pruning::count)
+      load_bigrams(bigrams, opt.bigram_stats);
+
+    std::cerr << "Pruning " << original.nonzeros() << " bigrams" << std::endl;
+    CompiledBigramModel pruned = original;
+    pruned.remove_bigrams(
+        select_bigrams(original, bigrams, unigrams, unigram_total));
+    if(opt.quantize != 0)
+      pruned.quantize(opt.quantize);
+    pruned.save(opt.output);
+
+    std::vector<std::string> words;
+    if(!opt.heldout.empty()) {
+      std::ifstream heldout(opt.heldout);
+      std::string line;
+      while(std::getline(heldout, line)) {
+        std::string word = line.substr(0, line.find('\t'));
+        if(!word.empty())
+          words.push_back(word);
+      }
+    }
+    long changed = changed_segmentations(original, pruned, words);
+
+    std::cerr << "{\"bigrams_before\": " << original.nonzeros()
+              << ", \"bigrams_after\": " << pruned.nonzeros()
+              << ", \"memory_bytes_before\": " << original.memory_bytes()
+              << ", \"memory_bytes_after\": " << pruned.memory_bytes()
+              << ", \"file_bytes\": " << std::filesystem::file_size(opt.output)
+              << ", \"quantization_bits\": " << pruned.quantization()
+              << ", \"heldout_words\": " << words.size()
+              << ", \"changed_words\": " << changed
+              << ", \"change_rate\": "
+              << (words.empty() ? 0.0 : (double)changed / words.size())
+              << "}" << std::endl;
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
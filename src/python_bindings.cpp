@@ -0,0 +1,197 @@
+/**
+ * Python extension `legros._native` exposing the C++ segmenters.
+ *
+ * The batch methods release the GIL and segment in parallel with OpenMP.
+ * Built only when pybind11 is available, into python/legros.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <Eigen/Dense>
+
+#include "cosine_viterbi.h"
+#include "segmenter.h"
+#include "vocabs.h"
+
+namespace py = pybind11;
+
+typedef py::array_t<float, py::array::c_style | py::array::forcecast>
+    float_array;
+
+
+static py::array_t<int32_t> to_array(const std::vector<int>& ids) {
+  py::array_t<int32_t> array(ids.size());
+  std::copy(ids.begin(), ids.end(), array.mutable_data());
+  return array;
+}
+
+
+static Eigen::MatrixXf to_matrix(const float_array& array) {
+  if(array.ndim() != 2)
+    throw std::invalid_argument("Expected a two-dimensional array.");
+
+  return Eigen::Map<const Eigen::Matrix<
+      float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>>(
+          array.data(), array.shape(0), array.shape(1));
+}
+
+
+// Segmentation by cosine similarity of word and subword embeddings, the
+// inference counterpart of the legros-train Viterbi decoding.
+class CosineSegmenter {
+ public:
+  Vocab subwords;
+  Eigen::MatrixXf embeddings;
+
+  // `subword_list` are the lines of a subwords.N file, `subword_embeddings`
+  // the corresponding subword_embeddings.N matrix.
+  CosineSegmenter(const std::vector<std::string>& subword_list,
+                  const float_array& subword_embeddings)
+      : embeddings(to_matrix(subword_embeddings)) {
+    subwords.insert(subword_list);
+
+    if(subwords.size() != embeddings.rows())
+      throw std::invalid_argument(
+          "The number of subwords does not match the embedding count.");
+  }
+
+  void segment(std::vector<std::string>& segmentation,
+               const std::string& word,
+               const Eigen::VectorXf& word_embedding) const {
+    viterbi_decode(segmentation, word, word_embedding, subwords, embeddings);
+  }
+
+  // Maps a segmentation to subword indices, -1 for out-of-vocabulary
+  // characters.
+  std::vector<int> ids(const std::vector<std::string>& segmentation) const {
+    std::vector<int> result;
+    for(const auto& subword : segmentation)
+      result.push_back(subwords.contains(subword) ? subwords[subword] : -1);
+    return result;
+  }
+};
+
+
+static std::vector<std::vector<std::string>> cosine_segment_batch(
+    const CosineSegmenter& segmenter,
+    const std::vector<std::string>& words,
+    const float_array& word_embeddings) {
+  Eigen::MatrixXf vectors = to_matrix(word_embeddings);
+  if(vectors.rows() != words.size() || vectors.cols() != segmenter.embeddings.cols())
+    throw std::invalid_argument("Expected one embedding per word.");
+
+  std::vector<std::vector<std::string>> segmentations(words.size());
+  {
+    py::gil_scoped_release release;
+
+#pragma omp parallel for schedule(dynamic, 16)
+    for(int i = 0; i < words.size(); ++i) {
+      segmenter.segment(segmentations[i], words[i], vectors.row(i));
+    }
+  }
+  return segmentations;
+}
+
+
+PYBIND11_MODULE(_native, m) {
+  m.doc() = "Native legros segmenters.";
+
+  py::class_<Segmenter>(m, "BigramSegmenter")
+      .def(py::init<const std::string&, const std::string&, int, bool, int>(),
+           py::arg("bigram_stats"), py::arg("unigram_stats"),
+           py::arg("beam_size") = 0, py::arg("pretokenize") = false,
+           py::arg("cache_size") = 100000,
+           py::call_guard<py::gil_scoped_release>())
+      .def("segment_token",
+           [](const Segmenter& self, const std::string& token) {
+             std::vector<std::string> segmentation;
+             self.segment_token(segmentation, token);
+             return segmentation;
+           },
+           py::arg("token"), "Segments a single token into subwords.")
+      .def("segment_tokens",
+           [](const Segmenter& self, const std::vector<std::string>& tokens) {
+             std::vector<std::vector<std::string>> segmentations(tokens.size());
+             {
+               py::gil_scoped_release release;
+
+#pragma omp parallel for schedule(dynamic, 16)
+               for(int i = 0; i < tokens.size(); ++i)
+                 self.segment_token(segmentations[i], tokens[i]);
+             }
+             return segmentations;
+           },
+           py::arg("tokens"), "Segments a batch of tokens in parallel.")
+      .def("segment",
+           [](const Segmenter& self, const std::string& line) {
+             std::vector<int> ids;
+             {
+               py::gil_scoped_release release;
+               self.segment(ids, line);
+             }
+             return to_array(ids);
+           },
+           py::arg("line"),
+           "Segments a line into an array of output vocabulary IDs.")
+      .def("segment_batch",
+           [](const Segmenter& self, const std::vector<std::string>& lines) {
+             std::vector<std::vector<int>> ids;
+             {
+               py::gil_scoped_release release;
+               self.segment_batch(ids, lines);
+             }
+             py::list result;
+             for(const auto& line_ids : ids)
+               result.append(to_array(line_ids));
+             return result;
+           },
+           py::arg("lines"),
+           "Segments lines in parallel into arrays of output vocabulary IDs.")
+      .def("id_to_piece", &Segmenter::id_to_piece, py::arg("id"))
+      .def("piece_to_id", &Segmenter::piece_to_id, py::arg("piece"),
+           py::arg("continued") = false)
+      .def_property_readonly("vocab_size", &Segmenter::vocab_size);
+
+  py::class_<CosineSegmenter>(m, "CosineSegmenter")
+      .def(py::init<const std::vector<std::string>&, const float_array&>(),
+           py::arg("subwords"), py::arg("subword_embeddings"))
+      .def("segment",
+           [](const CosineSegmenter& self, const std::string& word,
+              const py::array_t<float, py::array::forcecast>& embedding) {
+             if(embedding.size() != self.embeddings.cols())
+               throw std::invalid_argument(
+                   "Expected an embedding of the subword dimension.");
+             Eigen::VectorXf vector = Eigen::Map<const Eigen::VectorXf>(
+                 embedding.data(), embedding.size());
+             std::vector<std::string> segmentation;
+             self.segment(segmentation, word, vector);
+             return segmentation;
+           },
+           py::arg("word"), py::arg("embedding"),
+           "Segments a word given its embedding.")
+      .def("segment_batch", &cosine_segment_batch,
+           py::arg("words"), py::arg("embeddings"),
+           "Segments words in parallel, `embeddings` has a row per word.")
+      .def("segment_batch_ids",
+           [](const CosineSegmenter& self,
+              const std::vector<std::string>& words,
+              const float_array& embeddings) {
+             auto segmentations = cosine_segment_batch(self, words, embeddings);
+             py::list result;
+             for(const auto& segmentation : segmentations)
+               result.append(to_array(self.ids(segmentation)));
+             return result;
+           },
+           py::arg("words"), py::arg("embeddings"),
+           "Like segment_batch, but returns arrays of subword indices.")
+      .def_property_readonly("vocab_size", [](const CosineSegmenter& self) {
+        return self.subwords.size();
+      });
+}
@@ -0,0 +1,112 @@
+#include "segmentation_stats.h"
+
+#include <iomanip>
+#include <sstream>
+
+
+namespace {
+
+std::atomic<long> next_stats_id = 0;
+
+// The counters of the current thread, valid for the SegmentationStats
+// object with the id `thread_stats_id`.
+thread_local long thread_stats_id = -1;
+thread_local SegmentationStats::Counters* thread_counters = nullptr;
+
+double per_second(long count, double seconds) {
+  return seconds > 0 ? count / seconds : 0;
+}
+
+double ratio(long count, long total) {
+  return total > 0 ? (double)count / total : 0;
+}
+
+}  // namespace
+
+
+SegmentationStats::SegmentationStats()
+    : id(next_stats_id++), start(std::chrono::steady_clock::now()) {}
+
+
+SegmentationStats::Counters& SegmentationStats::local() {
+  if(thread_stats_id != id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back(std::make_unique<Counters>());
+    thread_counters = threads.back().get();
+    thread_stats_id = id;
+  }
+  return *thread_counters;
+}
+
+
+int SegmentationStats::length_bucket(int length) {
+  int bucket = 0;
+  for(int limit = 1; limit < length && bucket < length_buckets - 1; limit *= 2)
+    ++bucket;
+  return bucket;
+}
+
+
+void SegmentationStats::write_json(std::ostream& out, bool final) const {
+  auto load = [](const std::atomic<long>& counter) {
+    return counter.load(std::memory_order_relaxed);
+  };
+
+  long tokens = 0, bytes = 0, cache_hits = 0, decoded = 0, lattice_edges = 0;
+  long subwords = 0, oov_subwords = 0, decode_ns = 0;
+  std::array<long, length_buckets> bucket_tokens{}, bucket_ns{};
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(const auto& counters : threads) {
+      tokens += load(counters->tokens);
+      bytes += load(counters->bytes);
+      cache_hits += load(counters->cache_hits);
+      decoded += load(counters->decoded);
+      lattice_edges += load(counters->lattice_edges);
+      subwords += load(counters->subwords);
+      oov_subwords += load(counters->oov_subwords);
+      decode_ns += load(counters->decode_ns);
+      for(int b = 0; b < length_buckets; ++b) {
+        bucket_tokens[b] += load(counters->bucket_tokens[b]);
+        bucket_ns[b] += load(counters->bucket_ns[b]);
+      }
+    }
+  }
+
+  double seconds = elapsed_ns(start) / 1e9;
+
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(3);
+  line << "{\"final\": " << (final ? "true" : "false")
+       << ", \"seconds\": " << seconds
+       << ", \"lines\": " << lines
+       << ", \"tokens\": " << tokens
+       << ", \"bytes\": " << bytes
+       << ", \"lines_per_second\": " << per_second(lines, seconds)
+       << ", \"tokens_per_second\": " << per_second(tokens, seconds)
+       << ", \"bytes_per_second\": " << per_second(bytes, seconds)
+       << ", \"segmentations_per_thread_second\": "
+       << per_second(decoded, decode_ns / 1e9)
+       << ", \"cache_hit_rate\": " << ratio(cache_hits, tokens)
+       << ", \"mean_lattice_edges\": " << ratio(lattice_edges, decoded)
+       << ", \"oov_fallback_rate\": " << ratio(oov_subwords, subwords)
+       << ", \"read_seconds\": " << read_ns / 1e9
+       << ", \"decode_seconds\": " << decode_wall_ns / 1e9
+       << ", \"write_seconds\": " << write_ns / 1e9
+       << ", \"decode_time_by_token_length\": [";
+
+  int min_length = 1;
+  for(int b = 0; b < length_buckets; ++b) {
+    int max_length = 1 << b;
+    line << (b > 0 ? ", " : "") << "{\"min_length\": " << min_length;
+    if(b + 1 < length_buckets)
+      line << ", \"max_length\": " << max_length;
+    line << ", \"tokens\": " << bucket_tokens[b]
+         << ", \"mean_us\": " << ratio(bucket_ns[b], bucket_tokens[b]) / 1e3
+         << "}";
+    min_length = max_length + 1;
+  }
+  line << "]}";
+
+  out << line.str() << std::endl;
+}
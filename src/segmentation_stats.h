@@ -0,0 +1,81 @@
+#ifndef SSEG_SEGMENTATION_STATS_H_
+#define SSEG_SEGMENTATION_STATS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Throughput and latency statistics of a Segmenter. Each thread counts into
+// its own cache line without synchronization, the counters are only summed
+// when a report is written, so the statistics can stay enabled in
+// production.
+class SegmentationStats {
+ public:
+  // Token lengths in code points are bucketed into 1, 2, 3-4, 5-8, ...,
+  // 65-128 and over 128.
+  static const int length_buckets = 9;
+
+  // Counters of one thread. Only the owning thread writes them.
+  struct alignas(64) Counters {
+    std::atomic<long> tokens = 0;
+    std::atomic<long> bytes = 0;
+    std::atomic<long> cache_hits = 0;
+    std::atomic<long> decoded = 0;  // tokens not found in the cache
+    std::atomic<long> lattice_edges = 0;  // in the decoded tokens
+    std::atomic<long> subwords = 0;  // in the decoded tokens
+    std::atomic<long> oov_subwords = 0;  // single code point fallbacks
+    std::atomic<long> decode_ns = 0;
+    std::array<std::atomic<long>, length_buckets> bucket_tokens{};
+    std::array<std::atomic<long>, length_buckets> bucket_ns{};
+  };
+
+  SegmentationStats();
+
+  SegmentationStats(const SegmentationStats&) = delete;
+  SegmentationStats& operator=(const SegmentationStats&) = delete;
+
+  // Counters of the calling thread.
+  Counters& local();
+
+  // Adds to a counter of the calling thread, which is its only writer, so
+  // no atomic read-modify-write is needed.
+  static void add(std::atomic<long>& counter, long value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+
+  static int length_bucket(int length);
+
+  // Time of the driving loop outside of the segmenter.
+  void add_lines(long count) { lines += count; }
+  void add_read_time(long ns) { read_ns += ns; }
+  void add_decode_time(long ns) { decode_wall_ns += ns; }
+  void add_write_time(long ns) { write_ns += ns; }
+
+  // Writes the statistics since the construction as one JSON line.
+  void write_json(std::ostream& out, bool final) const;
+
+ private:
+  const long id;
+  const std::chrono::steady_clock::time_point start;
+
+  mutable std::mutex mutex;
+  std::vector<std::unique_ptr<Counters>> threads;
+
+  std::atomic<long> lines = 0;
+  std::atomic<long> read_ns = 0;
+  std::atomic<long> decode_wall_ns = 0;
+  std::atomic<long> write_ns = 0;
+};
+
+// Nanoseconds since `start`, for the add_*_time methods.
+inline long elapsed_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+#endif  // SSEG_SEGMENTATION_STATS_H_
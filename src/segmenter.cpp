@@ -0,0 +1,325 @@
+#include "segmenter.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+#include "pretokenize.h"
+#include "utf8.h"
+
+
+// Name of the byte-fallback piece for `byte`.
+static std::string byte_piece(unsigned char byte) {
+  char name[7];
+  std::snprintf(name, sizeof(name), "<0x%02X>", byte);
+  return name;
+}
+
+
+Segmenter::Segmenter(const std::string& bigram_stats,
+                     const std::string& unigram_stats,
+                     int beam_size,
+                     bool pretokenize,
+                     int cache_size)
+    : beam(beam_size), pretokenize_input(pretokenize),
+      cache_shard_size(cache_size / cache_shards
+                       + (cache_size % cache_shards > 0)),
+      cache(cache_shards) {
+
+  for(const auto& path : {bigram_stats, unigram_stats})
+    if(!std::ifstream(path))
+      throw std::runtime_error("Cannot read statistics from '" + path + "'");
+
+  std::vector<std::string> subwords;
+  unigram_count = load_unigrams(unigrams, subwords, unigram_stats);
+  load_bigrams(bigrams, bigram_stats);
+
+  for(const auto& subword : subwords)
+    max_unigram_length = std::max(max_unigram_length, (int)subword.size());
+  decode_token = select_segment_token_kernel(max_unigram_length);
+
+  init_pieces(subwords);
+}
+
+
+Segmenter::Segmenter(const std::string& compiled_model,
+                     int beam_size,
+                     bool pretokenize,
+                     int cache_size)
+    : beam(beam_size), pretokenize_input(pretokenize), use_compiled(true),
+      compiled(CompiledBigramModel::load(compiled_model)),
+      cache_shard_size(cache_size / cache_shards
+                       + (cache_size % cache_shards > 0)),
+      cache(cache_shards) {
+  max_unigram_length = compiled.max_subword_length();
+  init_pieces(compiled.vocabulary());
+}
+
+
+void Segmenter::init_pieces(const std::vector<std::string>& subwords) {
+  pieces.insert(subwords);
+  subword_pieces = pieces.size();
+
+  std::vector<std::string> bytes;
+  for(int byte = 0; byte < 256; ++byte) {
+    std::string piece = byte_piece(byte);
+    if(!pieces.contains(piece))
+      bytes.push_back(piece);
+  }
+  pieces.insert(bytes);
+}
+
+
+void Segmenter::split_line(std::vector<std::string>& tokens,
+                           std::string_view line) const {
+  if(pretokenize_input) {
+    pretokenize_line(tokens, line);
+    return;
+  }
+
+  size_t begin = 0;
+  while(begin <= line.size()) {
+    size_t end = line.find(' ', begin);
+    if(end == std::string_view::npos) {
+      // the last token, std::getline does not produce a trailing empty one
+      if(begin < line.size())
+        tokens.emplace_back(line.substr(begin));
+      break;
+    }
+    tokens.emplace_back(line.substr(begin, end - begin));
+    begin = end + 1;
+  }
+}
+
+
+void Segmenter::segment_token(std::vector<std::string>& segmentation,
+                              const std::string& token) const {
+  if(token.empty())
+    return;
+
+  SegmentationStats::Counters* counters = nullptr;
+  if(stats != nullptr) {
+    counters = &stats->local();
+    SegmentationStats::add(counters->tokens, 1);
+    SegmentationStats::add(counters->bytes, token.size());
+  }
+
+  CacheShard* shard = nullptr;
+  if(cache_shard_size > 0) {
+    shard = &cache[std::hash<std::string>{}(token) % cache_shards];
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    auto it = shard->entries.find(token);
+    if(it != shard->entries.end()) {
+      segmentation.insert(segmentation.end(), it->second.begin(),
+                          it->second.end());
+      if(counters != nullptr)
+        SegmentationStats::add(counters->cache_hits, 1);
+      return;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::string> segm;
+  if(use_compiled) {
+    compiled.segment_token(segm, token, beam);
+  } else if(beam == 0) {
+    decode_token(segm, token, unigrams, bigrams, unigram_count,
+                 max_unigram_length);
+  } else {
+    beam_search_segment(segm, token, unigrams, bigrams, unigram_count,
+                        max_unigram_length, beam);
+  }
+  if(counters != nullptr)
+    record_decode(*counters, token, segm, elapsed_ns(start));
+
+  if(shard != nullptr) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    // a full shard is simply emptied, frequent tokens come back quickly
+    if(shard->entries.size() >= cache_shard_size)
+      shard->entries.clear();
+    shard->entries.insert({token, segm});
+  }
+
+  segmentation.insert(segmentation.end(), segm.begin(), segm.end());
+}
+
+
+void Segmenter::record_decode(SegmentationStats::Counters& counters,
+                              const std::string& token,
+                              const std::vector<std::string>& segmentation,
+                              long ns) const {
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, token);
+  int units = boundaries.size() - 1;
+
+  // edges of the lattice: subwords up to the maximum length in bytes ending
+  // at each position, and always the single unit
+  long edges = 0;
+  int first = 0;
+  for(int i = 1; i <= units; ++i) {
+    while(boundaries[i] - boundaries[first] > max_unigram_length)
+      ++first;
+    edges += std::max(i - first, 1);
+  }
+
+  int oov = 0;
+  for(const auto& subword : segmentation)
+    if(!pieces.contains(subword))
+      ++oov;
+
+  int bucket = SegmentationStats::length_bucket(units);
+  SegmentationStats::add(counters.decoded, 1);
+  SegmentationStats::add(counters.lattice_edges, edges);
+  SegmentationStats::add(counters.subwords, segmentation.size());
+  SegmentationStats::add(counters.oov_subwords, oov);
+  SegmentationStats::add(counters.decode_ns, ns);
+  SegmentationStats::add(counters.bucket_tokens[bucket], 1);
+  SegmentationStats::add(counters.bucket_ns[bucket], ns);
+}
+
+
+void Segmenter::segment_tokens(
+    std::vector<std::vector<std::string>>& segmentations,
+    const std::vector<std::string>& tokens) const {
+  segmentations.resize(tokens.size());
+  for(int j = 0; j < tokens.size(); ++j) {
+    segmentations[j].clear();
+    segment_token(segmentations[j], tokens[j]);
+  }
+}
+
+
+void Segmenter::append_ids(std::vector<int>& ids,
+                           const std::vector<std::string>& segmentation) const {
+  for(int i = 0; i < segmentation.size(); ++i) {
+    const std::string& subword = segmentation[i];
+    bool continued = i + 1 < segmentation.size();
+
+    if(pieces.contains(subword)) {
+      ids.push_back(piece_to_id(subword, continued));
+      continue;
+    }
+
+    // byte fallback, only the last byte of the word is not continued
+    for(int b = 0; b < subword.size(); ++b) {
+      ids.push_back(piece_to_id(byte_piece(subword[b]),
+                                continued || b + 1 < subword.size()));
+    }
+  }
+}
+
+
+void Segmenter::segment(std::vector<int>& ids, std::string_view line) const {
+  std::vector<std::string> tokens;
+  split_line(tokens, line);
+
+  std::vector<std::string> segmentation;
+  for(const auto& token : tokens) {
+    segmentation.clear();
+    segment_token(segmentation, token);
+    append_ids(ids, segmentation);
+  }
+}
+
+
+std::vector<int> Segmenter::segment(std::string_view line) const {
+  std::vector<int> ids;
+  segment(ids, line);
+  return ids;
+}
+
+
+void Segmenter::segment_batch(
+    std::vector<std::vector<std::vector<std::string>>>& segmentations,
+    const std::vector<std::vector<std::string>>& lines) const {
+  segmentations.resize(lines.size());
+
+#pragma omp parallel for schedule(dynamic, 16)
+  for(int i = 0; i < lines.size(); ++i)
+    segment_tokens(segmentations[i], lines[i]);
+}
+
+
+void Segmenter::segment_batch(std::vector<std::vector<int>>& ids,
+                              const std::vector<std::string>& lines) const {
+  ids.resize(lines.size());
+
+#pragma omp parallel for schedule(dynamic, 16)
+  for(int i = 0; i < lines.size(); ++i) {
+    ids[i].clear();
+    segment(ids[i], lines[i]);
+  }
+}
+
+
+std::string Segmenter::id_to_piece(int id) const {
+  if(id < 0 || id >= vocab_size())
+    return "";
+
+  if(id < pieces.size())
+    return pieces[id];
+
+  return pieces[id - (int)pieces.size()] + "@@";
+}
+
+
+int Segmenter::piece_to_id(const std::string& piece, bool continued) const {
+  if(!pieces.contains(piece))
+    return -1;
+
+  return pieces[piece] + (continued ? pieces.size() : 0);
+}
+
+
+void Segmenter::write_vocab(std::ostream& os) const {
+  for(int id = 0; id < vocab_size(); ++id)
+    os << id_to_piece(id) << '\n';
+}
+
+
+void write_segmented_line(
+    std::ostream& os, const std::vector<std::vector<std::string>>& line) {
+  std::string wordsep = "";
+
+  for(const auto& segmented_token : line) {
+    os << wordsep;
+    wordsep = " ";
+
+    if(segmented_token.empty())
+      continue;
+
+    for(auto it = segmented_token.begin(); it != segmented_token.end() - 1; ++it) {
+      os << *it << sub_sep;
+    }
+
+    os << *(segmented_token.end() - 1);
+  }
+}
+
+
+void write_id_line(std::ostream& os, const std::vector<int>& ids) {
+  for(int i = 0; i < ids.size(); ++i) {
+    if(i > 0)
+      os << ' ';
+    os << ids[i];
+  }
+}
+
+
+void write_binary_line(std::ostream& os, const std::vector<int>& ids) {
+  std::string encoded;
+  encoded.reserve(4 * (ids.size() + 1));
+  auto append = [&encoded](uint32_t value) {
+    for(int i = 0; i < 4; ++i)
+      encoded.push_back((char)((value >> (8 * i)) & 0xFF));
+  };
+
+  append(ids.size());
+  for(int id : ids)
+    append(id);
+  os.write(encoded.data(), encoded.size());
+}
@@ -0,0 +1,155 @@
+#ifndef SSEG_SEGMENTER_H_
+#define SSEG_SEGMENTER_H_
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bigram_model.h"
+#include "compiled_model.h"
+#include "segmentation_stats.h"
+#include "vocabs.h"
+
+// Separator of subwords within a word in the text output.
+const std::string sub_sep = "@@ ";
+
+// Bigram segmentation model for in-process use. The model is loaded once in
+// the constructor and all segmentation methods are const and safe to call
+// from multiple threads at the same time.
+//
+// Besides subword strings, the segmenter produces IDs from the output
+// vocabulary, which corresponds to the tokens of the text output: it lists
+// the subwords from the unigram statistics and the 256 byte-fallback pieces
+// "<0xNN>", followed by the same pieces with the "@@" suffix for subwords
+// that are continued within a word. Characters that are not in the unigram
+// statistics are encoded as the byte pieces of their UTF-8 sequence.
+class Segmenter {
+ public:
+  // Loads the model from bigram and unigram statistics as written by
+  // legros-train. `beam_size` 0 means exact Viterbi search. With
+  // `pretokenize`, lines are split by the native pretokenizer, otherwise on
+  // single spaces. Up to `cache_size` token segmentations are cached, in 64
+  // shards of equal size, so the size is rounded up to a multiple of 64.
+  // Throws std::runtime_error when the statistics cannot be read.
+  Segmenter(const std::string& bigram_stats,
+            const std::string& unigram_stats,
+            int beam_size = 0,
+            bool pretokenize = false,
+            int cache_size = 100000);
+
+  // Loads a compiled model (see legros-compile), otherwise the same.
+  Segmenter(const std::string& compiled_model,
+            int beam_size = 0,
+            bool pretokenize = false,
+            int cache_size = 100000);
+
+  Segmenter(const Segmenter&) = delete;
+  Segmenter& operator=(const Segmenter&) = delete;
+
+  // Splits a line into tokens, either on single spaces or with the
+  // pretokenizer.
+  void split_line(std::vector<std::string>& tokens, std::string_view line) const;
+
+  // Segments a single token into subwords. An empty token has an empty
+  // segmentation.
+  void segment_token(std::vector<std::string>& segmentation,
+                     const std::string& token) const;
+
+  // Segments each of the tokens.
+  void segment_tokens(std::vector<std::vector<std::string>>& segmentations,
+                      const std::vector<std::string>& tokens) const;
+
+  // Segments a line and appends the output vocabulary IDs to `ids`.
+  void segment(std::vector<int>& ids, std::string_view line) const;
+  std::vector<int> segment(std::string_view line) const;
+
+  // Segments a batch of tokenized lines in parallel.
+  void segment_batch(
+      std::vector<std::vector<std::vector<std::string>>>& segmentations,
+      const std::vector<std::vector<std::string>>& lines) const;
+
+  // Segments a batch of lines into output vocabulary IDs in parallel.
+  void segment_batch(std::vector<std::vector<int>>& ids,
+                     const std::vector<std::string>& lines) const;
+
+  // Size of the output vocabulary.
+  int vocab_size() const { return 2 * pieces.size(); }
+
+  // Number of distinct subwords in the unigram statistics.
+  int subword_count() const { return subword_pieces; }
+
+  // Returns the output vocabulary item for an ID.
+  std::string id_to_piece(int id) const;
+
+  // Returns the output vocabulary ID of a subword, -1 when it does not exist.
+  int piece_to_id(const std::string& piece, bool continued = false) const;
+
+  // Appends the output vocabulary IDs of a segmented token.
+  void append_ids(std::vector<int>& ids,
+                  const std::vector<std::string>& segmentation) const;
+
+  // Writes the output vocabulary, one piece per line in the order of IDs.
+  void write_vocab(std::ostream& os) const;
+
+  // Records throughput and latency statistics into `stats` (not owned),
+  // nullptr turns the recording off.
+  void set_stats(SegmentationStats* stats) { this->stats = stats; }
+
+  int beam_size() const { return beam; }
+  bool pretokenizes() const { return pretokenize_input; }
+  int max_subword_length() const { return max_unigram_length; }
+
+ private:
+  static const int cache_shards = 64;
+
+  struct CacheShard {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<std::string>> entries;
+  };
+
+  unigram_table unigrams;
+  bigram_table bigrams;
+  int unigram_count;
+  int max_unigram_length = 0;
+  segment_token_fn decode_token;  // specialized for max_unigram_length
+
+  int beam;
+  bool pretokenize_input;
+
+  bool use_compiled = false;  // instead of the counts
+  CompiledBigramModel compiled;
+
+  Vocab pieces;
+  int subword_pieces;
+
+  int cache_shard_size;
+  mutable std::vector<CacheShard> cache;
+
+  SegmentationStats* stats = nullptr;
+
+  // Counts a token that was decoded (not found in the cache).
+  void record_decode(SegmentationStats::Counters& counters,
+                     const std::string& token,
+                     const std::vector<std::string>& segmentation,
+                     long ns) const;
+
+  // Sets up the output vocabulary.
+  void init_pieces(const std::vector<std::string>& subwords);
+};
+
+// Writes a segmented line in the text output format: words separated by
+// spaces and subwords within a word by `sub_sep`.
+void write_segmented_line(
+    std::ostream& os, const std::vector<std::vector<std::string>>& line);
+
+// Writes the output vocabulary IDs of a line separated by spaces.
+void write_id_line(std::ostream& os, const std::vector<int>& ids);
+
+// Writes the output vocabulary IDs of a line in the binary output format: the
+// number of IDs and the IDs, all as little-endian 32-bit unsigned integers.
+void write_binary_line(std::ostream& os, const std::vector<int>& ids);
+
+#endif  // SSEG_SEGMENTER_H_
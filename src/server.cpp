@@ -0,0 +1,301 @@
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// How often blocked threads check whether the server is stopping.
+static const int poll_timeout_ms = 200;
+
+
+// Writes the whole `data` to `fd`, returns false if the peer went away.
+static bool write_all(int fd, const std::string& data) {
+  size_t written = 0;
+  while(written < data.size()) {
+    ssize_t n = send(fd, data.data() + written, data.size() - written,
+                     MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return false;
+    written += n;
+  }
+  return true;
+}
+
+
+SegmentationServer::SegmentationServer(const Segmenter& segmenter,
+                                       const ServerOptions& options)
+    : segmenter(segmenter), options(options) {
+  latencies_us.reserve(latency_window);
+}
+
+
+int SegmentationServer::listen_socket() {
+  int fd;
+  if(!options.socket_path.empty()) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if(options.socket_path.size() >= sizeof(address.sun_path))
+      throw std::runtime_error("Socket path too long: " + options.socket_path);
+    std::strcpy(address.sun_path, options.socket_path.c_str());
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(options.socket_path.c_str());
+    if(fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0)
+      throw std::runtime_error("Cannot bind " + options.socket_path + ": "
+                               + std::strerror(errno));
+  } else {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0)
+      throw std::runtime_error("Cannot bind port " + std::to_string(options.port)
+                               + ": " + std::strerror(errno));
+  }
+
+  if(listen(fd, SOMAXCONN) != 0)
+    throw std::runtime_error(std::string("Cannot listen: ") + std::strerror(errno));
+
+  return fd;
+}
+
+
+void SegmentationServer::run() {
+  int fd = listen_socket();
+  std::cerr << "Listening on "
+            << (options.socket_path.empty()
+                ? "127.0.0.1:" + std::to_string(options.port)
+                : options.socket_path)
+            << std::endl;
+
+  std::atomic<bool> batches_stopping{false};
+  std::thread batcher([this, &batches_stopping]() {
+    while(true) {
+      std::vector<Request*> batch;
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_cv.wait(lock, [&]() {
+          return batches_stopping || !queue.empty();
+        });
+        if(queue.empty())
+          break;
+
+        // wait for more requests until the oldest one hits the latency limit
+        auto deadline = queue.front()->enqueued
+                        + std::chrono::microseconds(options.max_latency_us);
+        queue_cv.wait_until(lock, deadline, [&]() {
+          return batches_stopping || queue.size() >= options.max_batch_size;
+        });
+
+        while(!queue.empty() && batch.size() < options.max_batch_size) {
+          batch.push_back(queue.front());
+          queue.pop_front();
+        }
+      }
+      process_batch(batch);
+    }
+  });
+
+  std::atomic<int> connections{0};
+  while(!stopping) {
+    pollfd listening{fd, POLLIN, 0};
+    if(poll(&listening, 1, poll_timeout_ms) <= 0)
+      continue;
+
+    int client = accept(fd, nullptr, nullptr);
+    if(client < 0)
+      continue;
+
+    ++connections;
+    std::thread([this, client, &connections]() {
+      serve_connection(client);
+      --connections;
+    }).detach();
+  }
+
+  close(fd);
+  if(!options.socket_path.empty())
+    unlink(options.socket_path.c_str());
+
+  // connections finish their pending requests before the batcher stops
+  while(connections > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  batches_stopping = true;
+  queue_cv.notify_all();
+  batcher.join();
+}
+
+
+std::future<std::string> SegmentationServer::submit(Request& request) {
+  std::future<std::string> reply = request.reply.get_future();
+  request.enqueued = clock::now();
+
+  if(request.line == stats_request) {
+    request.reply.set_value(stats_json());
+    return reply;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queue.push_back(&request);
+  }
+  queue_cv.notify_one();
+  return reply;
+}
+
+
+void SegmentationServer::serve_connection(int fd) {
+  std::string buffer;
+  std::vector<char> chunk(1 << 16);
+
+  while(!stopping) {
+    pollfd readable{fd, POLLIN, 0};
+    int ready = poll(&readable, 1, poll_timeout_ms);
+    if(ready == 0 || (ready < 0 && errno == EINTR))
+      continue;
+
+    ssize_t n = ready < 0 ? -1 : read(fd, chunk.data(), chunk.size());
+    if(n <= 0)
+      break;
+    buffer.append(chunk.data(), n);
+
+    // all complete requests received so far go to the batcher together
+    std::vector<std::unique_ptr<Request>> requests;
+    size_t pos = 0;
+    bool oversized = false;
+    while(true) {
+      std::string line;
+      if(options.length_prefixed) {
+        if(buffer.size() - pos < 4)
+          break;
+        const unsigned char* header = (const unsigned char*)buffer.data() + pos;
+        uint32_t length = header[0] | (header[1] << 8) | (header[2] << 16)
+                          | ((uint32_t)header[3] << 24);
+        if(length > (uint32_t)options.max_request_bytes) {
+          oversized = true;
+          break;
+        }
+        if(buffer.size() - pos - 4 < length)
+          break;
+        line = buffer.substr(pos + 4, length);
+        pos += 4 + length;
+      } else {
+        size_t end = buffer.find('\n', pos);
+        if(end == std::string::npos) {
+          oversized = buffer.size() - pos > (size_t)options.max_request_bytes;
+          break;
+        }
+        line = buffer.substr(pos, end - pos);
+        pos = end + 1;
+      }
+      requests.push_back(std::make_unique<Request>());
+      requests.back()->line = std::move(line);
+    }
+    buffer.erase(0, pos);
+
+    std::vector<std::future<std::string>> replies;
+    for(auto& request : requests)
+      replies.push_back(submit(*request));
+
+    bool connected = true;
+    for(auto& reply : replies) {
+      std::string payload = reply.get();
+      std::string framed;
+      if(options.length_prefixed) {
+        uint32_t length = payload.size();
+        for(int i = 0; i < 4; ++i)
+          framed.push_back((char)((length >> (8 * i)) & 0xFF));
+        framed += payload;
+      } else {
+        framed = payload + '\n';
+      }
+      connected = connected && write_all(fd, framed);
+    }
+    // the complete requests are answered before an oversized one closes
+    // the connection
+    if(!connected || oversized)
+      break;
+  }
+
+  close(fd);
+}
+
+
+void SegmentationServer::process_batch(std::vector<Request*>& batch) {
+  std::vector<std::vector<std::string>> lines(batch.size());
+  for(int i = 0; i < batch.size(); ++i)
+    segmenter.split_line(lines[i], batch[i]->line);
+
+  std::vector<std::vector<std::vector<std::string>>> segmentations;
+  segmenter.segment_batch(segmentations, lines);
+
+  auto done = clock::now();
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    ++batch_count;
+    for(auto* request : batch) {
+      float latency = std::chrono::duration<float, std::micro>(
+          done - request->enqueued).count();
+      if(latencies_us.size() < latency_window)
+        latencies_us.push_back(latency);
+      else
+        latencies_us[latency_pos % latency_window] = latency;
+      ++latency_pos;
+      ++request_count;
+    }
+  }
+
+  for(int i = 0; i < batch.size(); ++i) {
+    std::ostringstream oss;
+    write_segmented_line(oss, segmentations[i]);
+    batch[i]->reply.set_value(oss.str());
+  }
+}
+
+
+std::string SegmentationServer::stats_json() const {
+  std::vector<float> latencies;
+  int64_t requests, batches;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    latencies = latencies_us;
+    requests = request_count;
+    batches = batch_count;
+  }
+
+  auto percentile = [&latencies](float p) -> float {
+    if(latencies.empty())
+      return 0;
+    size_t k = std::min(latencies.size() - 1, (size_t)(p * latencies.size()));
+    std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+    return latencies[k];
+  };
+
+  std::ostringstream oss;
+  oss << "{\"requests\": " << requests
+      << ", \"batches\": " << batches
+      << ", \"mean_batch_size\": "
+      << (batches == 0 ? 0.0 : (double)requests / batches)
+      << ", \"p50_us\": " << percentile(0.5)
+      << ", \"p99_us\": " << percentile(0.99) << "}";
+  return oss.str();
+}
@@ -0,0 +1,87 @@
+#ifndef SSEG_SERVER_H_
+#define SSEG_SERVER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "segmenter.h"
+
+// Request sent to get the server statistics instead of a segmentation.
+const std::string stats_request = "\x01STATS";
+
+struct ServerOptions {
+  // Path of a Unix domain socket to listen on; if empty, `port` is used.
+  std::string socket_path;
+  // TCP port on the loopback interface.
+  int port = 0;
+  // Requests and replies are 4-byte little-endian lengths followed by the
+  // payload instead of newline-terminated lines.
+  bool length_prefixed = false;
+  // A batch is segmented once it has `max_batch_size` requests or its oldest
+  // request has waited for `max_latency_us` microseconds.
+  int max_batch_size = 256;
+  int max_latency_us = 1000;
+  // Connections sending a longer request are closed.
+  int max_request_bytes = 1 << 20;
+};
+
+// Serves segmentation requests from local clients. Each request is a line of
+// text and the reply is its segmentation in the text output format of
+// legros. Concurrent requests (from multiple connections, or pipelined on one
+// connection) are collected into batches which are segmented in parallel.
+//
+// The reply to `stats_request` is a JSON object with request counts and
+// p50/p99 latencies (from enqueueing a request to its segmentation being
+// ready) over a window of recent requests.
+class SegmentationServer {
+ public:
+  SegmentationServer(const Segmenter& segmenter, const ServerOptions& options);
+
+  // Listens and serves until `stop` is called. Throws std::runtime_error
+  // when the socket cannot be set up.
+  void run();
+
+  // Makes `run` return; safe to call from a signal handler.
+  void stop() { stopping = true; }
+
+  std::string stats_json() const;
+
+ private:
+  typedef std::chrono::steady_clock clock;
+
+  struct Request {
+    std::string line;
+    clock::time_point enqueued;
+    std::promise<std::string> reply;
+  };
+
+  const Segmenter& segmenter;
+  ServerOptions options;
+  std::atomic<bool> stopping{false};
+
+  std::mutex queue_mutex;
+  std::condition_variable queue_cv;
+  std::deque<Request*> queue;
+
+  static const int latency_window = 100000;
+  mutable std::mutex stats_mutex;
+  std::vector<float> latencies_us;
+  int64_t latency_pos = 0;
+  int64_t request_count = 0;
+  int64_t batch_count = 0;
+
+  int listen_socket();
+  void serve_connection(int fd);
+  void batch_loop();
+  void process_batch(std::vector<Request*>& batch);
+  std::future<std::string> submit(Request& request);
+};
+
+#endif  // SSEG_SERVER_H_
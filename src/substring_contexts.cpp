@@ -0,0 +1,104 @@
+/**
+ * Substring stats -- count subwords in the context of words.
+ * Input:
+ * - subword vocabulary, a subword per line
+ * - word vocabulary, a word per line
+ * - tokenized text (standard input by default)
+ * - optionally allowed substrings, in the text or the binary format
+ *
+ * Output:
+ * - S x V matrix of how many times (or with which weight) each substring of
+ *   a token occurred with each word within the window, as a scipy.sparse
+ *   CSR matrix in an .npz archive (scipy.sparse.load_npz)
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "CLI11.hpp"
+#include "npz.h"
+#include "substring_stats.h"
+#include "vocabs.h"
+
+struct opt {
+  std::string subword_vocabulary;
+  std::string word_vocabulary;
+  std::string output;
+  std::string input = "/dev/stdin";
+  std::string allowed_substrings;
+  bool weighted = false;
+  int window_size = 3;
+  int max_subword = 10;
+  bool pretokenize = false;
+} opt;
+
+void get_options(CLI::App& app) {
+  app.add_option("subword_vocabulary", opt.subword_vocabulary,
+                 "Subword vocabulary, subword per line.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("word_vocabulary", opt.word_vocabulary,
+                 "Word vocabulary, word per line.")
+      ->required()
+      ->check(CLI::ExistingFile);
+
+  app.add_option("output", opt.output, "Output .npz file.")
+      ->required();
+
+  app.add_option("input", opt.input, "Tokenized text.");
+
+  app.add_option("--allowed-substrings", opt.allowed_substrings,
+                 "Count only the allowed substrings of each token instead of "
+                 "all its substrings in the subword vocabulary.")
+      ->check(CLI::ExistingFile);
+
+  app.add_flag("--weighted", opt.weighted,
+               "Every allowed substring is followed by its weight, which is "
+               "counted instead of 1.");
+
+  app.add_option("--window-size", opt.window_size, "Window size.");
+
+  app.add_option("--max-subword", opt.max_subword,
+                 "Maximum length of the substrings in code points, without "
+                 "allowed substrings.");
+
+  app.add_flag("--pretokenize", opt.pretokenize,
+               "Split the text with the native pretokenizer instead of on "
+               "whitespace.");
+}
+
+
+int main(int argc, char* argv[]) {
+  CLI::App app{"Substring stats -- count subwords in the context of words."};
+  get_options(app);
+  CLI11_PARSE(app, argc, argv);
+
+  try {
+    Vocab subwords(opt.subword_vocabulary);
+    Vocab words(opt.word_vocabulary);
+    std::cerr << "Loaded " << subwords.size() << " subwords and "
+              << words.size() << " words." << std::endl;
+
+    SparseStats stats(subwords.size(), words.size());
+    populate_substring_stats<SparseStats>(
+        stats, words, subwords, opt.input, opt.allowed_substrings,
+        opt.window_size, opt.max_subword, opt.weighted, opt.pretokenize);
+
+    std::vector<int64_t> indptr;
+    std::vector<int32_t> indices;
+    std::vector<double> values;
+    stats.to_csr(indptr, indices, values);
+
+    std::cerr << "Saving " << values.size() << " nonzero counts to "
+              << opt.output << std::endl;
+    save_csr_npz(opt.output, stats.rows(), stats.cols(), indptr, indices,
+                 values, !opt.weighted);
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,100 +1,14 @@
 #include "substring_stats.h"
 
+#include <algorithm>
 #include <unordered_map>
 #include <vector>
 #include <string>
 #include <fstream>
 #include <sstream>
 
+#include "utf8.h"
 
-void load_weighted_allowed_substrings(
-    std::unordered_map<std::string, std::vector<std::pair<std::string, float>>>& allowed_substrings,
-    const std::string &file) {
-
-  // format: space-separated file, first field is the word, the rest are allowed substrings with the weights
-  // example
-  // word w 0.2 wo 0.1 word 0.4 rd 0.1
-  std::ifstream ifs(file);
-  for(std::string line; std::getline(ifs, line);) {
-    std::istringstream iss(line);
-    std::string word;
-    iss >> word;
-
-    std::vector<std::pair<std::string, float>> pairs;
-
-    std::string first;
-    while(iss >> first) {
-      std::pair<std::string, float> pair;
-
-      pair.first = first;
-      iss >> pair.second;
-
-      pairs.push_back(pair);
-    }
-
-    allowed_substrings.insert({word, pairs});
-  }
-}
-
-void load_allowed_substrings(
-    std::unordered_map<std::string,std::vector<std::pair<std::string, float>>> &allowed_substrings,
-    const std::string &file) {
-
-  // format: space-separated file, first field is the word, the rest are allowed substrings
-  std::ifstream ifs(file);
-  for(std::string line; std::getline(ifs, line);) {
-    std::istringstream iss(line);
-    std::string word;
-    iss >> word;
-
-    std::vector<std::pair<std::string, float>> pairs;
-
-    std::string first;
-    while(iss >> first) {
-      std::pair<std::string, float> pair;
-
-      pair.first = first;
-      pair.second = 1.0;
-
-      pairs.push_back(pair);
-    }
-
-    allowed_substrings.insert({word, pairs});
-  }
-}
-
-void load_allowed_substrings( // THIS IS NOT WEIGHTED
-    std::unordered_map<std::string,std::vector<std::pair<std::string, float>>>& allowed_substrings,
-    std::unordered_map<std::string,std::vector<std::pair<std::string, float>>>& inverse_allowed_substrings,
-    const std::string& file) {
-
-  // format: space-separated file, first field is the word, the rest are allowed substrings
-  std::ifstream ifs(file);
-  for(std::string line; std::getline(ifs, line);) {
-    std::istringstream iss(line);
-    std::string word;
-    iss >> word;
-
-    std::vector<std::pair<std::string, float>> pairs;
-
-    std::string subword;
-    while(iss >> subword) {
-      float score = 1.0;
-
-      if(inverse_allowed_substrings.count(subword) == 0) {
-        inverse_allowed_substrings.insert({subword, std::vector<std::pair<std::string, float>>(
-            {std::pair<std::string, float>(word, score)})});
-      }
-      else {
-        inverse_allowed_substrings.at(subword).push_back(std::pair<std::string, float>(word, score));
-      }
-
-      pairs.push_back(std::pair<std::string, float>(subword, score));
-    }
-
-    allowed_substrings.insert({word, pairs});
-  }
-}
 
 void load_allowed_substrings(
     Eigen::MatrixXi& allowed_substrings,
@@ -102,11 +16,9 @@ void load_allowed_substrings(
     const Vocab& subword_vocab,
     const std::string& file) {
 
-  std::ifstream ifs(file);
-  for(std::string line; std::getline(ifs, line);) {
-    std::istringstream iss(line);
-    std::string word;
-    iss >> word;
+  AllowedSubstrings index = AllowedSubstrings::load(file);
+  for(int word_id = 0; word_id < index.word_count(); ++word_id) {
+    std::string word(index.word(word_id));
 
     if(!word_vocab.contains(word)) {
       std::cerr << "ERR: Word '" << word << "' not in vocab" << std::endl;
@@ -115,8 +27,8 @@ void load_allowed_substrings(
 
     int word_index = word_vocab[word];
 
-    std::string subword;
-    while(iss >> subword) {
+    for(const auto& entry : index.substrings(word_id)) {
+      std::string subword(index.subword(entry.subword));
 
       if(!subword_vocab.contains(subword)) {
         std::cerr << "ERR: Subword '" << subword << "' of '"
@@ -139,11 +51,9 @@ void load_allowed_substrings_sparse(
 
   std::vector<Eigen::Triplet<int>> triplet_list;
 
-  std::ifstream ifs(file);
-  for(std::string line; std::getline(ifs, line);) {
-    std::istringstream iss(line);
-    std::string word;
-    iss >> word;
+  AllowedSubstrings index = AllowedSubstrings::load(file);
+  for(int word_id = 0; word_id < index.word_count(); ++word_id) {
+    std::string word(index.word(word_id));
 
     if(!word_vocab.contains(word)) {
       std::cerr << "ERR: Word '" << word << "' not in vocab" << std::endl;
@@ -152,8 +62,9 @@ void load_allowed_substrings_sparse(
 
     int word_index = word_vocab[word];
 
-    std::string subword;
-    while(iss >> subword) {
+    for(const auto& entry : index.substrings(word_id)) {
+      std::string subword(index.subword(entry.subword));
+
       if(!subword_vocab.contains(subword)) {
         std::cerr << "ERR: Subword '" << subword << "' of '"
                   << word << "' not in subword vocab" << std::endl;
@@ -171,19 +82,44 @@ void load_allowed_substrings_sparse(
   allowed_substrings.setFromTriplets(triplet_list.begin(), triplet_list.end());
 }
 
+void SparseStats::to_csr(std::vector<int64_t>& indptr,
+                         std::vector<int32_t>& indices,
+                         std::vector<double>& values) const {
+  indptr.assign(1, 0);
+  indices.clear();
+  values.clear();
+  std::vector<std::pair<int, double>> row;
+  for(const auto& row_map : row_maps) {
+    row.assign(row_map.begin(), row_map.end());
+    std::sort(row.begin(), row.end());
+    for(const auto& [col, value] : row) {
+      indices.push_back(col);
+      values.push_back(value);
+    }
+    indptr.push_back(indices.size());
+  }
+}
+
+
 /**
  * get_all_substrings
  *
  * For given word, get all its substrings (present in the subword_to_index map)
- * BE CAREFUL, for this is byte-based!!!
+ * of at most `max_len` code points. The substrings never split a UTF-8
+ * sequence, malformed bytes count as single code points.
  */
 void get_all_substrings(std::vector<std::pair<std::string, float>> &substrings,
                         const Vocab &subwords,
                         const std::string &word, int max_len) {
 
-  for(int sub_len = 1; sub_len < std::min((int)word.size(), max_len) + 1; ++sub_len) {
-    for(int i = 0; i < word.size() - sub_len + 1; ++i) {
-      auto substr = word.substr(i, sub_len);
+  std::vector<int> boundaries;
+  utf8_boundaries(boundaries, word);
+  int units = boundaries.size() - 1;
+
+  for(int sub_len = 1; sub_len < std::min(units, max_len) + 1; ++sub_len) {
+    for(int i = 0; i < units - sub_len + 1; ++i) {
+      auto substr = word.substr(
+          boundaries[i], boundaries[i + sub_len] - boundaries[i]);
       if(!subwords.contains(substr))
         continue;
 
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <iterator>
+#include <mutex>
+#include <type_traits>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
@@ -11,28 +16,22 @@
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "allowed_substrings.h"
 #include "vocabs.h"
+#include "instrumentation.h"
+#include "pretokenize.h"
 
 typedef Eigen::MatrixXf CooccurrenceMatrix;
 //typedef std::unordered_map<int, std::unordered_map<int, int>> CooccurrenceMatrix;
-typedef std::unordered_map<std::string, std::vector<std::pair<std::string, float>>> AllowedSubstringMap;
-typedef std::unordered_map<std::string, std::vector<std::pair<std::string, float>>> InverseAllowedSubstringMap;
 
 #define BUFFER_SIZE 1000000
 
-void load_weighted_allowed_substrings(
-    std::unordered_map<std::string, std::vector<std::pair<std::string, float>>>& allowed_substrings,
-    const std::string& file);
-
-void load_allowed_substrings(
-    std::unordered_map<std::string,std::vector<std::pair<std::string, float>>>& allowed_substrings,
-    const std::string& file);
-
-void load_allowed_substrings(
-    std::unordered_map<std::string,std::vector<std::pair<std::string, float>>>& allowed_substrings,
-    std::unordered_map<std::string,std::vector<std::pair<std::string, float>>>& inverse_allowed_substrings,
-    const std::string& file);
-
+// The dense and sparse 0/1 matrices of allowed substrings, from the text or
+// the binary format (see AllowedSubstrings).
 void load_allowed_substrings(
     Eigen::MatrixXi& allowed_substrings,
     const Vocab& word_vocab,
@@ -51,6 +50,48 @@ void get_all_substrings(
     const std::string &word,
     int max_len);
 
+// Splits a line of the training corpus into tokens, either on whitespace or,
+// with `use_pretokenizer`, using the native pretokenizer.
+inline void split_corpus_line(std::vector<std::string>& tokens,
+                              const std::string& line,
+                              bool use_pretokenizer) {
+  if(use_pretokenizer) {
+    pretokenize_line(tokens, line);
+    return;
+  }
+
+  std::istringstream iss(line);
+  tokens.assign(std::istream_iterator<std::string>(iss),
+                std::istream_iterator<std::string>());
+}
+
+// Sparse statistics for the populate_* functions, a hash map per row. The
+// rows are updated through StatsAccumulator, which never updates a row from
+// two threads at once.
+class SparseStats {
+ public:
+  SparseStats(int rows, int cols) : col_count(cols), row_maps(rows) {}
+
+  int rows() const { return row_maps.size(); }
+  int cols() const { return col_count; }
+
+  double& at(int row, int col) { return row_maps[row][col]; }
+
+  // The nonzero statistics, with the columns of row r in
+  // indices[indptr[r]] to indices[indptr[r + 1] - 1], sorted.
+  void to_csr(std::vector<int64_t>& indptr,
+              std::vector<int32_t>& indices,
+              std::vector<double>& values) const;
+
+ private:
+  int col_count;
+  std::vector<std::unordered_map<int, double>> row_maps;
+};
+
+inline double& get_2d(SparseStats& stats, int stat_index, int word_index) {
+  return stats.at(stat_index, word_index);
+}
+
 template<typename U>
 U& get_2d(
     std::vector<std::vector<U>>& stats,
@@ -84,34 +125,113 @@ inline int& get_2d(
 //   return stats(stat_index, word_index);
 // }
 
+// Whether different rows of a stats type can be updated concurrently;
+// an insertion into an Eigen::SparseMatrix may move all of its rows.
+template<typename T>
+struct concurrent_rows : std::true_type {};
+
+template<typename Scalar, int Options, typename Index>
+struct concurrent_rows<Eigen::SparseMatrix<Scalar, Options, Index>>
+    : std::false_type {};
+
+// Collects the updates of `stats` in a buffer per OpenMP thread instead of
+// adding them to the shared statistics one by one. A full buffer is sorted,
+// the updates of the same entry are summed and the sums are added through
+// get_2d, a shard of rows at a time under the lock of the shard, so the
+// threads neither contend for cache lines while counting nor update an entry
+// at the same time. Every thread calls `flush` at the end of its work.
+template<typename T>
+class StatsAccumulator {
+ public:
+  StatsAccumulator(T& stats, int rows, size_t buffer_size = 1 << 16)
+      : stats(stats), rows(std::max(rows, 1)), buffer_size(buffer_size),
+        locks(concurrent_rows<T>::value ? 64 : 1) {
+#ifdef _OPENMP
+    buffers.resize(omp_get_max_threads());
+#else
+    buffers.resize(1);
+#endif
+  }
+
+  void add(int row, int col, float value) {
+    auto& buffer = thread_buffer();
+    buffer.push_back({row, col, value});
+    if(buffer.size() >= buffer_size)
+      flush_buffer(buffer);
+  }
+
+  // Adds the buffered updates of the calling thread to the statistics.
+  void flush() { flush_buffer(thread_buffer()); }
+
+ private:
+  struct Update {
+    int row;
+    int col;
+    float value;
+  };
+
+  std::vector<Update>& thread_buffer() {
+#ifdef _OPENMP
+    return buffers[omp_get_thread_num()];
+#else
+    return buffers[0];
+#endif
+  }
+
+  int shard(int row) const { return (long)row * locks.size() / rows; }
+
+  void flush_buffer(std::vector<Update>& buffer) {
+    std::sort(buffer.begin(), buffer.end(),
+              [](const Update& a, const Update& b) {
+                return a.row != b.row ? a.row < b.row : a.col < b.col;
+              });
+
+    size_t size = 0;
+    for(const auto& update : buffer) {
+      if(size > 0 && buffer[size - 1].row == update.row
+         && buffer[size - 1].col == update.col)
+        buffer[size - 1].value += update.value;
+      else
+        buffer[size++] = update;
+    }
+
+    for(size_t i = 0; i < size;) {
+      int current = shard(buffer[i].row);
+      std::lock_guard<std::mutex> lock(locks[current]);
+      for(; i < size && shard(buffer[i].row) == current; ++i)
+        get_2d(stats, buffer[i].row, buffer[i].col) += buffer[i].value;
+    }
+    buffer.clear();
+  }
+
+  T& stats;
+  int rows;
+  size_t buffer_size;
+  std::vector<std::vector<Update>> buffers;
+  std::vector<std::mutex> locks;
+};
+
+// Adds the `substrings` (indices to the subword vocabulary with weights) to
+// the statistics of `token`.
 template<typename T>
 void try_add_to_stats(
-    T& stats,
+    StatsAccumulator<T>& stats,
     const std::string& token,
-    const std::vector<std::pair<std::string, float>>& substrings,
-    const Vocab& words,
-    const Vocab& subwords) {
+    const std::vector<std::pair<int, float>>& substrings,
+    const Vocab& words) {
 
   if(!words.contains(token))
     return;
 
   int word_index = words[token];
 
-  for(std::pair<std::string, float> substring_pair : substrings) {
-    if(!subwords.contains(substring_pair.first))
-      continue;
-
-    // add to stats
-    int stat_index = subwords[substring_pair.first];
-
-#pragma omp atomic
-    get_2d(stats, stat_index, word_index) += substring_pair.second;
-  }
+  for(const auto& [stat_index, weight] : substrings)
+    stats.add(stat_index, word_index, weight);
 }
 
 
 template<typename T>
-void try_add_word_to_stats(T& stats,
+void try_add_word_to_stats(StatsAccumulator<T>& stats,
                            const Vocab& words,
                            const std::string& target_token,
                            const std::string& window_token) {
@@ -125,13 +245,12 @@ void try_add_word_to_stats(T& stats,
   int word_index = words[target_token];
   int stat_index = words[window_token];
 
-#pragma omp atomic
-  get_2d(stats, stat_index, word_index) += 1;
+  stats.add(stat_index, word_index, 1);
 }
 
 
 template<>
-inline void try_add_word_to_stats<CooccurrenceMatrix>(CooccurrenceMatrix& stats,
+inline void try_add_word_to_stats<CooccurrenceMatrix>(StatsAccumulator<CooccurrenceMatrix>& stats,
                                                       const Vocab& words,
                                                       const std::string& target_token,
                                                       const std::string& window_token) {
@@ -155,8 +274,7 @@ inline void try_add_word_to_stats<CooccurrenceMatrix>(CooccurrenceMatrix& stats,
 //   }
 //   else {
 
-#pragma omp atomic
-  get_2d(stats, target_index, window_index) += 1;
+  stats.add(target_index, window_index, 1);
 
 }
 
@@ -168,44 +286,55 @@ void process_buffer(
     int end,
     int max_subword,
     int window_size,
-    T &stats,
+    StatsAccumulator<T>& stats,
     const Vocab &words,
     const Vocab &subwords,
-    bool use_allowed_substrings,
-    std::unordered_map<std::string,std::vector<std::pair<std::string, float>>> &allowed_substrings) {
-
-#pragma omp parallel for
-  for(int i = 0; i < end; ++i) {
-    std::string line = buffer[i];
-    std::istringstream iss(line);
-
-    std::vector<std::string> tokens(
-        (std::istream_iterator<std::string>(iss)),
-        std::istream_iterator<std::string>());
-
-    int t = 0;
-    for(auto token: tokens) {
-
-      std::vector<std::pair<std::string, float>> substrings;
-
-      if(use_allowed_substrings) {
-        if(allowed_substrings.count(token))  // use only this if you want to use all substrings instead of none
-          substrings = allowed_substrings[token];
-        else
-          continue;
-      }
-      else
-        get_all_substrings(substrings, subwords, token, max_subword);
-
-      for(int j = std::max(0, t - window_size); j < t; ++j) {
-        try_add_to_stats<T>(stats, tokens[j], substrings, words, subwords);
-      }
-
-      for(int k = t + 1; k < std::min(t + 1 + window_size, (int)tokens.size()); ++k) {
-        try_add_to_stats<T>(stats, tokens[k], substrings, words, subwords);
+    const AllowedSubstrings* allowed_substrings,
+    const std::vector<int>& allowed_subword_indices,
+    bool pretokenize_input) {
+
+#pragma omp parallel
+  {
+#pragma omp for
+    for(int i = 0; i < end; ++i) {
+      std::vector<std::string> tokens;
+      split_corpus_line(tokens, buffer[i], pretokenize_input);
+
+      std::vector<std::pair<std::string, float>> all_substrings;
+      std::vector<std::pair<int, float>> substrings;
+
+      int t = 0;
+      for(const auto& token: tokens) {
+        substrings.clear();
+
+        // without allowed substrings, all substrings in the subword vocabulary
+        if(allowed_substrings != nullptr) {
+          int word_id = allowed_substrings->word_id(token);
+          if(word_id == -1)
+            continue;
+          for(const auto& entry : allowed_substrings->substrings(word_id)) {
+            int stat_index = allowed_subword_indices[entry.subword];
+            if(stat_index != -1)
+              substrings.push_back({stat_index, entry.weight});
+          }
+        } else {
+          all_substrings.clear();
+          get_all_substrings(all_substrings, subwords, token, max_subword);
+          for(const auto& [substring, weight] : all_substrings)
+            substrings.push_back({subwords[substring], weight});
+        }
+
+        for(int j = std::max(0, t - window_size); j < t; ++j) {
+          try_add_to_stats<T>(stats, tokens[j], substrings, words);
+        }
+
+        for(int k = t + 1; k < std::min(t + 1 + window_size, (int)tokens.size()); ++k) {
+          try_add_to_stats<T>(stats, tokens[k], substrings, words);
+        }
+        ++t;
       }
-      ++t;
     }
+    stats.flush();
   }
 }
 
@@ -218,22 +347,32 @@ void populate_substring_stats(
     const std::string &allowed_substrings_file,
     int window_size,
     int max_subword,
-    bool use_weighted_substrings) {
+    bool use_weighted_substrings,
+    bool pretokenize_input = false) {
 
   std::cerr << "Iterating over sentences from " << training_data_file << std::endl;
   std::ifstream input_fh(training_data_file);
 
-  std::unordered_map<std::string,std::vector<std::pair<std::string, float>>> allowed_substrings;
+  AllowedSubstrings allowed_substrings;
+  std::vector<int> allowed_subword_indices;  // to the subword vocabulary
   if (!allowed_substrings_file.empty()) {
-    if(use_weighted_substrings) {
+    if(use_weighted_substrings)
       std::cerr << "Loading list of weighted allowed substrings from " << allowed_substrings_file << std::endl;
-      load_weighted_allowed_substrings(allowed_substrings, allowed_substrings_file);
-    } else {
+    else
       std::cerr << "Loading list of allowed substrings from " << allowed_substrings_file << std::endl;
-      load_allowed_substrings(allowed_substrings, allowed_substrings_file);
+    allowed_substrings = AllowedSubstrings::load(allowed_substrings_file,
+                                                 use_weighted_substrings);
+
+    for(int id = 0; id < allowed_substrings.subword_count(); ++id) {
+      std::string subword(allowed_substrings.subword(id));
+      allowed_subword_indices.push_back(
+          subwords.contains(subword) ? subwords[subword] : -1);
     }
   }
+  const AllowedSubstrings* allowed = allowed_substrings_file.empty()
+                                     ? nullptr : &allowed_substrings;
 
+  StatsAccumulator<T> accumulator(stats, subwords.size());
   int lineno = 0;
   int buffer_pos = 0;
   std::vector<std::string> buffer(BUFFER_SIZE);
@@ -247,17 +386,17 @@ void populate_substring_stats(
     // full buffer -> process
     if(buffer_pos == BUFFER_SIZE) {
       process_buffer<T>(buffer, buffer_pos, max_subword, window_size,
-                        stats, words, subwords, !allowed_substrings_file.empty(),
-                        allowed_substrings);
+                        accumulator, words, subwords, allowed,
+                        allowed_subword_indices, pretokenize_input);
       buffer_pos = 0;
     }
   }
 
   // process the rest of the buffer
   if(buffer_pos > 0) {
-    process_buffer<T>(buffer, buffer_pos, max_subword, window_size, stats,
-                      words, subwords, !allowed_substrings_file.empty(),
-                      allowed_substrings);
+    process_buffer<T>(buffer, buffer_pos, max_subword, window_size,
+                      accumulator, words, subwords, allowed,
+                      allowed_subword_indices, pretokenize_input);
   }
 
   std::cerr << "Read " << lineno << " lines in total." << std::endl;
@@ -265,56 +404,70 @@ void populate_substring_stats(
 
 
 
-template<typename T>
-void process_word_buffer(T& stats,
-                         std::vector<int>& word_frequencies,
+// Counts the lines of `buffer` into `stats` and `word_frequencies`, returns
+// the number of tokens.
+template<typename T, typename F>
+long process_word_buffer(StatsAccumulator<T>& stats,
+                         std::vector<F>& word_frequencies,
                          const std::vector<std::string>& buffer,
                          const Vocab& words,
                          int length,
-                         int window_size) {
-#pragma omp parallel for
-  for(int i = 0; i < length; ++i) {
-    std::string line = buffer[i];
-    std::istringstream iss(line);
-
-    std::vector<std::string> tokens(
-        (std::istream_iterator<std::string>(iss)),
-        std::istream_iterator<std::string>());
-
-    int t = 0;
-    for(auto token: tokens) {
-      if(words.contains(token))
-        word_frequencies[words[token]]++;
-
-      for(int j = std::max(0, t - window_size); j < t; ++j) {
-        try_add_word_to_stats<T>(stats, words, tokens[j], token);
+                         int window_size,
+                         bool pretokenize_input) {
+  long token_count = 0;
+#pragma omp parallel reduction(+:token_count)
+  {
+    // a histogram per thread, summed at the end
+    std::vector<F> local_frequencies(word_frequencies.size());
+
+#pragma omp for
+    for(int i = 0; i < length; ++i) {
+      std::vector<std::string> tokens;
+      split_corpus_line(tokens, buffer[i], pretokenize_input);
+      token_count += tokens.size();
+
+      int t = 0;
+      for(auto token: tokens) {
+        if(words.contains(token))
+          ++local_frequencies[words[token]];
+
+        for(int j = std::max(0, t - window_size); j < t; ++j) {
+          try_add_word_to_stats<T>(stats, words, tokens[j], token);
+        }
+
+        for(int k = t + 1; k < std::min(t + 1 + window_size, (int)tokens.size()); ++k) {
+          try_add_word_to_stats<T>(stats, words, tokens[k], token);
+        }
+        ++t;
       }
-
-      for(int k = t + 1; k < std::min(t + 1 + window_size, (int)tokens.size()); ++k) {
-        try_add_word_to_stats<T>(stats, words, tokens[k], token);
-      }
-      ++t;
     }
+    stats.flush();
+
+#pragma omp critical
+    for(int w = 0; w < word_frequencies.size(); ++w)
+      word_frequencies[w] += local_frequencies[w];
   }
+  return token_count;
 }
 
 
-template<typename T>
-void populate_word_stats(T& stats,
-                         std::vector<int>& word_frequencies,
+// Counts the word cooccurrences within `window_size` tokens and the word
+// frequencies in the lines of `input`. Returns the number of lines and adds
+// the number of tokens to `tokens`.
+template<typename T, typename F>
+long populate_word_stats(T& stats,
+                         std::vector<F>& word_frequencies,
                          const Vocab& words,
-                         const std::string &training_data_file,
-                         int window_size) {
-
-  std::cerr << "Iterating over sentences from " << training_data_file
-            << std::endl;
-  std::ifstream input_fh(training_data_file);
-
-  int lineno = 0;
+                         std::istream& input,
+                         int window_size,
+                         bool pretokenize_input,
+                         long& tokens) {
+  StatsAccumulator<T> accumulator(stats, words.size());
+  long lineno = 0;
   int buffer_pos = 0;
   std::vector<std::string> buffer(BUFFER_SIZE);
 
-  while(std::getline(input_fh, buffer[buffer_pos])) {
+  while(std::getline(input, buffer[buffer_pos])) {
     ++lineno;
     ++buffer_pos;
 
@@ -322,7 +475,9 @@ void populate_word_stats(T& stats,
     if(buffer_pos == BUFFER_SIZE) {
       std::cerr << "Processing buffer; lineno: " << lineno << "\r";
 
-      process_word_buffer<T>(stats, word_frequencies, buffer, words, buffer_pos, window_size);
+      tokens += process_word_buffer<T>(accumulator, word_frequencies, buffer,
+                                       words, buffer_pos, window_size,
+                                       pretokenize_input);
       buffer_pos = 0;
     }
   }
@@ -331,8 +486,32 @@ void populate_word_stats(T& stats,
 
   // process the rest of the buffer
   if(buffer_pos > 0) {
-    process_word_buffer<T>(stats, word_frequencies, buffer, words, buffer_pos, window_size);
+    tokens += process_word_buffer<T>(accumulator, word_frequencies, buffer,
+                                     words, buffer_pos, window_size,
+                                     pretokenize_input);
   }
+  return lineno;
+}
+
+
+template<typename T, typename F>
+void populate_word_stats(T& stats,
+                         std::vector<F>& word_frequencies,
+                         const Vocab& words,
+                         const std::string &training_data_file,
+                         int window_size,
+                         bool pretokenize_input = false) {
+
+  std::cerr << "Iterating over sentences from " << training_data_file
+            << std::endl;
+  std::ifstream input_fh(training_data_file);
+
+  long tokens = 0;
+  long lineno = populate_word_stats<T>(stats, word_frequencies, words,
+                                       input_fh, window_size,
+                                       pretokenize_input, tokens);
 
   std::cerr << "Read " << lineno << " lines in total." << std::endl;
+  profiler().count("tokens", tokens);
+  profiler().count("lines", lineno);
 }
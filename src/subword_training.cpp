@@ -0,0 +1,549 @@
+#include "subword_training.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "instrumentation.h"
+#include "utf8.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char cooccurrences_magic[8] = {'L', 'E', 'G', 'R', 'O', 'S', 'C', 'O'};
+const char checkpoint_magic[8] = {'L', 'E', 'G', 'R', 'O', 'S', 'C', 'K'};
+const uint32_t checkpoint_version = 1;
+
+template<typename T>
+void write_pod(std::ostream& os, const T& value) {
+  os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void read_pod(std::istream& is, T& value) {
+  is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+// Whether the rest of the stream holds `count` items of `item_size` bytes.
+// The position is only sought for arrays above a few KiB, the smaller ones
+// are left to fail in the reads that follow.
+bool fits(std::istream& is, uint64_t count, uint64_t item_size) {
+  if(item_size == 0 || count <= 4096 / item_size)
+    return true;
+  std::streampos pos = is.tellg();
+  is.seekg(0, std::ios::end);
+  uint64_t remaining = is.tellg() - pos;
+  is.seekg(pos);
+  return is && count <= remaining / item_size;
+}
+
+// Reads the size of an array of `item_size` byte items, failing the stream
+// when the file is too short for it, so that a corrupted checkpoint cannot
+// make us allocate arbitrary amounts of memory.
+void read_size(std::istream& is, uint64_t& size, uint64_t item_size) {
+  read_pod(is, size);
+  if(is && !fits(is, size, item_size))
+    is.setstate(std::ios::failbit);
+  if(!is)
+    size = 0;
+}
+
+void write_string(std::ostream& os, const std::string& value) {
+  write_pod(os, (uint64_t)value.size());
+  os.write(value.data(), value.size());
+}
+
+void read_string(std::istream& is, std::string& value) {
+  uint64_t size = 0;
+  read_size(is, size, 1);
+  value.resize(size);
+  is.read(value.data(), value.size());
+}
+
+void write_strings(std::ostream& os, const std::vector<std::string>& values) {
+  write_pod(os, (uint64_t)values.size());
+  for(const auto& value : values)
+    write_string(os, value);
+}
+
+void read_strings(std::istream& is, std::vector<std::string>& values) {
+  uint64_t size = 0;
+  read_size(is, size, sizeof(uint64_t));
+  values.resize(size);
+  for(auto& value : values)
+    read_string(is, value);
+}
+
+void write_matrix(std::ostream& os, const Eigen::MatrixXf& matrix) {
+  write_pod(os, (uint64_t)matrix.rows());
+  write_pod(os, (uint64_t)matrix.cols());
+  os.write(reinterpret_cast<const char*>(matrix.data()),
+           matrix.size() * sizeof(float));
+}
+
+void read_matrix(std::istream& is, Eigen::MatrixXf& matrix) {
+  uint64_t rows = 0, cols = 0;
+  read_pod(is, rows);
+  read_size(is, cols, sizeof(float));
+  if(is && cols != 0 && !fits(is, rows, cols * sizeof(float)))
+    is.setstate(std::ios::failbit);
+  matrix.resize(is ? rows : 0, is ? cols : 0);
+  is.read(reinterpret_cast<char*>(matrix.data()),
+          matrix.size() * sizeof(float));
+}
+
+void write_inverse(std::ostream& os, const InverseAllowedSubstrings& inverse) {
+  write_pod(os, (uint64_t)inverse.size());
+  for(const auto& words : inverse) {
+    write_pod(os, (uint64_t)words.size());
+    for(const auto& [word, weight] : words) {
+      write_pod(os, (int32_t)word);
+      write_pod(os, weight);
+    }
+  }
+}
+
+void read_inverse(std::istream& is, InverseAllowedSubstrings& inverse) {
+  uint64_t size = 0;
+  read_size(is, size, sizeof(uint64_t));
+  inverse.assign(size, {});
+  for(auto& words : inverse) {
+    uint64_t count = 0;
+    read_size(is, count, sizeof(int32_t) + sizeof(float));
+    words.resize(count);
+    for(auto& [word, weight] : words) {
+      int32_t index;
+      read_pod(is, index);
+      read_pod(is, weight);
+      word = index;
+    }
+  }
+}
+
+// Opens `path` and checks its magic and version.
+std::ifstream open_checkpoint(const fs::path& path, const char* magic) {
+  std::ifstream is(path, std::ios::binary);
+  char file_magic[8];
+  uint32_t version = 0;
+  is.read(file_magic, sizeof(file_magic));
+  read_pod(is, version);
+  if(!is || std::memcmp(file_magic, magic, sizeof(file_magic)) != 0
+     || version != checkpoint_version)
+    throw std::runtime_error("Cannot read checkpoint " + path.string());
+  return is;
+}
+
+// Writes a file by `write` under a temporary name and renames it to `path`.
+template<typename Writer>
+void write_atomically(const fs::path& path, const char* magic, Writer write) {
+  fs::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream os(tmp_path, std::ios::binary);
+    os.write(magic, 8);
+    write_pod(os, checkpoint_version);
+    write(os);
+    os.flush();
+    if(!os)
+      throw std::runtime_error("Cannot write checkpoint " + path.string());
+  }
+  fs::rename(tmp_path, path);
+}
+
+}  // namespace
+
+InverseAllowedSubstrings invert_allowed_substrings(
+    const AllowedSubstrings& allowed_substrings,
+    const Vocab& word_vocab,
+    const Vocab& subword_vocab) {
+
+  // subword vocabulary indices of the subwords in the index
+  std::vector<int> subword_indices(allowed_substrings.subword_count());
+  for(int id = 0; id < allowed_substrings.subword_count(); ++id) {
+    std::string subword(allowed_substrings.subword(id));
+    subword_indices[id] =
+        subword_vocab.contains(subword) ? subword_vocab[subword] : -1;
+  }
+
+  InverseAllowedSubstrings a_sub_inv(subword_vocab.size());
+  for(int word_id = 0; word_id < allowed_substrings.word_count(); ++word_id) {
+    std::string word(allowed_substrings.word(word_id));
+    if(!word_vocab.contains(word))
+      continue;
+
+    int word_index = word_vocab[word];
+    for(const auto& entry : allowed_substrings.substrings(word_id)) {
+      int subword_index = subword_indices[entry.subword];
+      if(subword_index != -1)
+        a_sub_inv[subword_index].push_back({word_index, entry.weight});
+    }
+  }
+
+  return a_sub_inv;
+}
+
+
+void word_subword_cooccurrences(
+    Eigen::MatrixXf& c_sub,
+    const std::vector<int>& subwords,
+    const InverseAllowedSubstrings& a_sub_inv,
+    const std::vector<std::unordered_map<int, int>>& sparse_c_v) {
+
+  // every row is summed by a single thread in the same order, so the sums do
+  // not depend on the number of threads
+#pragma omp parallel for
+  for(int i = 0; i < subwords.size(); ++i) {
+    for(const auto& [word_index, weight] : a_sub_inv[subwords[i]]) {
+      for(auto cooccurs : sparse_c_v.at(word_index)) {
+        int num = cooccurs.second;
+        int j = cooccurs.first;
+
+        c_sub(i, j) += num * weight;
+      }
+    }
+  }
+}
+
+
+void deterministic_product(Eigen::MatrixXf& result,
+                           const Eigen::MatrixXf& lhs,
+                           const Eigen::MatrixXf& rhs) {
+  const int block_rows = 64;
+  result.resize(lhs.rows(), rhs.cols());
+
+  // Eigen does not parallelize the products inside a parallel region
+#pragma omp parallel for schedule(dynamic)
+  for(int begin = 0; begin < lhs.rows(); begin += block_rows) {
+    int rows = std::min<int>(block_rows, lhs.rows() - begin);
+    result.middleRows(begin, rows).noalias() =
+        lhs.middleRows(begin, rows) * rhs;
+  }
+}
+
+
+void word_candidates(
+    std::vector<std::vector<int>>& candidates,
+    const Vocab& word_vocab,
+    const Vocab& subword_vocab) {
+
+  candidates.assign(word_vocab.size(), {});
+
+#pragma omp parallel for
+  for(int i = 0; i < word_vocab.size(); ++i) {
+    const std::string& word = word_vocab[i];
+    std::vector<int> boundaries;
+    utf8_boundaries(boundaries, word);
+
+    for(size_t begin = 0; begin + 1 < boundaries.size(); ++begin) {
+      for(size_t end = begin + 1; end < boundaries.size(); ++end) {
+        std::string subword = word.substr(
+            boundaries[begin], boundaries[end] - boundaries[begin]);
+        if(subword_vocab.contains(subword))
+          candidates[i].push_back(subword_vocab[subword]);
+      }
+    }
+  }
+}
+
+
+void sparse_cooccurrences(
+    std::vector<std::unordered_map<int, int>>& sparse_c_v,
+    std::vector<int>& word_frequencies,
+    const Embeddings& word_vocab,
+    const std::string& train_data,
+    int window_size,
+    bool pretokenize_input,
+    bool compute_pseudoinverse_w,
+    Eigen::MatrixXf& pinv) {
+
+  CooccurrenceMatrix c_v = CooccurrenceMatrix::Zero(word_vocab.size(),
+                                                    word_vocab.size());
+
+  // --> this thing takes too long after traverse through data
+  {
+    ScopedTimer timer("cooccurrence counting");
+    populate_word_stats<CooccurrenceMatrix>(
+        c_v, word_frequencies, word_vocab, train_data, window_size,
+        pretokenize_input);
+  }
+
+  std::cerr << "Done, here are some stats:" << std::endl;
+  std::cerr << c_v.topLeftCorner<5,5>() << std::endl;
+
+  std::cerr << "Converting to sparse structure" << std::endl;
+
+  long nonzeros = 0;
+  {
+    ScopedTimer timer("sparse conversion");
+#pragma omp parallel for reduction(+:nonzeros)
+    for(int i = 0; i < word_vocab.size(); ++i) {
+      std::vector<std::pair<int, int>> row_pairs;
+      for(int j = 0; j < word_vocab.size(); ++j) {
+        int freq = c_v(i, j);
+        if(freq > 0) {
+          row_pairs.push_back({j, freq});
+        }
+      }
+
+      nonzeros += row_pairs.size();
+
+#pragma omp critical
+      sparse_c_v[i] = std::unordered_map<int, int>(
+          row_pairs.begin(), row_pairs.end());
+    }
+  }
+  profiler().count("cooccurrence_nonzeros", nonzeros);
+
+  if(compute_pseudoinverse_w)
+    cooccurrence_pseudoinverse(pinv, c_v, word_vocab);
+}
+
+
+void cooccurrence_pseudoinverse(
+    Eigen::MatrixXf& pinv,
+    CooccurrenceMatrix& c_v,
+    const Embeddings& word_vocab) {
+  ScopedTimer timer("pinv");
+  std::cerr << "Computing pseudoinverse of W from embeddings and word counts"
+            << std::endl;
+  // c_v dim: [V,V]
+
+  // smooth:
+  c_v.array() += 0.00001f;
+  // smooth, log & norm:
+  Eigen::VectorXf sums = c_v.rowwise().sum();
+  Eigen::MatrixXf normed = c_v.array().log().matrix().colwise()
+                           - sums.array().log().matrix();
+
+  // exact inverse (still the same dim)
+  normed = normed.inverse();
+
+  // matmul with embeddings (emb dim [V,E], product dim [V,E])
+  pinv = normed * word_vocab.emb;
+}
+
+
+void save_cooccurrences(
+    const fs::path& path,
+    const std::vector<std::unordered_map<int, int>>& sparse_c_v,
+    const std::vector<int>& word_frequencies,
+    const Eigen::MatrixXf* pinv) {
+  write_atomically(path, cooccurrences_magic, [&](std::ostream& os) {
+    write_pod(os, (uint64_t)sparse_c_v.size());
+    for(int i = 0; i < sparse_c_v.size(); ++i) {
+      write_pod(os, (int32_t)word_frequencies[i]);
+      write_pod(os, (uint64_t)sparse_c_v[i].size());
+      for(const auto& [j, count] : sparse_c_v[i]) {
+        write_pod(os, (int32_t)j);
+        write_pod(os, (int32_t)count);
+      }
+    }
+
+    write_pod(os, (uint8_t)(pinv != nullptr));
+    if(pinv != nullptr)
+      write_matrix(os, *pinv);
+  });
+}
+
+
+void load_cooccurrences(
+    const fs::path& path,
+    std::vector<std::unordered_map<int, int>>& sparse_c_v,
+    std::vector<int>& word_frequencies,
+    Eigen::MatrixXf* pinv) {
+  std::ifstream is = open_checkpoint(path, cooccurrences_magic);
+
+  uint64_t word_count = 0;
+  read_pod(is, word_count);
+  if(word_count != sparse_c_v.size())
+    throw std::runtime_error("Checkpoint " + path.string()
+                             + " is for another word vocabulary");
+
+  for(int i = 0; i < word_count && is; ++i) {
+    int32_t frequency;
+    uint64_t size = 0;
+    read_pod(is, frequency);
+    read_size(is, size, 2 * sizeof(int32_t));
+    word_frequencies[i] = frequency;
+
+    sparse_c_v[i].clear();
+    sparse_c_v[i].reserve(size);
+    for(uint64_t k = 0; k < size && is; ++k) {
+      int32_t j, count;
+      read_pod(is, j);
+      read_pod(is, count);
+      sparse_c_v[i].insert({j, count});
+    }
+  }
+
+  uint8_t has_pinv = 0;
+  read_pod(is, has_pinv);
+  if(pinv != nullptr) {
+    if(!has_pinv)
+      throw std::runtime_error("Checkpoint " + path.string()
+                               + " contains no pseudo-inverse");
+    read_matrix(is, *pinv);
+  }
+
+  if(!is)
+    throw std::runtime_error("Cannot read checkpoint " + path.string());
+}
+
+
+void save_training_checkpoint(
+    const fs::path& path,
+    const Vocab& subword_vocab,
+    const InverseAllowedSubstrings& a_sub_inv,
+    const IncrementalState* incremental,
+    const std::vector<std::vector<std::string>>& word_segmentations) {
+  write_atomically(path, checkpoint_magic, [&](std::ostream& os) {
+    write_strings(os, subword_vocab.index_to_word);
+    write_inverse(os, a_sub_inv);
+
+    write_pod(os, (uint8_t)(incremental != nullptr));
+    if(incremental == nullptr)
+      return;
+
+    write_inverse(os, incremental->computed_words);
+    write_matrix(os, incremental->computed_embeddings);
+    write_matrix(os, incremental->segmented_embeddings);
+    write_pod(os, (uint64_t)incremental->changed.size());
+    os.write(incremental->changed.data(), incremental->changed.size());
+    write_pod(os, (uint64_t)word_segmentations.size());
+    for(const auto& segmentation : word_segmentations)
+      write_strings(os, segmentation);
+  });
+}
+
+
+void load_training_checkpoint(
+    const fs::path& path,
+    Vocab& subword_vocab,
+    InverseAllowedSubstrings& a_sub_inv,
+    IncrementalState* incremental,
+    std::vector<std::vector<std::string>>& word_segmentations) {
+  std::ifstream is = open_checkpoint(path, checkpoint_magic);
+
+  std::vector<std::string> subwords;
+  read_strings(is, subwords);
+  subword_vocab = Vocab();
+  subword_vocab.insert(subwords);
+  read_inverse(is, a_sub_inv);
+
+  uint8_t has_incremental = 0;
+  read_pod(is, has_incremental);
+  if(is && has_incremental != (incremental != nullptr))
+    throw std::runtime_error(
+        "Checkpoint " + path.string() + " was written "
+        + (has_incremental ? "with" : "without") + " incremental training");
+
+  if(incremental != nullptr) {
+    read_inverse(is, incremental->computed_words);
+    read_matrix(is, incremental->computed_embeddings);
+    read_matrix(is, incremental->segmented_embeddings);
+    uint64_t size = 0;
+    read_size(is, size, 1);
+    incremental->changed.resize(size);
+    is.read(incremental->changed.data(), incremental->changed.size());
+    read_size(is, size, sizeof(uint64_t));
+    word_segmentations.resize(size);
+    for(auto& segmentation : word_segmentations)
+      read_strings(is, segmentation);
+  }
+
+  if(!is)
+    throw std::runtime_error("Cannot read checkpoint " + path.string());
+}
+
+
+void write_embeddings(std::ostream& os, const Eigen::MatrixXf& embeddings) {
+  os << embeddings << '\n';
+}
+
+
+void write_lines(std::ostream& os, const std::vector<std::string>& lines) {
+  for(const auto& line : lines)
+    os << line << '\n';
+}
+
+
+void write_unigram_stats(std::ostream& os,
+                         const std::vector<std::string>& subwords,
+                         const std::vector<int>& unigram_freqs) {
+  for(int i = 0; i < subwords.size(); ++i)
+    os << subwords[i] << '\t' << unigram_freqs[i] << '\n';
+}
+
+
+void write_bigram_stats(
+    std::ostream& os,
+    const std::vector<std::string>& subwords,
+    const std::vector<std::unordered_map<std::string, int>>& bigram_freqs,
+    bool sorted) {
+  for(int i = 0; i < subwords.size(); ++i) {
+    if(!sorted) {
+      for(const auto& pair : bigram_freqs[i])
+        os << subwords[i] << '\t' << pair.first << '\t' << pair.second << '\n';
+      continue;
+    }
+
+    std::vector<std::pair<std::string, int>> successors(
+        bigram_freqs[i].begin(), bigram_freqs[i].end());
+    std::sort(successors.begin(), successors.end());
+    for(const auto& pair : successors)
+      os << subwords[i] << '\t' << pair.first << '\t' << pair.second << '\n';
+  }
+}
+
+
+void save_embedding_checkpoint(
+    const fs::path& path,
+    const Eigen::MatrixXf& embeddings) {
+  std::ofstream ofs(path);
+  write_embeddings(ofs, embeddings);
+}
+
+
+void load_embedding_checkpoint(const fs::path& path,
+                               Eigen::MatrixXf& embeddings) {
+  std::ifstream ifs(path);
+  if(!ifs)
+    throw std::runtime_error("Cannot read embeddings from " + path.string());
+
+  std::vector<float> values;
+  long rows = 0, cols = -1;
+  for(std::string line; std::getline(ifs, line);) {
+    size_t before = values.size();
+    const char* begin = line.c_str();
+    for(char* end; ; begin = end) {
+      float value = std::strtof(begin, &end);
+      if(end == begin)
+        break;
+      values.push_back(value);
+    }
+    long count = values.size() - before;
+    if(count == 0)
+      continue;
+    if(cols != -1 && count != cols)
+      throw std::runtime_error(
+          "Embeddings " + path.string() + " have rows of different sizes");
+    cols = count;
+    ++rows;
+  }
+
+  embeddings.resize(rows, std::max(cols, 0L));
+  for(long i = 0; i < rows; ++i)
+    for(long j = 0; j < cols; ++j)
+      embeddings(i, j) = values[i * cols + j];
+}
+
+
+void save_strings(const fs::path& path,
+                  const std::vector<std::string>& segments) {
+  std::ofstream ofs(path);
+  write_lines(ofs, segments);
+}
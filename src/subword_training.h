@@ -0,0 +1,177 @@
+#ifndef SSEG_SUBWORD_TRAINING_H_
+#define SSEG_SUBWORD_TRAINING_H_
+
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "allowed_substrings.h"
+#include "vocabs.h"
+#include "substring_stats.h"
+
+// The words (indices to the word vocabulary) with their weights for each
+// subword of the subword vocabulary, i.e., the transposed allowed substrings.
+typedef std::vector<std::vector<std::pair<int, float>>> InverseAllowedSubstrings;
+
+// Transposes `allowed_substrings` to the subwords of `subword_vocab`,
+// skipping the words outside of `word_vocab`.
+InverseAllowedSubstrings invert_allowed_substrings(
+    const AllowedSubstrings& allowed_substrings,
+    const Vocab& word_vocab,
+    const Vocab& subword_vocab);
+
+// Fills `c_sub` with word-subword cooccurrences, given word cooccurrences in
+// `sparse_c_v`. Row r of `c_sub` belongs to subword `subwords[r]` and only
+// considers its words in `a_sub_inv` (aka. allowed substrings)
+void word_subword_cooccurrences(
+    Eigen::MatrixXf& c_sub,
+    const std::vector<int>& subwords,
+    const InverseAllowedSubstrings& a_sub_inv,
+    const std::vector<std::unordered_map<int, int>>& sparse_c_v);
+
+// Computes `lhs * rhs` in fixed blocks of rows, each by a single thread, so
+// that unlike the Eigen product the result does not depend on the number of
+// threads.
+void deterministic_product(Eigen::MatrixXf& result,
+                           const Eigen::MatrixXf& lhs,
+                           const Eigen::MatrixXf& rhs);
+
+// Fills `candidates` with the subwords (indices to `subword_vocab`) that are
+// substrings of each word on code point boundaries, i.e., the subwords that
+// viterbi_decode considers for the word.
+void word_candidates(
+    std::vector<std::vector<int>>& candidates,
+    const Vocab& word_vocab,
+    const Vocab& subword_vocab);
+
+
+// Populates a dense structure of cooccurrences of `word_vocab` vocabulary
+// items in `train_data` within a window of size `window_size`.
+//
+// Converts the dense structure to sparse representation `sparse_c_v` to save
+// memory.
+//
+// Saves unigram frequencies in `word_frequencies`.
+//
+// With `pretokenize_input`, the lines of `train_data` are split using the
+// native pretokenizer instead of on whitespace.
+//
+// Optionally, when `compute_pseudoinverse_w` is specified, it computes the
+// pseudo-inverse of the log cooccurrence matrix and stores it in `pinv`.
+// This is done here because the dense structure is needed.
+void sparse_cooccurrences(
+    std::vector<std::unordered_map<int, int>>& sparse_c_v,
+    std::vector<int>& word_frequencies,
+    const Embeddings& word_vocab,
+    const std::string& train_data,
+    int window_size,
+    bool pretokenize_input,
+    bool compute_pseudoinverse_w,
+    Eigen::MatrixXf& pinv);
+
+// Computes the pseudo-inverse of the log cooccurrence matrix `c_v` (which
+// is smoothed in place) multiplied by the word embeddings into `pinv`.
+void cooccurrence_pseudoinverse(
+    Eigen::MatrixXf& pinv,
+    CooccurrenceMatrix& c_v,
+    const Embeddings& word_vocab);
+
+
+// State carried between incremental epochs (legros-train --incremental), per
+// subword of the initial vocabulary: the last computed embedding with the
+// words it was computed from, the embedding at the last segmentation of its
+// words and whether it changed since then.
+struct IncrementalState {
+  InverseAllowedSubstrings computed_words;
+  Eigen::MatrixXf computed_embeddings;
+  Eigen::MatrixXf segmented_embeddings;
+  std::vector<char> changed;
+};
+
+
+// Saves the word cooccurrences and word frequencies, and the pseudo-inverse
+// unless it is nullptr, so that a resumed training skips counting them.
+void save_cooccurrences(
+    const std::filesystem::path& path,
+    const std::vector<std::unordered_map<int, int>>& sparse_c_v,
+    const std::vector<int>& word_frequencies,
+    const Eigen::MatrixXf* pinv);
+
+// Loads what save_cooccurrences wrote, the pseudo-inverse only when `pinv`
+// is not nullptr. Throws std::runtime_error when the file is missing, does
+// not match the word count or does not contain a requested pseudo-inverse.
+void load_cooccurrences(
+    const std::filesystem::path& path,
+    std::vector<std::unordered_map<int, int>>& sparse_c_v,
+    std::vector<int>& word_frequencies,
+    Eigen::MatrixXf* pinv);
+
+
+// Saves the state of the training at the beginning of an epoch: the subword
+// vocabulary and the inverse allowed substrings, and for incremental
+// training also its state and the segmentations of the words. The file is
+// written under a temporary name and renamed, so a crash never leaves a
+// partial checkpoint behind.
+void save_training_checkpoint(
+    const std::filesystem::path& path,
+    const Vocab& subword_vocab,
+    const InverseAllowedSubstrings& a_sub_inv,
+    const IncrementalState* incremental,
+    const std::vector<std::vector<std::string>>& word_segmentations);
+
+// Loads what save_training_checkpoint wrote, the incremental state exactly
+// when `incremental` is not nullptr. Throws std::runtime_error when the file
+// cannot be read or was written with or without incremental training
+// differently.
+void load_training_checkpoint(
+    const std::filesystem::path& path,
+    Vocab& subword_vocab,
+    InverseAllowedSubstrings& a_sub_inv,
+    IncrementalState* incremental,
+    std::vector<std::vector<std::string>>& word_segmentations);
+
+
+// Writes the rows of `embeddings` as lines of space-separated numbers.
+void write_embeddings(std::ostream& os, const Eigen::MatrixXf& embeddings);
+
+// Writes `lines`, each terminated by a newline.
+void write_lines(std::ostream& os, const std::vector<std::string>& lines);
+
+// Writes the unigram statistics of an epoch, a subword and its frequency
+// per line, and the bigram statistics, a previous subword, a subword and
+// their frequency per line; `unigram_freqs` and `bigram_freqs` are indexed
+// by the positions in `subwords`. With `sorted`, the bigrams of a previous
+// subword are written ordered by the subword instead of in the hash order.
+void write_unigram_stats(std::ostream& os,
+                         const std::vector<std::string>& subwords,
+                         const std::vector<int>& unigram_freqs);
+void write_bigram_stats(
+    std::ostream& os,
+    const std::vector<std::string>& subwords,
+    const std::vector<std::unordered_map<std::string, int>>& bigram_freqs,
+    bool sorted = false);
+
+
+// Saves an Eigen matrix `embeddings` into a file specified by `path`.
+void save_embedding_checkpoint(
+    const std::filesystem::path& path,
+    const Eigen::MatrixXf& embeddings);
+
+
+// Loads embeddings saved by save_embedding_checkpoint (subword_embeddings.N).
+// Throws std::runtime_error when the file cannot be read or its rows differ
+// in size.
+void load_embedding_checkpoint(
+    const std::filesystem::path& path,
+    Eigen::MatrixXf& embeddings);
+
+
+// Saves `segments`, a vector of lines, a file specified by `path`.
+void save_strings(const std::filesystem::path& path,
+                  const std::vector<std::string>& segments);
+
+#endif  // SSEG_SUBWORD_TRAINING_H_
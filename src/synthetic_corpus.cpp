@@ -0,0 +1,210 @@
+#include "synthetic_corpus.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <unordered_set>
+
+#include "substring_stats.h"
+#include "vocabs.h"
+
+namespace fs = std::filesystem;
+
+
+uint64_t SplitMix64::next() {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+
+float SplitMix64::normal() {
+  double u1 = 1.0 - uniform();  // in (0, 1]
+  double u2 = uniform();
+  return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+
+ZipfSampler::ZipfSampler(int n, double exponent) : cdf(n) {
+  double sum = 0;
+  for(int rank = 0; rank < n; ++rank) {
+    sum += 1.0 / std::pow(rank + 1, exponent);
+    cdf[rank] = sum;
+  }
+  for(auto& value : cdf)
+    value /= sum;
+}
+
+
+int ZipfSampler::sample(SplitMix64& rng) const {
+  double u = rng.uniform();
+  int rank = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+  return std::min(rank, (int)cdf.size() - 1);
+}
+
+
+void generate_synthetic_data(SyntheticData& data,
+                             const SyntheticOptions& options) {
+  SplitMix64 rng(options.seed);
+
+  // syllable inventory, the non-ASCII vowels make some multi-byte code points
+  const std::vector<std::string> onsets = {
+    "", "b", "k", "d", "l", "m", "n", "p", "r", "s", "t", "v", "z", "st",
+    "tr", "ch"};
+  const std::vector<std::string> vowels = {
+    "a", "e", "i", "o", "u", "y", "á", "é", "ů"};
+  const std::vector<std::string> codas = {"", "n", "s", "r", "k"};
+
+  std::vector<std::string> syllables;
+  for(const auto& onset : onsets)
+    for(const auto& vowel : vowels)
+      for(const auto& coda : codas)
+        syllables.push_back(onset + vowel + coda);
+
+  // words as sequences of Zipf-distributed syllables
+  ZipfSampler syllable_sampler(syllables.size(), 1.0);
+  std::unordered_set<std::string> seen;
+  std::vector<std::vector<int>> word_syllables;
+  while(data.words.size() < options.word_count) {
+    int length = 1 + rng.below(4);
+    std::vector<int> parts;
+    std::string word;
+    for(int i = 0; i < length; ++i) {
+      parts.push_back(syllable_sampler.sample(rng));
+      word += syllables[parts.back()];
+    }
+    if(!seen.insert(word).second)
+      continue;
+    data.words.push_back(word);
+    word_syllables.push_back(parts);
+  }
+
+  // sentences of Zipf-distributed words
+  ZipfSampler word_sampler(options.word_count, options.zipf_exponent);
+  data.word_frequencies.assign(options.word_count, 0);
+  data.corpus.clear();
+  for(int line = 0; line < options.line_count; ++line) {
+    int length = options.min_line_length
+        + rng.below(options.max_line_length - options.min_line_length + 1);
+    std::string text;
+    for(int i = 0; i < length; ++i) {
+      int word = word_sampler.sample(rng);
+      data.word_frequencies[word]++;
+      if(i > 0)
+        text += ' ';
+      text += data.words[word];
+    }
+    data.corpus.push_back(text);
+  }
+
+  // subwords: the used syllables and the most frequent multi-syllable words
+  data.subwords = {bow, eow};
+  std::unordered_set<std::string> subword_set(data.subwords.begin(),
+                                               data.subwords.end());
+  for(const auto& parts : word_syllables)
+    for(int syllable : parts)
+      if(subword_set.insert(syllables[syllable]).second)
+        data.subwords.push_back(syllables[syllable]);
+  for(int word = 0; word < options.word_count / 10; ++word)
+    if(subword_set.insert(data.words[word]).second)
+      data.subwords.push_back(data.words[word]);
+
+  // unigram and bigram counts from the reference segmentation
+  data.unigrams.clear();
+  data.bigrams.clear();
+  for(const auto& subword : data.subwords)
+    data.unigrams[subword] = 0;
+  for(int word = 0; word < options.word_count; ++word) {
+    int frequency = data.word_frequencies[word];
+    std::vector<std::string> segmentation;
+    if(subword_set.count(data.words[word]))
+      segmentation.push_back(data.words[word]);
+    else
+      for(int syllable : word_syllables[word])
+        segmentation.push_back(syllables[syllable]);
+
+    std::string prev = bow;
+    data.unigrams[bow] += frequency;
+    for(const auto& subword : segmentation) {
+      data.unigrams[subword] += frequency;
+      if(frequency > 0)
+        data.bigrams[prev][subword] += frequency;
+      prev = subword;
+    }
+  }
+  data.unigram_count = 0;
+  for(const auto& unigram : data.unigrams)
+    data.unigram_count += unigram.second;
+
+  Vocab subword_vocab;
+  subword_vocab.insert(data.subwords);
+  data.allowed_substrings.assign(options.word_count, {});
+  for(int word = 0; word < options.word_count; ++word) {
+    std::vector<std::pair<std::string, float>> substrings;
+    get_all_substrings(substrings, subword_vocab, data.words[word], 100);
+    for(const auto& substring : substrings)
+      data.allowed_substrings[word].push_back(substring.first);
+  }
+
+  data.word_embeddings.resize(options.word_count, options.embedding_dim);
+  for(int i = 0; i < data.word_embeddings.rows(); ++i)
+    for(int j = 0; j < options.embedding_dim; ++j)
+      data.word_embeddings(i, j) = rng.normal();
+
+  data.subword_embeddings.resize(data.subwords.size(), options.embedding_dim);
+  for(int i = 0; i < data.subword_embeddings.rows(); ++i)
+    for(int j = 0; j < options.embedding_dim; ++j)
+      data.subword_embeddings(i, j) = rng.normal();
+}
+
+
+void write_synthetic_data(const SyntheticData& data,
+                          const std::string& directory) {
+  fs::path dir(directory);
+  fs::create_directories(dir);
+
+  std::ofstream corpus(dir / "corpus.txt");
+  for(const auto& line : data.corpus)
+    corpus << line << '\n';
+
+  std::ofstream words(dir / "words.txt");
+  for(const auto& word : data.words)
+    words << word << '\n';
+
+  std::ofstream embeddings(dir / "embeddings.txt");
+  embeddings << data.word_embeddings.rows() << " "
+             << data.word_embeddings.cols() << '\n';
+  for(int i = 0; i < data.word_embeddings.rows(); ++i) {
+    embeddings << data.words[i];
+    for(int j = 0; j < data.word_embeddings.cols(); ++j)
+      embeddings << " " << data.word_embeddings(i, j);
+    embeddings << '\n';
+  }
+
+  std::ofstream allowed(dir / "allowed_substrings.txt");
+  for(int i = 0; i < data.words.size(); ++i) {
+    allowed << data.words[i];
+    for(const auto& substring : data.allowed_substrings[i])
+      allowed << " " << substring;
+    allowed << '\n';
+  }
+
+  std::ofstream subwords(dir / "subwords.txt");
+  std::ofstream unigrams(dir / "unigram_stats.txt");
+  std::ofstream bigrams(dir / "bigram_stats.txt");
+  for(const auto& subword : data.subwords) {
+    subwords << subword << '\n';
+    unigrams << subword << "\t" << data.unigrams.at(subword) << '\n';
+
+    if(data.bigrams.count(subword) == 0)
+      continue;
+    // sorted, so that the files are identical for identical data
+    std::map<std::string, int> next(data.bigrams.at(subword).begin(),
+                                    data.bigrams.at(subword).end());
+    for(const auto& pair : next)
+      bigrams << subword << "\t" << pair.first << "\t" << pair.second << '\n';
+  }
+}
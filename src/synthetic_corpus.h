@@ -0,0 +1,90 @@
+#ifndef SSEG_SYNTHETIC_CORPUS_H_
+#define SSEG_SYNTHETIC_CORPUS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "bigram_model.h"
+
+// SplitMix64 pseudo-random generator. Unlike the std distributions, its
+// output does not depend on the platform or standard library, which keeps
+// the synthetic data identical across machines.
+class SplitMix64 {
+ public:
+  explicit SplitMix64(uint64_t seed) : state(seed) {}
+
+  uint64_t next();
+
+  // Uniform in [0, 1).
+  double uniform() { return (next() >> 11) * 0x1.0p-53; }
+
+  // Uniform integer in [0, n).
+  int below(int n) { return (int)(uniform() * n); }
+
+  // Standard normal variable (Box-Muller).
+  float normal();
+
+ private:
+  uint64_t state;
+};
+
+
+// Samples ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s.
+class ZipfSampler {
+ public:
+  ZipfSampler(int n, double exponent);
+  int sample(SplitMix64& rng) const;
+
+ private:
+  std::vector<double> cdf;
+};
+
+
+struct SyntheticOptions {
+  uint64_t seed = 42;
+  int word_count = 2000;
+  int line_count = 20000;
+  int min_line_length = 5;
+  int max_line_length = 25;
+  double zipf_exponent = 1.1;
+  int embedding_dim = 64;
+};
+
+
+// A synthetic corpus with a matching word vocabulary, subword vocabulary,
+// bigram model and random embeddings.
+//
+// Words are concatenations of syllables (a few of them non-ASCII, to exercise
+// the UTF-8 code paths), sentences are sampled from a Zipfian distribution
+// over the words. The subword vocabulary consists of all syllables and the
+// most frequent whole words; the unigram and bigram counts come from the
+// corresponding reference segmentation of the corpus.
+struct SyntheticData {
+  std::vector<std::string> words;  // by frequency rank
+  std::vector<int> word_frequencies;
+  std::vector<std::string> corpus;  // lines of space-separated words
+  std::vector<std::string> subwords;  // starts with bow and eow
+  std::vector<std::vector<std::string>> allowed_substrings;  // per word
+
+  unigram_table unigrams;
+  bigram_table bigrams;
+  int unigram_count = 0;
+
+  Eigen::MatrixXf word_embeddings;
+  Eigen::MatrixXf subword_embeddings;
+};
+
+void generate_synthetic_data(SyntheticData& data,
+                             const SyntheticOptions& options);
+
+// Writes the data in the formats of the legros tools into `directory`:
+// corpus.txt, words.txt, embeddings.txt (word2vec text format),
+// allowed_substrings.txt, subwords.txt, unigram_stats.txt and
+// bigram_stats.txt.
+void write_synthetic_data(const SyntheticData& data,
+                          const std::string& directory);
+
+#endif  // SSEG_SYNTHETIC_CORPUS_H_
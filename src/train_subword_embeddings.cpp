@@ -11,10 +11,12 @@
  * Output file (will contain the trained subword embeddings)
  */
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <ranges>
 #include <filesystem>
+#include <memory>
 
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
@@ -23,6 +25,10 @@
 #include "vocabs.h"
 #include "substring_stats.h"
 #include "cosine_viterbi.h"
+#include "subword_training.h"
+#include "instrumentation.h"
+#include "async_writer.h"
+#include "word_counts.h"
 
 namespace fs = std::filesystem;
 
@@ -33,6 +39,7 @@ struct opt {
 
   std::string output;
   std::string train_data;
+  std::string word_counts;
 
   std::string output_directory = ".";
   std::string segmentations_prefix = "segmentations.";
@@ -40,10 +47,25 @@ struct opt {
   std::string subwords_prefix = "subwords.";
   std::string unigrams_prefix = "unigram_stats.";
   std::string bigrams_prefix = "bigram_stats.";
+  std::string checkpoint_prefix = "checkpoint.";
+  std::string cooccurrences_file = "cooccurrences.bin";
+
+  std::string report_file;
+  std::string trace_file;
 
   int fasttext_dim = 200;
   int window_size = 3;
   int epochs = 1;
+  bool pretokenize = false;
+
+  bool incremental = false;
+  float incremental_threshold = 0;
+
+  bool checkpoint = false;
+  int resume_from_epoch = 0;
+
+  int output_memory_mb = 1024;
+  bool deterministic = false;
 } opt;
 
 void get_options(CLI::App& app) {
@@ -53,8 +75,14 @@ void get_options(CLI::App& app) {
       ->check(CLI::ExistingFile);
 
   app.add_option(
-      "train_data", opt.train_data, "Training data for cooccurrence matrix.")
-      ->required()
+      "train_data", opt.train_data,
+      "Training data for cooccurrence matrix (not needed with --word-counts).")
+      ->check(CLI::ExistingFile);
+
+  app.add_option(
+      "--word-counts", opt.word_counts,
+      "Word cooccurrences counted by legros-count and merged by legros-merge, "
+      "used instead of counting them in the training data.")
       ->check(CLI::ExistingFile);
 
   app.add_option(
@@ -77,6 +105,25 @@ void get_options(CLI::App& app) {
   app.add_option(
       "--window-size", opt.window_size, "Window size.");
 
+  app.add_flag(
+      "--pretokenize", opt.pretokenize,
+      "Pretokenize the training data (as legros.pretokenize) instead of "
+      "splitting it on whitespace.");
+
+  app.add_flag(
+      "--incremental", opt.incremental,
+      "After the first epoch, recompute only the embeddings of subwords "
+      "whose words changed and segment again only the words with a "
+      "candidate subword that was removed or whose embedding moved.");
+
+  app.add_option(
+      "--incremental-threshold", opt.incremental_threshold,
+      "With --incremental, an embedding moved when it changed by more than "
+      "this fraction of its norm since the words were last segmented; 0 "
+      "segments again on any change, which gives the segmentations of the "
+      "full epochs up to rounding of the embeddings.")
+      ->check(CLI::NonNegativeNumber);
+
   app.add_option(
       "--output-directory", opt.output_directory, "Output directory.");
 
@@ -99,127 +146,46 @@ void get_options(CLI::App& app) {
   app.add_option(
       "--bigram-prefix", opt.bigrams_prefix,
       "Prefix for bigram stats.");
-}
-
 
-// Fills `c_sub` with word-subword cooccurrences, given word cooccurrences in
-// `sparse_c_v`. Only considers subwords present in the `a_sub_inv` map
-// (aka. allowed substrings)
-void word_subword_cooccurrences(
-    Eigen::MatrixXf& c_sub,
-    const Embeddings& word_vocab,
-    const Vocab& subword_vocab,
-    const InverseAllowedSubstringMap& a_sub_inv,
-    const std::vector<std::unordered_map<int, int>>& sparse_c_v) {
+  app.add_flag(
+      "--checkpoint", opt.checkpoint,
+      "Save the word cooccurrences once and the training state after every "
+      "epoch to the output directory, so the training can be resumed.");
 
-#pragma omp parallel for
-  for(int i = 0; i < subword_vocab.size(); ++i) {
-
-    std::string subword = subword_vocab[i];
-    if(a_sub_inv.count(subword) == 0)
-      continue;
-
-    for(auto wordscores : a_sub_inv.at(subword)) {
-      if(!word_vocab.contains(wordscores.first))
-        continue;
-
-      for(auto cooccurs : sparse_c_v.at(word_vocab[wordscores.first])) {
-        int num = cooccurs.second;
-        int j = cooccurs.first;
-
-#pragma omp atomic
-        c_sub(i, j) += num * wordscores.second;
-      }
-    }
-  }
-}
-
-
-// Populates a dense structure of cooccurrences of `word_vocab` vocabulary
-// items in `train_data` within a window of size `window_size`.
-//
-// Converts the dense structure to sparse representation `sparse_c_v` to save
-// memory.
-//
-// Saves unigram frequencies in `word_frequencies`.
-//
-// Optionally, when `compute_pseudoinverse_w` is specified, it computes the
-// pseudo-inverse of the log cooccurrence matrix and stores it in `pinv`.
-// This is done here because the dense structure is needed.
-void sparse_cooccurrences(
-    std::vector<std::unordered_map<int, int>>& sparse_c_v,
-    std::vector<int>& word_frequencies,
-    const Embeddings& word_vocab,
-    const std::string& train_data,
-    int window_size,
-    bool compute_pseudoinverse_w,
-    Eigen::MatrixXf& pinv) {
-
-  CooccurrenceMatrix c_v(word_vocab.size(), word_vocab.size());
-
-  // --> this thing takes too long after traverse through data
-  populate_word_stats<CooccurrenceMatrix>(
-      c_v, word_frequencies, word_vocab, train_data, window_size);
-
-  std::cerr << "Done, here are some stats:" << std::endl;
-  std::cerr << c_v.topLeftCorner<5,5>() << std::endl;
-
-  std::cerr << "Converting to sparse structure" << std::endl;
-
-#pragma omp parallel for
-  for(int i = 0; i < word_vocab.size(); ++i) {
-    std::vector<std::pair<int, int>> row_pairs;
-    for(int j = 0; j < word_vocab.size(); ++j) {
-      int freq = c_v(i, j);
-      if(freq > 0) {
-        row_pairs.push_back({j, freq});
-      }
-    }
-
-#pragma omp critical
-    sparse_c_v[i] = std::unordered_map<int, int>(
-        row_pairs.begin(), row_pairs.end());
-  }
-
-  if(compute_pseudoinverse_w) {
-    std::cerr << "Computing pseudoinverse of W from embeddings and word counts"
-              << std::endl;
-    // c_v dim: [V,V]
-
-    // smooth:
-    c_v.array() += 0.00001f;
-    // smooth, log & norm:
-    Eigen::VectorXf sums = c_v.rowwise().sum();
-    Eigen::MatrixXf normed = c_v.array().log().matrix().colwise()
-                             - sums.array().log().matrix();
+  app.add_option(
+      "--resume-from-epoch", opt.resume_from_epoch,
+      "Continue from the checkpoint written after the previous epoch, with "
+      "the same results as without the interruption.")
+      ->check(CLI::NonNegativeNumber);
 
-    // exact inverse (still the same dim)
-    normed = normed.inverse();
+  app.add_option(
+      "--checkpoint-prefix", opt.checkpoint_prefix,
+      "Prefix for training state checkpoints.");
 
-    // matmul with embeddings (emb dim [V,E], product dim [V,E])
-    pinv = normed * word_vocab.emb;
-  }
-}
+  app.add_option(
+      "--cooccurrences-file", opt.cooccurrences_file,
+      "File name of the saved word cooccurrences.");
 
+  app.add_option(
+      "--output-memory", opt.output_memory_mb,
+      "Memory in MiB for the epoch outputs that wait to be written in the "
+      "background while the next epoch runs; 0 writes them synchronously.")
+      ->check(CLI::NonNegativeNumber);
 
-// Saves an Eigen matrix `embeddings` into a file specified by `path`.
-void save_embedding_checkpoint(
-    const fs::path& path,
-    const Eigen::MatrixXf& embeddings) {
-  std::ofstream ofs(path);
-  ofs << embeddings << std::endl;
-  ofs.close();
-}
+  app.add_flag(
+      "--deterministic", opt.deterministic,
+      "Compute in a fixed order and sort the bigram statistics, so the outputs "
+      "are identical for any number of threads; the pseudo-inverse is then "
+      "computed by a single thread.");
 
+  app.add_option(
+      "--report", opt.report_file,
+      "Write phase timings, memory use and counters of the setup and of each "
+      "epoch to this file as JSON lines.");
 
-// Saves `segments`, a vector of lines, a file specified by `path`.
-void save_strings(const fs::path& path,
-                  const std::vector<std::string>& segments) {
-  std::ofstream ofs(path);
-  for(auto w: segments) {
-    ofs << w << std::endl;
-  }
-  ofs.close();
+  app.add_option(
+      "--trace", opt.trace_file,
+      "Write the phase timings in the Chrome trace-event format.");
 }
 
 
@@ -228,29 +194,98 @@ int main(int argc, char* argv[]) {
   get_options(app);
   CLI11_PARSE(app, argc, argv);
 
+  if(opt.train_data.empty() && opt.word_counts.empty()) {
+    std::cerr << "Either the training data or --word-counts is required."
+              << std::endl;
+    return 1;
+  }
+
   #ifndef SSEG_RELEASE_BUILD
   std::cerr
       << "\n\033[31m!! WARNING !!\033[0m You are likely running a debug build"
       << "\nFor best results, use cmake with -DCMAKE_BUILD_TYPE=Release\n\n";
   #endif
 
+  // the blocking of the parallel Eigen products depends on the number of
+  // threads, and so do the rounding errors of their sums
+  if(opt.deterministic)
+    Eigen::setNbThreads(1);
+
+  std::ofstream report;
+  if(!opt.report_file.empty())
+    report.open(opt.report_file);
+  if(!opt.report_file.empty() || !opt.trace_file.empty())
+    profiler().start_rss_sampling();
+
   // compute word cooccurrence matrix for data C_v (dim. V x V)
   // implemented in word_cooccurrence_matrix.cpp
   std::cerr << "Loading word embeddings: " << opt.embeddings_file << std::endl;
-  Embeddings word_vocab(opt.embeddings_file);
+  Embeddings word_vocab = [] {
+    ScopedTimer timer("load embeddings");
+    return Embeddings(opt.embeddings_file);
+  }();
   int word_count = word_vocab.size();
 
+  fs::path output_dir(opt.output_directory);
+  fs::path cooccurrences_path = output_dir / fs::path(opt.cooccurrences_file);
+  bool compute_pinv = opt.fasttext_output_pseudoinverse.empty();
+
   Eigen::MatrixXf pinv(word_count, opt.fasttext_dim);
-  std::cerr << "Populating word cooccurrence stats (" << word_count
-            << " words)" << std::endl;
   std::vector<std::unordered_map<int, int>> sparse_c_v(word_count);
   std::vector<int> word_frequencies(word_count);
-  sparse_cooccurrences(
-      sparse_c_v, word_frequencies, word_vocab, opt.train_data,
-      opt.window_size, opt.fasttext_output_pseudoinverse.empty(), pinv);
+  if(opt.resume_from_epoch > 0) {
+    std::cerr << "Loading word cooccurrence stats from " << cooccurrences_path
+              << std::endl;
+    ScopedTimer timer("load cooccurrences");
+    try {
+      load_cooccurrences(cooccurrences_path, sparse_c_v, word_frequencies,
+                         compute_pinv ? &pinv : nullptr);
+    } catch(const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  } else {
+    if(!opt.word_counts.empty()) {
+      std::cerr << "Loading word cooccurrence stats from " << opt.word_counts
+                << std::endl;
+      ScopedTimer timer("load word counts");
+      try {
+        load_word_counts(opt.word_counts, word_vocab, sparse_c_v,
+                         word_frequencies);
+      } catch(const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+
+      if(compute_pinv) {
+        CooccurrenceMatrix c_v = CooccurrenceMatrix::Zero(word_count,
+                                                          word_count);
+        for(int i = 0; i < word_count; ++i) {
+          for(const auto& [j, count] : sparse_c_v[i])
+            c_v(i, j) = count;
+        }
+        cooccurrence_pseudoinverse(pinv, c_v, word_vocab);
+      }
+    } else {
+      std::cerr << "Populating word cooccurrence stats (" << word_count
+                << " words)" << std::endl;
+      sparse_cooccurrences(
+          sparse_c_v, word_frequencies, word_vocab, opt.train_data,
+          opt.window_size, opt.pretokenize, compute_pinv, pinv);
+    }
+
+    if(opt.checkpoint) {
+      std::cerr << "Saving word cooccurrence stats to " << cooccurrences_path
+                << std::endl;
+      ScopedTimer timer("save cooccurrences");
+      save_cooccurrences(cooccurrences_path, sparse_c_v, word_frequencies,
+                         compute_pinv ? &pinv : nullptr);
+    }
+  }
   std::cerr << sparse_c_v[10].size() << std::endl;
 
   if(!opt.fasttext_output_pseudoinverse.empty()) {
+    ScopedTimer timer("load pseudoinverse");
     std::cerr << "Loading pseudo-inverse of fasttext output matrix from "
               << opt.fasttext_output_pseudoinverse << std::endl;
     std::ifstream fasttext_fh(opt.fasttext_output_pseudoinverse);
@@ -270,102 +305,251 @@ int main(int argc, char* argv[]) {
   std::cerr << "Loading list of allowed substrings from "
             << opt.allowed_substrings << std::endl;
 
-  AllowedSubstringMap a_sub;
-  InverseAllowedSubstringMap a_sub_inv;
-  load_allowed_substrings(a_sub, a_sub_inv, opt.allowed_substrings);
+  AllowedSubstrings a_sub;
+  try {
+    ScopedTimer timer("load allowed substrings");
+    a_sub = AllowedSubstrings::load(opt.allowed_substrings);
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
 
   std::cerr << "Loading subword vocab." << std::endl;
-  Vocab subword_vocab(std::views::keys(a_sub_inv), true);
+  Vocab subword_vocab(
+      std::views::iota(0, a_sub.subword_count())
+      | std::views::transform([&a_sub](int id) {
+          return std::string(a_sub.subword(id));
+        }),
+      true);
   std::cerr << "Initial subword vocab size: " << subword_vocab.size()
             << std::endl;
+  InverseAllowedSubstrings a_sub_inv =
+      invert_allowed_substrings(a_sub, word_vocab, subword_vocab);
+
+  // The incremental epochs refer to the subwords of the initial vocabulary.
+  Vocab initial_subword_vocab = subword_vocab;
+  std::vector<std::vector<int>> candidates;  // initial subwords of each word
+  IncrementalState incremental;
+  if(opt.incremental) {
+    ScopedTimer timer("word candidates");
+    word_candidates(candidates, word_vocab, initial_subword_vocab);
+    incremental.computed_words.resize(initial_subword_vocab.size());
+    incremental.computed_embeddings.setZero(initial_subword_vocab.size(),
+                                            pinv.cols());
+    incremental.segmented_embeddings.setZero(initial_subword_vocab.size(),
+                                             pinv.cols());
+    incremental.changed.assign(initial_subword_vocab.size(), 0);
+  }
+  std::vector<std::vector<std::string>> word_segmentations(word_count);
+
+  if(opt.resume_from_epoch > 0) {
+    auto state_path = output_dir / fs::path(
+        opt.checkpoint_prefix + std::to_string(opt.resume_from_epoch));
+    std::cerr << "Resuming from " << state_path << std::endl;
+    ScopedTimer timer("load checkpoint");
+    try {
+      load_training_checkpoint(state_path, subword_vocab, a_sub_inv,
+                               opt.incremental ? &incremental : nullptr,
+                               word_segmentations);
+    } catch(const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
 
-  fs::path output_dir(opt.output_directory);
+  if(report.is_open())
+    profiler().write_report(report, "setup");
+
+  AsyncWriter writer((size_t)opt.output_memory_mb << 20);
 
   // ====== here the algorithm begins
-  for(int epoch = 0; epoch < opt.epochs; ++epoch) {
+  for(int epoch = opt.resume_from_epoch; epoch < opt.epochs; ++epoch) {
     std::cerr << "Epoch " << epoch << " begins." << std::endl;
 
     auto subw_path = output_dir / fs::path(opt.subwords_prefix
                                            + std::to_string(epoch));
 
+    // the subwords of this epoch, for the vocabulary and the statistics
+    auto subwords = std::make_shared<const std::vector<std::string>>(
+        subword_vocab.index_to_word);
+    size_t subwords_bytes = 0;
+    for(const auto& subword : *subwords)
+      subwords_bytes += sizeof(std::string) + subword.size();
+
     std::cerr << "Saving subword vocabulary to " << subw_path << std::endl;
-    save_strings(subw_path, subword_vocab.index_to_word);
+    {
+      ScopedTimer timer("save subwords");
+      writer.write(subw_path, subwords_bytes, [subwords](std::ostream& os) {
+        write_lines(os, *subwords);
+      });
+    }
+    profiler().count("subwords", subword_vocab.size());
+
+    // indices of the subwords in the initial vocabulary
+    std::vector<int> initial_index(subword_vocab.size());
+    for(int i = 0; i < subword_vocab.size(); ++i)
+      initial_index[i] = initial_subword_vocab[subword_vocab[i]];
+
+    // subwords whose embeddings are computed in this epoch
+    std::vector<int> computed_subwords;
+    for(int i = 0; i < subword_vocab.size(); ++i) {
+      if(!opt.incremental || epoch == 0
+         || a_sub_inv[i] != incremental.computed_words[initial_index[i]])
+        computed_subwords.push_back(i);
+    }
+    profiler().count("computed_subwords", computed_subwords.size());
 
     std::cerr << "Calculating word-subword cooccurrence matrix. " << std::endl;
-    Eigen::MatrixXf c_sub(subword_vocab.size(), word_count); // = a_sub * c_v;
-    word_subword_cooccurrences(
-        c_sub, word_vocab, subword_vocab, a_sub_inv, sparse_c_v);
+    Eigen::MatrixXf c_sub; // = a_sub * c_v;
+    {
+      ScopedTimer timer("word_subword_cooccurrences");
+      c_sub.setZero(computed_subwords.size(), word_count);
+      word_subword_cooccurrences(c_sub, computed_subwords, a_sub_inv,
+                                 sparse_c_v);
+      profiler().count("subword_cooccurrence_nonzeros",
+                       (c_sub.array() != 0).count());
+    }
 
     std::cerr << "Computing subword embeddings" << std::endl;
 
-    c_sub.array() += 0.00001f;
-    Eigen::VectorXf sums = c_sub.rowwise().sum();
-    Eigen::MatrixXf normed = c_sub.array().log().matrix().colwise() - sums.array().log().matrix();
-    Eigen::MatrixXf subword_embeddings =  normed * pinv;
+    Eigen::MatrixXf normed;
+    {
+      ScopedTimer timer("log normalize");
+      c_sub.array() += 0.00001f;
+      Eigen::VectorXf sums = c_sub.rowwise().sum();
+      normed = c_sub.array().log().matrix().colwise()
+               - sums.array().log().matrix();
+    }
+
+    Eigen::MatrixXf subword_embeddings;
+    {
+      ScopedTimer timer("matmul");
+      if(opt.deterministic)
+        deterministic_product(subword_embeddings, normed, pinv);
+      else
+        subword_embeddings = normed * pinv;
+    }
+
+    if(opt.incremental) {
+      ScopedTimer timer("update embeddings");
+      long moved_subwords = 0;
+      for(int r = 0; r < computed_subwords.size(); ++r) {
+        int g = initial_index[computed_subwords[r]];
+        incremental.computed_embeddings.row(g) = subword_embeddings.row(r);
+        incremental.computed_words[g] = a_sub_inv[computed_subwords[r]];
+
+        auto computed = incremental.computed_embeddings.row(g);
+        auto segmented = incremental.segmented_embeddings.row(g);
+        float moved = (computed - segmented).norm();
+        if(epoch == 0
+           || moved > opt.incremental_threshold * segmented.norm()) {
+          incremental.changed[g] = 1;
+          segmented = computed;
+          ++moved_subwords;
+        }
+      }
+      profiler().count("moved_subwords", moved_subwords);
+
+      subword_embeddings.resize(subword_vocab.size(), pinv.cols());
+      for(int i = 0; i < subword_vocab.size(); ++i)
+        subword_embeddings.row(i) =
+            incremental.computed_embeddings.row(initial_index[i]);
+    }
+
+    std::cerr << "Counting new subword-word cooccurrences." << std::endl;
+
+    // words whose candidate subwords changed since their last segmentation
+    std::vector<int> segmented_words;
+    for(int i = 0; i < word_count; ++i) {
+      bool segment = !opt.incremental || epoch == 0
+                     || std::any_of(candidates[i].begin(), candidates[i].end(),
+                                    [&incremental](int g) {
+                                      return incremental.changed[g];
+                                    });
+      if(segment)
+        segmented_words.push_back(i);
+    }
+    std::fill(incremental.changed.begin(), incremental.changed.end(), 0);
+
+    {
+      ScopedTimer timer("viterbi");
+#pragma omp parallel for
+      for(int k = 0; k < segmented_words.size(); ++k) {
+        int i = segmented_words[k];
+        std::string word = word_vocab[i];
+        word_segmentations[i].clear();
+        viterbi_decode(word_segmentations[i], word,
+                       word_vocab.emb.row(word_vocab[word]), subword_vocab,
+                       subword_embeddings);
+      } // word
+      profiler().count("segmentations", segmented_words.size());
+    }
 
     auto checkpoint_path = output_dir / fs::path(opt.embeddings_prefix
                                                  + std::to_string(epoch));
     std::cerr << "Saving checkpoint to " << checkpoint_path << std::endl;
-    save_embedding_checkpoint(checkpoint_path, subword_embeddings);
-
-    std::cerr << "Counting new subword-word cooccurrences." << std::endl;
-    InverseAllowedSubstringMap a_sub_inv_next; // maps subword to pairs word and score
+    {
+      ScopedTimer timer("save embeddings");
+      auto embeddings = std::make_shared<const Eigen::MatrixXf>(
+          std::move(subword_embeddings));
+      writer.write(checkpoint_path, embeddings->size() * sizeof(float),
+                   [embeddings](std::ostream& os) {
+                     write_embeddings(os, *embeddings);
+                   });
+    }
 
     // připravit novou matici A pomocí for cyklu níže:
+    InverseAllowedSubstrings a_sub_inv_next(subword_vocab.size()); // words segmented with each subword
     std::vector<std::string> segmented_vocab(word_count);
     std::vector<int> unigram_freqs(subword_vocab.size());
     std::vector<std::unordered_map<std::string, int>> bigram_freqs(subword_vocab.size());
 
-#pragma omp parallel for
-    for(int i = 0; i < word_count; ++i) {
-      std::string word = word_vocab[i];
-      int w_freq = word_frequencies[i];
-      std::vector<std::string> segm;
-
-      viterbi_decode(segm, word, word_vocab.emb.row(word_vocab[word]), subword_vocab, subword_embeddings);
-
-      std::pair<std::string, float> word_pair{word, 1.0};
+    {
+      ScopedTimer timer("segmentation statistics");
+      for(int i = 0; i < word_count; ++i) {
+        int w_freq = word_frequencies[i];
 
-      std::string sep = "";
-      std::ostringstream oss;
-      int prev_sub_index = subword_vocab[bow];
-      unigram_freqs[prev_sub_index] += w_freq;
+        std::string sep = "";
+        std::ostringstream oss;
+        int prev_sub_index = subword_vocab[bow];
+        unigram_freqs[prev_sub_index] += w_freq;
 
-      for(auto it = segm.begin(); it != segm.end(); ++it) {
-        std::string subword = *it;
-        oss << sep << subword;
-        sep = " ";
+        for(const auto& subword : word_segmentations[i]) {
+          oss << sep << subword;
+          sep = " ";
 
-        // This is the case of single-byte OOVs - in this case, we can just
-        // ignore them
-        if(!subword_vocab.contains(subword))
-          continue;
+          // This is the case of single-character OOVs - in this case, we can
+          // just ignore them
+          if(!subword_vocab.contains(subword))
+            continue;
 
-#pragma omp critical
-        {
           int index = subword_vocab[subword];
           unigram_freqs[index] += w_freq;
-
-          if(bigram_freqs[prev_sub_index].count(subword) == 0)
-            bigram_freqs[prev_sub_index].insert({subword, 0});
-          bigram_freqs[prev_sub_index].at(subword) += w_freq;
+          bigram_freqs[prev_sub_index][subword] += w_freq;
           prev_sub_index = index;
 
-          if(a_sub_inv_next.count(subword) == 0)
-            a_sub_inv_next.insert({subword, std::vector<std::pair<std::string, float>>{word_pair}});
-          else
-            a_sub_inv_next.at(subword).push_back(word_pair);
+          a_sub_inv_next[index].push_back({i, 1.0});
         }
-
+        segmented_vocab[i] = oss.str();
       }
-      segmented_vocab[i] = oss.str();
-    } // word
+    }
 
     auto segmentations_path = output_dir / fs::path(opt.segmentations_prefix
                                                     + std::to_string(epoch));
 
     std::cerr << "Saving segmentations to " << segmentations_path << std::endl;
-    save_strings(segmentations_path, segmented_vocab);
+    {
+      ScopedTimer timer("save segmentations");
+      size_t segmentations_bytes = 0;
+      for(const auto& segmentation : segmented_vocab)
+        segmentations_bytes += sizeof(std::string) + segmentation.size();
+      auto segmentations = std::make_shared<const std::vector<std::string>>(
+          std::move(segmented_vocab));
+      writer.write(segmentations_path, segmentations_bytes,
+                   [segmentations](std::ostream& os) {
+                     write_lines(os, *segmentations);
+                   });
+    }
 
     // save unigram and bigram stats
     auto unigrams_path = output_dir / fs::path(opt.unigrams_prefix
@@ -374,38 +558,90 @@ int main(int argc, char* argv[]) {
     auto bigrams_path = output_dir / fs::path(opt.bigrams_prefix
                                               + std::to_string(epoch));
 
-    std::ofstream uniofs(unigrams_path);
-    std::ofstream biofs(bigrams_path);
-
-    for(int i = 0; i < subword_vocab.size(); ++i) {
-      std::string unigram = subword_vocab[i];
-      uniofs << unigram << "\t" << unigram_freqs[i] << std::endl;
-
-      for(auto pair : bigram_freqs[i]) {
-        biofs << unigram << "\t" << pair.first << "\t" << pair.second
-              << std::endl;
+    {
+      ScopedTimer timer("save statistics");
+      size_t bigrams_bytes = 0;
+      for(const auto& successors : bigram_freqs) {
+        bigrams_bytes += sizeof(successors);
+        for(const auto& pair : successors)
+          bigrams_bytes += sizeof(pair) + pair.first.size() + sizeof(void*);
       }
+      auto unigrams = std::make_shared<const std::vector<int>>(
+          std::move(unigram_freqs));
+      auto bigrams = std::make_shared<
+          const std::vector<std::unordered_map<std::string, int>>>(
+              std::move(bigram_freqs));
+      writer.write(unigrams_path, unigrams->size() * sizeof(int),
+                   [subwords, unigrams](std::ostream& os) {
+                     write_unigram_stats(os, *subwords, *unigrams);
+                   });
+      writer.write(bigrams_path, bigrams_bytes,
+                   [subwords, bigrams](std::ostream& os) {
+                     write_bigram_stats(os, *subwords, *bigrams,
+                                        opt.deterministic);
+                   });
     }
 
-    uniofs.close();
-    biofs.close();
-
 
     // create new subword vocabulary -> filter subwords which are not used in
     // any segmentation
-    auto filter_unused = [&a_sub_inv_next](std::string subword) {
-      return a_sub_inv_next.count(subword) > 0;
+    auto filter_unused = [&a_sub_inv_next, &subword_vocab](std::string subword) {
+      return !a_sub_inv_next[subword_vocab[subword]].empty();
     };
 
     auto new_subwords = subword_vocab.index_to_word | std::views::filter(filter_unused);
 
     // UPDATE
-    subword_vocab = Vocab(new_subwords, true);
-    std::cerr << "Updated subword vocabulary size: " << subword_vocab.size() << std::endl;
+    Vocab new_subword_vocab(new_subwords, true);
+    std::cerr << "Updated subword vocabulary size: " << new_subword_vocab.size() << std::endl;
+
+    // the words of the removed subwords need a new segmentation
+    if(opt.incremental) {
+      for(int i = 0; i < subword_vocab.size(); ++i) {
+        if(!new_subword_vocab.contains(subword_vocab[i]))
+          incremental.changed[initial_index[i]] = 1;
+      }
+    }
 
-    a_sub_inv = a_sub_inv_next;
+    a_sub_inv.assign(new_subword_vocab.size(), {});
+    for(int i = 0; i < new_subword_vocab.size(); ++i) {
+      const std::string& subword = new_subword_vocab[i];
+      if(subword_vocab.contains(subword))
+        a_sub_inv[i] = std::move(a_sub_inv_next[subword_vocab[subword]]);
+    }
+    subword_vocab = std::move(new_subword_vocab);
+
+    if(opt.checkpoint) {
+      auto state_path = output_dir / fs::path(
+          opt.checkpoint_prefix + std::to_string(epoch + 1));
+      std::cerr << "Saving training state to " << state_path << std::endl;
+      ScopedTimer timer("save checkpoint");
+      // a checkpoint implies that the outputs of its epochs are complete
+      try {
+        writer.wait();
+      } catch(const std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+      save_training_checkpoint(state_path, subword_vocab, a_sub_inv,
+                               opt.incremental ? &incremental : nullptr,
+                               word_segmentations);
+    }
 
+    if(report.is_open())
+      profiler().write_report(report, "epoch", epoch);
   } // epoch
 
+  try {
+    ScopedTimer timer("wait for outputs");
+    writer.wait();
+  } catch(const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  if(!opt.trace_file.empty())
+    profiler().write_trace(opt.trace_file);
+
   return 0;
 }
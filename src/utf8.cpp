@@ -0,0 +1,98 @@
+#include "utf8.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "unicode_alnum.h"
+
+
+int utf8_decode(std::string_view text, size_t pos, char32_t& codepoint) {
+  unsigned char lead = text[pos];
+
+  if(lead < 0x80) {
+    codepoint = lead;
+    return 1;
+  }
+
+  int length;
+  char32_t min_codepoint;
+  if((lead & 0xE0) == 0xC0) {
+    length = 2;
+    min_codepoint = 0x80;
+    codepoint = lead & 0x1F;
+  } else if((lead & 0xF0) == 0xE0) {
+    length = 3;
+    min_codepoint = 0x800;
+    codepoint = lead & 0x0F;
+  } else if((lead & 0xF8) == 0xF0) {
+    length = 4;
+    min_codepoint = 0x10000;
+    codepoint = lead & 0x07;
+  } else {
+    codepoint = invalid_codepoint;
+    return 1;
+  }
+
+  if(pos + length > text.size()) {
+    codepoint = invalid_codepoint;
+    return 1;
+  }
+
+  for(int i = 1; i < length; ++i) {
+    unsigned char byte = text[pos + i];
+    if((byte & 0xC0) != 0x80) {
+      codepoint = invalid_codepoint;
+      return 1;
+    }
+    codepoint = (codepoint << 6) | (byte & 0x3F);
+  }
+
+  // reject overlong encodings, surrogates and values beyond Unicode
+  if(codepoint < min_codepoint || codepoint > 0x10FFFF
+     || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+    codepoint = invalid_codepoint;
+    return 1;
+  }
+
+  return length;
+}
+
+
+void utf8_boundaries(std::vector<int>& boundaries, std::string_view text) {
+  boundaries.clear();
+  boundaries.reserve(text.size() + 1);
+
+  char32_t codepoint;
+  for(size_t pos = 0; pos < text.size(); pos += utf8_decode(text, pos, codepoint))
+    boundaries.push_back(pos);
+
+  boundaries.push_back(text.size());
+}
+
+
+bool is_alnum(char32_t codepoint) {
+  if(codepoint < 0x80)
+    return (codepoint >= '0' && codepoint <= '9')
+        || (codepoint >= 'A' && codepoint <= 'Z')
+        || (codepoint >= 'a' && codepoint <= 'z');
+
+  // find the first range that ends at or after the code point
+  auto range = std::lower_bound(
+      std::begin(unicode_alnum_ranges), std::end(unicode_alnum_ranges),
+      codepoint,
+      [](const char32_t (&r)[2], char32_t cp) { return r[1] < cp; });
+
+  return range != std::end(unicode_alnum_ranges) && (*range)[0] <= codepoint;
+}
+
+
+bool is_space(char32_t codepoint) {
+  if(codepoint < 0x80)
+    return codepoint == ' ' || (codepoint >= '\t' && codepoint <= '\r')
+        || (codepoint >= 0x1C && codepoint <= 0x1F);
+
+  return codepoint == 0x85 || codepoint == 0xA0 || codepoint == 0x1680
+      || (codepoint >= 0x2000 && codepoint <= 0x200A)
+      || codepoint == 0x2028 || codepoint == 0x2029 || codepoint == 0x202F
+      || codepoint == 0x205F || codepoint == 0x3000;
+}
@@ -0,0 +1,30 @@
+#ifndef SSEG_UTF8_H_
+#define SSEG_UTF8_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Marks a byte that does not start a well-formed UTF-8 sequence.
+const char32_t invalid_codepoint = 0xFFFFFFFF;
+
+// Decodes the UTF-8 sequence starting at byte `pos` of `text`, stores the code
+// point in `codepoint` and returns the length of the sequence in bytes.
+// Malformed, overlong or truncated sequences are consumed one byte at a time
+// and decode to `invalid_codepoint`.
+int utf8_decode(std::string_view text, size_t pos, char32_t& codepoint);
+
+// Fills `boundaries` with the byte offsets at which the code points of `text`
+// begin, followed by `text.size()`, so that unit i spans the bytes
+// [boundaries[i], boundaries[i + 1]). Bytes which are not part of a well-formed
+// sequence become units of their own, which is the explicit byte fallback for
+// malformed input.
+void utf8_boundaries(std::vector<int>& boundaries, std::string_view text);
+
+// Returns true for code points that Python's str.isalnum() accepts.
+bool is_alnum(char32_t codepoint);
+
+// Returns true for code points that Python's str.isspace() accepts.
+bool is_space(char32_t codepoint);
+
+#endif  // SSEG_UTF8_H_
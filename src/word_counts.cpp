@@ -0,0 +1,210 @@
+#include "word_counts.h"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "substring_stats.h"
+
+namespace {
+
+const char magic[8] = {'L', 'E', 'G', 'R', 'O', 'S', 'W', 'C'};
+const uint32_t format_version = 1;
+const size_t stream_buffer_size = 1 << 20;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t window_size;
+  uint64_t vocabulary_size;
+  uint64_t vocabulary_fingerprint;
+  uint64_t lines;
+  uint64_t tokens;
+  uint64_t pairs;
+};
+
+Header to_header(const WordCountsInfo& info) {
+  Header header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = format_version;
+  header.window_size = info.window_size;
+  header.vocabulary_size = info.vocabulary_size;
+  header.vocabulary_fingerprint = info.vocabulary_fingerprint;
+  header.lines = info.lines;
+  header.tokens = info.tokens;
+  header.pairs = info.pairs;
+  return header;
+}
+
+}  // namespace
+
+
+uint64_t vocabulary_fingerprint(const Vocab& words) {
+  // FNV-1a over the words, each terminated by a newline
+  uint64_t hash = 14695981039346656037ULL;
+  for(const auto& word : words.index_to_word) {
+    for(unsigned char c : word)
+      hash = (hash ^ c) * 1099511628211ULL;
+    hash = (hash ^ '\n') * 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+void count_word_cooccurrences(std::vector<WordPairCount>& pairs,
+                              WordCountsInfo& info,
+                              const Vocab& words,
+                              std::istream& corpus,
+                              int window_size,
+                              bool pretokenize_input) {
+  info = WordCountsInfo();
+  info.window_size = window_size;
+  info.vocabulary_size = words.size();
+  info.vocabulary_fingerprint = vocabulary_fingerprint(words);
+  info.word_frequencies.assign(words.size(), 0);
+
+  SparseStats stats(words.size(), words.size());
+  long tokens = 0;
+  info.lines = populate_word_stats<SparseStats>(
+      stats, info.word_frequencies, words, corpus, window_size,
+      pretokenize_input, tokens);
+  info.tokens = tokens;
+
+  std::vector<int64_t> indptr;
+  std::vector<int32_t> indices;
+  std::vector<double> counts;
+  stats.to_csr(indptr, indices, counts);
+
+  pairs.clear();
+  pairs.reserve(counts.size());
+  for(int word = 0; word < words.size(); ++word) {
+    for(int64_t k = indptr[word]; k < indptr[word + 1]; ++k)
+      pairs.push_back({(uint32_t)word, (uint32_t)indices[k],
+                       (uint64_t)counts[k]});
+  }
+  info.pairs = pairs.size();
+}
+
+
+WordCountsReader::WordCountsReader(const std::string& path)
+    : path(path), buffer(stream_buffer_size) {
+  is.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+  is.open(path, std::ios::binary);
+
+  Header file_header;
+  is.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
+  if(!is || std::memcmp(file_header.magic, magic, sizeof(magic)) != 0)
+    throw std::runtime_error("Cannot read word counts from '" + path + "'");
+  if(file_header.version != format_version)
+    throw std::runtime_error(
+        "Word counts '" + path + "' are of another version");
+
+  header.window_size = file_header.window_size;
+  header.vocabulary_size = file_header.vocabulary_size;
+  header.vocabulary_fingerprint = file_header.vocabulary_fingerprint;
+  header.lines = file_header.lines;
+  header.tokens = file_header.tokens;
+  header.pairs = file_header.pairs;
+
+  // the sizes are bounded by the file one by one, so that a corrupted header
+  // cannot make us allocate arbitrary amounts of memory
+  is.seekg(0, std::ios::end);
+  uint64_t file_size = is.tellg();
+  is.seekg(sizeof(Header));
+  uint64_t data_size = is ? file_size - sizeof(Header) : 0;
+  if(!is || header.vocabulary_size > data_size / sizeof(uint64_t)
+     || header.pairs > data_size / sizeof(WordPairCount)
+     || data_size != header.vocabulary_size * sizeof(uint64_t)
+                     + header.pairs * sizeof(WordPairCount))
+    throw std::runtime_error(
+        "Word counts '" + path + "' are truncated or corrupted");
+
+  header.word_frequencies.resize(header.vocabulary_size);
+  is.read(reinterpret_cast<char*>(header.word_frequencies.data()),
+          header.word_frequencies.size() * sizeof(uint64_t));
+  if(!is)
+    throw std::runtime_error("Word counts '" + path + "' are truncated");
+  remaining = header.pairs;
+}
+
+
+bool WordCountsReader::next(WordPairCount& pair) {
+  if(remaining == 0)
+    return false;
+  is.read(reinterpret_cast<char*>(&pair), sizeof(pair));
+  if(!is)
+    throw std::runtime_error("Word counts '" + path + "' are truncated");
+
+  // the merge relies on the pairs being sorted and unique
+  uint64_t key = (uint64_t)pair.word << 32 | pair.context;
+  if(pair.word >= header.vocabulary_size
+     || pair.context >= header.vocabulary_size
+     || (remaining < header.pairs && key <= previous_key))
+    throw std::runtime_error("Word counts '" + path + "' are corrupted");
+  previous_key = key;
+  --remaining;
+  return true;
+}
+
+
+WordCountsWriter::WordCountsWriter(const std::string& path,
+                                   const WordCountsInfo& info)
+    : path(path), buffer(stream_buffer_size), header(info) {
+  os.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+  os.open(path, std::ios::binary);
+
+  // the number of pairs is rewritten by `close`
+  Header file_header = to_header(header);
+  os.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+  os.write(reinterpret_cast<const char*>(header.word_frequencies.data()),
+           header.word_frequencies.size() * sizeof(uint64_t));
+  if(!os)
+    throw std::runtime_error("Cannot write word counts to '" + path + "'");
+}
+
+
+void WordCountsWriter::add(const WordPairCount& pair) {
+  os.write(reinterpret_cast<const char*>(&pair), sizeof(pair));
+  ++written;
+}
+
+
+void WordCountsWriter::close() {
+  header.pairs = written;
+  Header file_header = to_header(header);
+  os.seekp(0);
+  os.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+  os.close();
+  if(!os)
+    throw std::runtime_error("Cannot write word counts to '" + path + "'");
+}
+
+
+void load_word_counts(const std::string& path,
+                      const Vocab& words,
+                      std::vector<std::unordered_map<int, int>>& sparse_c_v,
+                      std::vector<int>& word_frequencies) {
+  WordCountsReader reader(path);
+  const WordCountsInfo& info = reader.info();
+  if(info.vocabulary_size != words.size()
+     || info.vocabulary_fingerprint != vocabulary_fingerprint(words))
+    throw std::runtime_error(
+        "Word counts '" + path + "' are of another vocabulary");
+
+  // the training counts in int
+  auto too_large = [&path](uint64_t count) {
+    if(count > std::numeric_limits<int>::max())
+      throw std::runtime_error(
+          "Word counts '" + path + "' exceed the range of the training");
+  };
+  for(uint64_t frequency : info.word_frequencies)
+    too_large(frequency);
+  word_frequencies.assign(info.word_frequencies.begin(),
+                          info.word_frequencies.end());
+
+  sparse_c_v.assign(words.size(), {});
+  for(WordPairCount pair; reader.next(pair);) {
+    too_large(pair.count);
+    sparse_c_v[pair.word][pair.context] = pair.count;
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef SSEG_WORD_COUNTS_H_
+#define SSEG_WORD_COUNTS_H_
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vocabs.h"
+
+// Word cooccurrence counts of a corpus or of a shard of it, as written by
+// legros-count and merged by legros-merge. The file starts with a header
+// (the window size, the vocabulary, identified by its size and fingerprint,
+// and the numbers of lines, tokens and pairs), followed by the frequency of
+// every word and by the pairs of a word and a context word with their count,
+// sorted by the word and then by the context word. The sorting lets any
+// number of files be merged in a single streaming pass.
+
+struct WordCountsInfo {
+  uint32_t window_size = 0;
+  uint64_t vocabulary_size = 0;
+  uint64_t vocabulary_fingerprint = 0;
+  uint64_t lines = 0;
+  uint64_t tokens = 0;
+  uint64_t pairs = 0;
+  std::vector<uint64_t> word_frequencies;
+};
+
+struct WordPairCount {
+  uint32_t word;
+  uint32_t context;
+  uint64_t count;
+};
+
+// Hash of the words of `words` in their order; counts are only merged and
+// used with the same vocabulary.
+uint64_t vocabulary_fingerprint(const Vocab& words);
+
+// Counts the cooccurrences of the words of `words` in `corpus` within
+// `window_size` tokens with populate_word_stats, as the training does,
+// filling the sorted `pairs` and `info`.
+void count_word_cooccurrences(std::vector<WordPairCount>& pairs,
+                              WordCountsInfo& info,
+                              const Vocab& words,
+                              std::istream& corpus,
+                              int window_size,
+                              bool pretokenize_input = false);
+
+// Reads a counts file sequentially. Throws std::runtime_error when the file
+// cannot be read, is truncated, or has pairs out of order or out of the
+// vocabulary.
+class WordCountsReader {
+ public:
+  explicit WordCountsReader(const std::string& path);
+
+  const WordCountsInfo& info() const { return header; }
+
+  // Reads the next pair, false after the last one.
+  bool next(WordPairCount& pair);
+
+ private:
+  std::string path;
+  std::vector<char> buffer;
+  std::ifstream is;
+  WordCountsInfo header;
+  uint64_t remaining;
+  uint64_t previous_key = 0;  // the last word and context
+};
+
+// Writes a counts file; the pairs are added in the sorted order. Throws
+// std::runtime_error on failure.
+class WordCountsWriter {
+ public:
+  // `info.pairs` is ignored, `close` writes the number of added pairs.
+  WordCountsWriter(const std::string& path, const WordCountsInfo& info);
+
+  void add(const WordPairCount& pair);
+  void close();
+
+  uint64_t pairs() const { return written; }
+
+ private:
+  std::string path;
+  std::vector<char> buffer;
+  std::ofstream os;
+  WordCountsInfo header;
+  uint64_t written = 0;
+};
+
+// Loads a counts file into the structures of the training, the rows of
+// `sparse_c_v` being the words and the columns the context words. Throws
+// std::runtime_error when the counts are of another vocabulary or do not fit
+// in int.
+void load_word_counts(const std::string& path,
+                      const Vocab& words,
+                      std::vector<std::unordered_map<int, int>>& sparse_c_v,
+                      std::vector<int>& word_frequencies);
+
+#endif  // SSEG_WORD_COUNTS_H_